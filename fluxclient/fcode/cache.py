@@ -0,0 +1,245 @@
+# !/usr/bin/env python3
+
+import hashlib
+import logging
+import tempfile
+import struct
+import json
+import os
+
+from fluxclient import __version__
+
+logger = logging.getLogger(__name__)
+
+# blake2b is much faster than sha1 on large gcode, but only exists >= 3.6
+_hash = getattr(hashlib, 'blake2b', hashlib.sha1)
+
+CACHE_MAGIC = b'FCC1'
+CACHE_SUFFIX = '.fcc'
+DEFAULT_MAX_SIZE = 256 * 1024 * 1024  # bytes
+READ_CHUNK = 1024 * 1024
+# bump when the converters change their output without a new release,
+# entries of another revision or release are never hit
+CONVERTER_REVISION = 2
+
+
+def default_cache_dir():
+    return os.environ.get('FLUX_FCODE_CACHE',
+                          os.path.join(os.path.expanduser("~"), ".fluxclient_fcode_cache"))
+
+
+class FcodeCache(object):
+    """
+    on-disk cache of converted fcode, keyed by the gcode content and the
+    conversion parameters
+
+    every entry is one file: magic, uint32 header length, json header
+    (metadata, empty layers, blob sizes) and then the blobs (fcode, path_bin,
+    path_js). Entries are written to a temp file and renamed in place, so
+    several processes can share one cache directory, a reader either sees a
+    whole entry or nothing. Least recently used entries (by mtime, touched on
+    every hit) are removed when the directory grows over max_size.
+    """
+    def __init__(self, root=None, max_size=DEFAULT_MAX_SIZE):
+        super(FcodeCache, self).__init__()
+        self.root = root if root else default_cache_dir()
+        self.max_size = max_size
+        os.makedirs(self.root, exist_ok=True)
+
+    @classmethod
+    def make_key(cls, source, head_type="EXTRUDER", config=None, G92_delta=None,
+                 pause_at_layers=None, layer_events=None, ext_metadata=None, image=None,
+                 engine=None, record_path=True):
+        """
+        source[in]: gcode as a file path, bytes or binary file object
+        return a hex key
+        """
+        h = _hash()
+        params = {
+            'version': __version__,
+            'revision': CONVERTER_REVISION,
+            'head_type': head_type,
+            'engine': engine,
+            'record_path': bool(record_path),
+            'config': config,
+            'G92_delta': list(G92_delta) if G92_delta else None,
+            'pause_at_layers': sorted(pause_at_layers) if pause_at_layers else None,
+            'layer_events': [list(e) for e in layer_events] if layer_events else None,
+            'ext_metadata': ext_metadata,
+        }
+        h.update(json.dumps(params, sort_keys=True, default=str).encode())
+        h.update(_hash(image).digest() if image else b'\0')
+
+        if type(source) == bytes:
+            h.update(source)
+        elif type(source) == str:
+            with open(source, 'rb') as f:
+                cls._update_from_file(h, f)
+        else:
+            cls._update_from_file(h, source)
+        return h.hexdigest()
+
+    @staticmethod
+    def _update_from_file(h, f):
+        buf = f.read(READ_CHUNK)
+        while buf:
+            h.update(buf)
+            buf = f.read(READ_CHUNK)
+
+    def _entry_path(self, key):
+        return os.path.join(self.root, key + CACHE_SUFFIX)
+
+    def get(self, key):
+        """
+        return a dict with 'fcode', 'metadata', 'empty_layer', 'path_bin' and
+        'path_js', or None when missing
+        """
+        filename = self._entry_path(key)
+        try:
+            with open(filename, 'rb') as f:
+                data = f.read()
+        except (FileNotFoundError, PermissionError):
+            return None
+
+        try:
+            entry = self._decode(data)
+        except ValueError:
+            logger.warning("Drop broken fcode cache entry %s", key)
+            self._remove(filename)
+            return None
+
+        try:
+            os.utime(filename, None)  # mark as recently used
+        except OSError:
+            pass
+        return entry
+
+    def put(self, key, fcode, metadata, empty_layer=(), path_bin=None, path_js=None):
+        blobs = [('fcode', fcode)]
+        if path_bin is not None:
+            blobs.append(('path_bin', path_bin))
+        if path_js is not None:
+            blobs.append(('path_js', path_js.encode() if type(path_js) == str else path_js))
+
+        header = json.dumps({
+            'metadata': metadata,
+            'empty_layer': list(empty_layer),
+            'blobs': [[name, len(blob)] for name, blob in blobs],
+        }, default=str).encode()
+
+        fd, tmp_filename = tempfile.mkstemp(dir=self.root, suffix='.tmp')
+        try:
+            with os.fdopen(fd, 'wb') as f:
+                f.write(CACHE_MAGIC)
+                f.write(struct.pack('<I', len(header)))
+                f.write(header)
+                for _, blob in blobs:
+                    f.write(blob)
+            os.replace(tmp_filename, self._entry_path(key))
+        except Exception:
+            self._remove(tmp_filename)
+            raise
+
+        self.evict()
+
+    def evict(self):
+        """
+        remove least recently used entries until the cache fits max_size
+        """
+        entries = []
+        total = 0
+        for name in os.listdir(self.root):
+            if not name.endswith(CACHE_SUFFIX):
+                continue
+            filename = os.path.join(self.root, name)
+            try:
+                st = os.stat(filename)
+            except FileNotFoundError:  # evicted by another process
+                continue
+            entries.append((st.st_mtime, st.st_size, filename))
+            total += st.st_size
+
+        if total <= self.max_size:
+            return
+        entries.sort()
+        for _, size, filename in entries:
+            self._remove(filename)
+            total -= size
+            if total <= self.max_size:
+                break
+
+    def clear(self):
+        for name in os.listdir(self.root):
+            if name.endswith(CACHE_SUFFIX):
+                self._remove(os.path.join(self.root, name))
+
+    def process(self, converter, input_path, output_stream):
+        """
+        run converter(GcodeToFcodeCpp or GcodeToFcode).process on input_path
+        unless the same conversion is cached, write fcode into output_stream
+
+        return the cached entry on hit, None when converted; on a hit
+        converter.md and converter.empty_layer are restored but the native
+        path is not, use entry['path_js'] and entry['path_bin'] instead
+        """
+        key = self.make_key(input_path,
+                            head_type=converter.md.get('HEAD_TYPE'),
+                            config=converter.config,
+                            G92_delta=converter.G92_delta,
+                            pause_at_layers=getattr(converter, 'pause_at_layers', None),
+                            layer_events=getattr(converter, 'layer_events', None),
+                            ext_metadata=converter.md,
+                            image=converter.image,
+                            engine=getattr(converter, 'engine', None),
+                            record_path=getattr(converter, 'record_path', True))
+        entry = self.get(key)
+        if entry:
+            output_stream.write(entry['fcode'])
+            converter.md = entry['metadata']
+            converter.empty_layer = entry['empty_layer']
+            return entry
+
+        start = output_stream.tell()
+        with open(input_path, 'r') as f:
+            converter.process(f, output_stream)
+        output_stream.seek(start)
+        fcode = output_stream.read()
+
+        path_js = path_bin = None
+        if getattr(converter, 'record_path', True):
+            path_js = converter.get_path('js')
+            path_bin = converter.get_path('bin')
+        try:
+            self.put(key, fcode, converter.md, converter.empty_layer, path_bin, path_js)
+        except OSError:
+            logger.exception("Can not write fcode cache")
+        return None
+
+    @staticmethod
+    def _decode(data):
+        if data[:4] != CACHE_MAGIC or len(data) < 8:
+            raise ValueError('Bad magic')
+        header_len = struct.unpack('<I', data[4:8])[0]
+        offset = 8 + header_len
+        try:
+            header = json.loads(data[8:offset].decode())
+        except (UnicodeDecodeError, ValueError):
+            raise ValueError('Bad header')
+
+        entry = {'metadata': header['metadata'], 'empty_layer': header['empty_layer'],
+                 'path_bin': None, 'path_js': None}
+        for name, size in header['blobs']:
+            entry[name] = data[offset:offset + size]
+            offset += size
+        if offset != len(data):
+            raise ValueError('Truncated entry')
+        if entry['path_js'] is not None:
+            entry['path_js'] = entry['path_js'].decode()
+        return entry
+
+    @staticmethod
+    def _remove(filename):
+        try:
+            os.remove(filename)
+        except OSError:
+            pass
@@ -46,6 +46,9 @@ class FcodeBase(object):
         if path_type == 'js':
             self.T.join()
             return self.path_js
+        elif path_type == 'bin':
+            self.T.join()
+            return Tools().path_to_bin(self.path)
         else:
             if self.path:
                 return self.path
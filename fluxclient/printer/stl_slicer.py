@@ -19,6 +19,7 @@ import numpy as np
 from fluxclient.scanner.tools import dot, normal, normalize, dotX, normalX
 from fluxclient.utils._utils import GcodeToFcodeCpp, Tools
 from fluxclient.fcode.g_to_f import GcodeToFcode
+from fluxclient.fcode.cache import FcodeCache
 from fluxclient.hw_profile import HW_PROFILE
 from fluxclient.printer.flux_raft import Raft
 from fluxclient.printer import ini_string, ini_string_cura2, ini_constraint, ignore, ini_flux_params
@@ -26,6 +27,9 @@ from fluxclient.printer import _printer
 
 logger = logging.getLogger(__name__)
 
+PREVIEW_FACES = 100000  # face limit of preview meshes
+QUICK_SLICE_FACES = 200000  # larger models are simplified before quick_slice
+
 
 def rreplace(s, old, new, occurrence):
     li = s.rsplit(old, occurrence)
@@ -52,8 +56,9 @@ class StlSlicer(object):
 
     def reset(self, slic3r):
         self.working_p = []  # process that are slicing
-        self.models = {}  # models data, store the buf(stl file)
+        self.models = {}  # models data, MeshObj of each uploaded model
         self.parameter = {}  # model's parameter
+        self.previews = {}  # simplified models for display, (max_faces, stl bytes)
 
         # self.slic3r = '../Slic3r/slic3r.pl'  # slic3r's location
         # self.slic3r = '/Applications/Slic3r.app/Contents/MacOS/slic3r'
@@ -67,6 +72,8 @@ class StlSlicer(object):
         self.image = b''
         self.ext_metadata = {'CORRECTION': 'A'}
         self.path_js = None
+        self.path_bin = None
+        self.fcode_cache = None  # FcodeCache, opened by the first convert_gcode
         self.setting_slicer = "slic3r"
         self.version = 0
         self.T = None
@@ -75,6 +82,7 @@ class StlSlicer(object):
         self.working_p = other.working_p
         self.models = other.models
         self.parameter = other.parameter
+        self.previews = other.previews
         self.config = other.config
         self.path = None
         self.image = b''
@@ -85,6 +93,7 @@ class StlSlicer(object):
         """
         upload a model's data in stl as bytes data
         """
+        self.previews.pop(name, None)
         try:
             if buf_type == 'stl':
                 self.models[name] = self.read_stl(buf)
@@ -110,7 +119,7 @@ class StlSlicer(object):
         """
         logger.debug('duplicate in:{} out:{}'.format(name_in, name_out))
         if name_in in self.models:
-            self.models[name_out] = [self.models[name_in][0], self.models[name_in][1]]
+            self.models[name_out] = self.models[name_in]  # meshes are copied before transform
             return True
         else:
             return False
@@ -150,6 +159,7 @@ class StlSlicer(object):
         """
         if name in self.models:
             del self.models[name]
+            self.previews.pop(name, None)
             if name in self.parameter:
                 del self.parameter[name]
             return True, 'OK'
@@ -167,6 +177,43 @@ class StlSlicer(object):
         else:
             return "%s not upload yet" % (name)
 
+    def arrange(self, names=None, spacing=2.):
+        """
+        place models side by side on the plate, turning them about z, and record their parameters
+        rotation about x, y, scale and z of a model already set are kept
+        names[in]: models to place, all uploaded ones by default
+        spacing[in]: least gap between models, in mm
+        return dict of name to its new parameter, None for a model without room
+        """
+        if names is None:
+            names = list(self.models)
+        meshes = []
+        for n in names:
+            parameter = self.parameter.get(n, [0, 0, 0, 0, 0, 0, 1, 1, 1])
+            m_mesh = self.models[n].copy()
+            m_mesh.apply_transform([0, 0, 0, parameter[3], parameter[4], 0] + list(parameter[6:9]))
+            meshes.append(m_mesh)
+
+        placements = _printer.arrange(meshes, HW_PROFILE['model-1']['radius'], spacing / 2.)
+        result = {}
+        for n, m_mesh, placement in zip(names, meshes, placements):
+            if placement is None:
+                result[n] = None
+                continue
+            x, y, rz = placement
+            if n in self.parameter:
+                z = self.parameter[n][2]
+                parameter = list(self.parameter[n])
+            else:
+                # new model rests on the plate
+                z = -m_mesh.bounding_box()[0][2]
+                parameter = [0, 0, 0, 0, 0, 0, 1, 1, 1]
+            parameter[0:3] = [x, y, z]
+            parameter[5] = rz
+            self.parameter[n] = parameter
+            result[n] = parameter
+        return result
+
     def advanced_setting(self, lines):
         """
         user input  setting content
@@ -230,14 +277,153 @@ class StlSlicer(object):
         logger.info("Converted path to json")
         self.T = None
 
-    def get_path(self):
+    def convert_gcode(self, m_GcodeToFcode, gcode_file, fcode_output):
+        """
+        convert gcode_file into fcode_output, reuse the cached result when
+        the same gcode was converted with the same settings before
+        return: path(None when cached), path_js, path_bin
+        """
+        # the cache directory is only made once something is converted,
+        # FLUX_FCODE_CACHE=0 turns it off
+        if self.fcode_cache is None and os.environ.get('FLUX_FCODE_CACHE') != '0':
+            try:
+                self.fcode_cache = FcodeCache()
+            except OSError:
+                logger.exception("Fcode cache disabled")
+        if self.fcode_cache is None:
+            with open(gcode_file, 'r') as f:
+                m_GcodeToFcode.process(f, fcode_output)
+            return m_GcodeToFcode.trim_ends(m_GcodeToFcode.path), m_GcodeToFcode.get_path('js'), None
+
+        entry = self.fcode_cache.process(m_GcodeToFcode, gcode_file, fcode_output)
+        if entry:
+            logger.info("Fcode cache hit: %s", gcode_file)
+            return None, entry['path_js'], entry['path_bin']
+        # the cache stored path_bin, it's kept on the converter
+        return m_GcodeToFcode.trim_ends(m_GcodeToFcode.path), m_GcodeToFcode.get_path('js'), m_GcodeToFcode.get_path('bin')
+
+    def get_path(self, path_type='js'):
         """
+        path_type[in]: 'js' for json string, 'bin' for binary preview bytes
         """
         if self.T:
             self.T.join()
         logger.debug("Returning get path")
+        if path_type == 'bin':
+            if self.path_bin is None and self.path:
+                self.path_bin = Tools().path_to_bin(self.path)
+            return self.path_bin
         return self.path_js
 
+    def preview(self, name, max_faces=PREVIEW_FACES):
+        """
+        model [name] simplified to at most max_faces faces for display
+        return binary stl in bytes, or None if [name] is not uploaded
+        """
+        if name not in self.models:
+            return None
+        cached = self.previews.get(name)
+        if cached is None or cached[0] != max_faces:
+            m_mesh = self.models[name]
+            if len(m_mesh) > max_faces:
+                m_mesh = m_mesh.decimate(max_faces)
+            cached = (max_faces, bytes(m_mesh.dumps()))
+            self.previews[name] = cached
+        return cached[1]
+
+    def merge_models(self, names, max_faces=None, cut_bottom=None):
+        """
+        place each model by its transform as an instance of a shared mesh,
+        the bottom is cut off when cut_bottom is set
+        max_faces[in]: models with more faces are simplified to this first
+        cut_bottom[in]: height to cut at, config cut_bottom by default
+        return MeshInstances, geometry is only expanded when it's written or merged
+        """
+        if cut_bottom is None:
+            cut_bottom = float(self.config['cut_bottom'])
+        # turning about z and moving in xy are left to the instances,
+        # so models sharing a mesh, height, tilt and scale are transformed and cut once
+        bases = {}
+        instances = _printer.MeshInstances()
+        for n in names:
+            parameter = self.parameter[n]
+            key = (id(self.models[n]), parameter[2], parameter[3], parameter[4]) + tuple(parameter[6:9])
+            if key not in bases:
+                if max_faces and len(self.models[n]) > max_faces:
+                    m_mesh = self.models[n].decimate(max_faces)
+                else:
+                    m_mesh = self.models[n].copy()
+                m_mesh.apply_transform([0, 0] + list(parameter[2:5]) + [0] + list(parameter[6:9]))
+                if cut_bottom > 0:
+                    m_mesh = m_mesh.cut(cut_bottom)
+                bases[key] = m_mesh
+            instances.add(bases[key], parameter[0], parameter[1], parameter[5])
+        return instances
+
+    def config_float(self, key, base=1.):
+        """
+        value of a config entry, percentage is relative to base
+        """
+        value = self.config[key].strip()
+        if value.endswith('%'):
+            return float(value[:-1]) * base / 100.
+        return float(value)
+
+    def quick_slice(self, names):
+        """
+        estimate print time and filament from cross sections of the models,
+        without running the slicer. meant for previews, a full slicing is still
+        needed for the real numbers
+        :param list names: names of stl that need to be estimated
+        :return:
+            if success:
+                True, metadata([TIME_COST, FILAMENT_USED])
+            else:
+                False, error message
+        """
+        for n in names:
+            if not (n in self.models and n in self.parameter):
+                return False, 'id:%s is not setted yet' % (n)
+        if not names:
+            return False, 'no model to slice'
+
+        m_mesh_merge = self.merge_models(names, QUICK_SLICE_FACES)
+        top = m_mesh_merge.bounding_box()[1][2]
+
+        first_height = self.config_float('first_layer_height', self.config_float('layer_height'))
+        layer_height = self.config_float('layer_height')
+        heights = [first_height]
+        if top > first_height:
+            heights += [layer_height] * int(np.ceil((top - first_height) / layer_height))
+        heights = np.array(heights)
+        # cut at the middle of each layer
+        zs = np.cumsum(heights) - heights / 2
+        stats = m_mesh_merge.layer_stats(zs)
+        area, perimeter = np.abs(stats[:, 0]), stats[:, 1]
+
+        nozzle = self.config_float('extrusion_width', layer_height)
+        if nozzle <= 0:
+            nozzle = 0.4
+        perimeters = self.config_float('perimeters')
+        solid = np.zeros(len(zs), dtype=bool)
+        solid[:int(self.config_float('bottom_solid_layers'))] = True
+        if int(self.config_float('top_solid_layers')):
+            solid[-int(self.config_float('top_solid_layers')):] = True
+        density = np.where(solid, 1., self.config_float('fill_density', 1.))
+
+        # path length of walls and infill on each layer
+        wall = perimeter * perimeters
+        fill = np.maximum(area - wall * nozzle, 0) * density / nozzle
+
+        perimeter_speed = np.full(len(zs), self.config_float('perimeter_speed'))
+        infill_speed = np.full(len(zs), self.config_float('infill_speed'))
+        perimeter_speed[0] = infill_speed[0] = self.config_float('first_layer_speed', self.config_float('perimeter_speed'))
+        time_cost = float(np.sum(wall / perimeter_speed + fill / infill_speed))
+
+        volume = np.sum((wall + fill) * nozzle * heights) * self.config_float('extrusion_multiplier')
+        filament_used = float(volume / (np.pi * (self.config_float('filament_diameter') / 2) ** 2))
+        return True, [time_cost, filament_used]
+
     def begin_slicing(self, names, ws, output_type):
         """
         :param list names: names of stl that need to be sliced
@@ -268,19 +454,7 @@ class StlSlicer(object):
         tmp = tempfile.NamedTemporaryFile(dir=temp_dir, suffix='.ini', delete=False)
         tmp_slic3r_setting_file = tmp.name  # store gcode
 
-        m_mesh_merge = None
-
-        for n in names:
-            points, faces = self.models[n]
-            m_mesh = _printer.MeshObj(points, faces)
-            m_mesh.apply_transform(self.parameter[n])
-            if m_mesh_merge is None:
-                m_mesh_merge = m_mesh
-            else:
-                m_mesh_merge.add_on(m_mesh)
-
-        if float(self.config['cut_bottom']) > 0:
-            m_mesh_merge = m_mesh_merge.cut(float(self.config['cut_bottom']))
+        m_mesh_merge = self.merge_models(names)
 
         bounding_box = m_mesh_merge.bounding_box()
         cx, cy = (bounding_box[0][0] + bounding_box[1][0]) / 2., (bounding_box[0][1] + bounding_box[1][1]) / 2.
@@ -362,23 +536,21 @@ class StlSlicer(object):
                 tmp -= 16
             ext_metadata['HEAD_ERROR_LEVEL'] = str(tmp)
 
-            with open(tmp_gcode_file, 'r') as f:
-                status_list.append('{"slice_status": "computing", "message": "Analyzing Metadata++", "percentage": 0.99}')
-                m_GcodeToFcode = GcodeToFcodeCpp(ext_metadata=ext_metadata)
-                m_GcodeToFcode.config = config
-                m_GcodeToFcode.image = image
-                m_GcodeToFcode.process(f, fcode_output)
-                path = m_GcodeToFcode.trim_ends(m_GcodeToFcode.path)
-                metadata = m_GcodeToFcode.md
-                metadata = [float(metadata['TIME_COST']), float(metadata['FILAMENT_USED'].split(',')[0])]
-                if slic3r_error or len(m_GcodeToFcode.empty_layer) > 0:
-                    status_list.append('{"slice_status": "warning", "message" : "%s"}' % ("{} empty layers, might be error when slicing {}".format(len(m_GcodeToFcode.empty_layer), repr(m_GcodeToFcode.empty_layer))))
-
-                if float(m_GcodeToFcode.md['MAX_R']) >= HW_PROFILE['model-1']['radius']:
-                    fail_flag = True
-                    slic3r_out = [6, "Gcode area was too big"]  # errorcode 6
+            status_list.append('{"slice_status": "computing", "message": "Analyzing Metadata++", "percentage": 0.99}')
+            m_GcodeToFcode = GcodeToFcodeCpp(ext_metadata=ext_metadata)
+            m_GcodeToFcode.config = config
+            m_GcodeToFcode.image = image
+            path, path_js, path_bin = self.convert_gcode(m_GcodeToFcode, tmp_gcode_file, fcode_output)
+            metadata = m_GcodeToFcode.md
+            metadata = [float(metadata['TIME_COST']), float(metadata['FILAMENT_USED'].split(',')[0])]
+            if slic3r_error or len(m_GcodeToFcode.empty_layer) > 0:
+                status_list.append('{"slice_status": "warning", "message" : "%s"}' % ("{} empty layers, might be error when slicing {}".format(len(m_GcodeToFcode.empty_layer), repr(m_GcodeToFcode.empty_layer))))
+
+            if float(m_GcodeToFcode.md['MAX_R']) >= HW_PROFILE['model-1']['radius']:
+                fail_flag = True
+                slic3r_out = [6, "Gcode area was too big"]  # errorcode 6
 
-                del m_GcodeToFcode
+            del m_GcodeToFcode
 
             if output_type == '-g':
                 with open(tmp_gcode_file, 'rb') as f:
@@ -414,7 +586,7 @@ class StlSlicer(object):
                 path = None
             status_list.append([False, slic3r_out, path])
         else:
-            status_list.append([output, metadata, path])
+            status_list.append([output, metadata, path, path_js, path_bin])
 
     def end_slicing(self, exit_reason=""):
         """
@@ -470,12 +642,14 @@ class StlSlicer(object):
                             msg = '{"slice_status": "error", "error": "%d", "info": "%s"}' % (message[1][0], message[1][1])
 
                     self.path = message[2]
-
-                    if self.path:
-                        self.path_js = None
-                        from threading import Thread  # Do not expose thrading in module level
-                        self.T = Thread(target=self.sub_convert_path)
-                        self.T.start()
+                    self.path_js = message[3] if len(message) > 3 else None
+                    self.path_bin = message[4] if len(message) > 4 else None
+
+                    if self.path or self.path_js:
+                        if self.path_js is None:
+                            from threading import Thread  # Do not expose thrading in module level
+                            self.T = Thread(target=self.sub_convert_path)
+                            self.T.start()
                         ret.append(msg)
                     else:
                         ret.append('{"slice_status": "error", "error": "%d", "info": "%s"}' % (16, 'UNDEFINED_SLICING_ERROR'))
@@ -583,97 +757,9 @@ class StlSlicer(object):
     def read_stl(cls, file_data):
         """
         file_data[in]: string indicating a a file path, or a bytes that is the content of stl file
-        read in stl
+        read in stl, return a MeshObj
         """
-        # ref: https://en.wikipedia.org/wiki/STL_(file_format)
-        if type(file_data) == str:
-            with open(file_data, 'rb') as f:
-                file_data = f.read()
-                byte_order = '@'
-        elif type(file_data) == bytes:
-            byte_order = '<'
-        else:
-            raise ValueError('wrong stl data type: %s' % str(type(file_data)))
-
-        points_list = []
-        points_map = {}  # key: points, value: index
-        counter = 0
-        faces = np.zeros(0, dtype=np.int)
-        if cls.ascii_or_binary(file_data, byte_order):
-            tFaces = []
-            # ascii stl file
-            instl = StringIO(file_data.decode('utf8'))
-
-            read_until(instl)  # read in: "solid [name]"
-            while True:
-                t = read_until(instl)  # read in: "facet normal 0 0 0"
-
-                # if not t.startswith('endsolid'):  # end of file
-                if t.startswith('endsolid'):
-                    tt = read_until(instl)
-                    if len(tt) == 0:
-                        break
-                    else:
-                        continue
-
-                read_normal = tuple(map(float, (t.split()[-3:])))
-                read_until(instl)   # outer loop
-                v0 = tuple(map(float, (read_until(instl).split()[-3:])))
-                v1 = tuple(map(float, (read_until(instl).split()[-3:])))
-                v2 = tuple(map(float, (read_until(instl).split()[-3:])))
-                if dotX(v0, v1, v2, read_normal) < 0:
-                    v1, v2 = v2, v1
-
-                read_until(instl)  # read in: "endloop"
-                read_until(instl)  # read in: "endfacet"
-
-                for v in [v0, v1, v2]:
-                    pIdx = points_map.get(v, None)
-                    if pIdx is None:
-                        points_map[v] = counter
-                        pIdx = counter
-                        points_list.append(v)
-                        counter += 1
-                    tFaces.append(pIdx)
-            # Compact python list to nparray
-            logger.info("np array convert (ascii) %d " % len(tFaces))
-            faces = np.array(tFaces, dtype=np.int)
-            del tFaces
-            gc.collect()
-        else:
-            # binary stl file
-            header = file_data[:80]
-            length = unpack(byte_order + 'I', file_data[80:84])[0]
-
-            patten = byte_order + 'fff'
-            index = 84
-
-            # declare static type np array
-            faces = np.zeros(length * 3, dtype=np.int)
-            fptr = 0
-
-            for i in range(length):
-                read_normal = unpack(patten, file_data[index + (4 * 3 * 0):index + (4 * 3 * 1)])
-                v0 = unpack(patten, file_data[index + (4 * 3 * 1):index + (4 * 3 * 2)])
-                v1 = unpack(patten, file_data[index + (4 * 3 * 2):index + (4 * 3 * 3)])
-                v2 = unpack(patten, file_data[index + (4 * 3 * 3):index + (4 * 3 * 4)])
-                if dotX(v0, v1, v2, read_normal) < 0:
-                    v1, v2 = v2, v1
-
-                for v in [v0, v1, v2]:
-                    pIdx = points_map.get(v, None)
-                    if pIdx is None:
-                        points_map[v] = counter
-                        pIdx = counter
-                        points_list.append(v)
-                        counter += 1
-                    faces[fptr] = pIdx
-                    fptr = fptr + 1
-                index += 50
-            logger.info("np array convert (bin) %d" % faces.size)
-
-        logger.debug("Faces[0] type %s ", type(faces).__name__)
-        return _printer.MeshCloud(points_list), faces
+        return _printer.MeshObj.from_stl(file_data)
 
     @classmethod
     def read_obj(cls, file_data):
@@ -709,8 +795,7 @@ class StlSlicer(object):
                 else:
                     faces[i][j] = len(points_list) + faces[i][j]
 
-        logger.debug("Faces[0] type %s ", type(faces).__name__)
-        return _printer.MeshCloud(points_list), faces
+        return _printer.MeshObj(_printer.MeshCloud(points_list), faces)
 
 
 class StlSlicerCura(StlSlicer):
@@ -794,30 +879,14 @@ class StlSlicerCura(StlSlicer):
 
         if old_transform != current_transform:  # Need to regenerate new stl
             logger.info('Generating transformed stl')
-            # Applying transform to each mesh object, and merge to m_mesh_merge
-            for n in names:
-                m_mesh = _printer.MeshObj(self.models[n][0], self.models[n][1])
-
-                if self.is_aborted(p_index):
-                    return logger.info('Worker #%d aborted' % p_index)
-
-                m_mesh.apply_transform(self.parameter[n])
-
-                if self.is_aborted(p_index):
-                    return logger.info('Worker #%d aborted' % p_index)
-
-                if m_mesh_merge is None:
-                    m_mesh_merge = m_mesh
-                else:
-                    m_mesh_merge.add_on(m_mesh)
+            # Applying transform to each mesh object, copies of a model share its geometry
+            if float(config['cut_bottom']) > 0:
+                status_list.append('{"slice_status": "computing", "message": "Performing cut_bottom", "percentage": 0.04}')
+            m_mesh_merge = self.merge_models(names, cut_bottom=float(config['cut_bottom']))
 
             if self.is_aborted(p_index):
                 return logger.info('Worker #%d aborted' % p_index)
 
-            if float(config['cut_bottom']) > 0:
-                status_list.append('{"slice_status": "computing", "message": "Performing cut_bottom", "percentage": 0.04}')
-                m_mesh_merge = m_mesh_merge.cut(float(config['cut_bottom']))
-
             logger.info('Writing new stl')
             status_list.append('{"slice_status": "computing", "message": "Writing new stl", "percentage": 0.05}')
             m_mesh_merge.write_stl(tmp_stl_file)
@@ -938,25 +1007,23 @@ class StlSlicerCura(StlSlicer):
                 tmp -= 16
             ext_metadata['HEAD_ERROR_LEVEL'] = str(tmp)
 
-            with open(tmp_gcode_file, 'r') as f:
-                m_GcodeToFcode = GcodeToFcodeCpp(ext_metadata=ext_metadata)
-                m_GcodeToFcode.engine = 'cura'
-                # m_GcodeToFcode.process_path = self.process_path
-                m_GcodeToFcode.config = config
-                m_GcodeToFcode.image = image
-                m_GcodeToFcode.process(f, fcode_output)
-                path = m_GcodeToFcode.trim_ends(m_GcodeToFcode.path)
-                metadata = m_GcodeToFcode.md
-                metadata = [float(metadata['TIME_COST']), float(metadata['FILAMENT_USED'].split(',')[0])]
-                if slicer_error or len(m_GcodeToFcode.empty_layer) > 0:
-                    status_list.append('{"slice_status": "warning", "message" : "%s"}' % ("{} empty layers, might be error when slicing {}".format(len(m_GcodeToFcode.empty_layer), repr(m_GcodeToFcode.empty_layer))))
-
-                if float(m_GcodeToFcode.md['MAX_R']) >= HW_PROFILE['model-1']['radius']:
-                    logger.info("CuraEngine: gcode out of range")
-                    fail_flag = True
-                    slicer_out = [6, "Gcode area too big MAX_R=%s" % str(m_GcodeToFcode.md['MAX_R'])]  # errorcode 6
+            m_GcodeToFcode = GcodeToFcodeCpp(ext_metadata=ext_metadata)
+            m_GcodeToFcode.engine = 'cura'
+            # m_GcodeToFcode.process_path = self.process_path
+            m_GcodeToFcode.config = config
+            m_GcodeToFcode.image = image
+            path, path_js, path_bin = self.convert_gcode(m_GcodeToFcode, tmp_gcode_file, fcode_output)
+            metadata = m_GcodeToFcode.md
+            metadata = [float(metadata['TIME_COST']), float(metadata['FILAMENT_USED'].split(',')[0])]
+            if slicer_error or len(m_GcodeToFcode.empty_layer) > 0:
+                status_list.append('{"slice_status": "warning", "message" : "%s"}' % ("{} empty layers, might be error when slicing {}".format(len(m_GcodeToFcode.empty_layer), repr(m_GcodeToFcode.empty_layer))))
+
+            if float(m_GcodeToFcode.md['MAX_R']) >= HW_PROFILE['model-1']['radius']:
+                logger.info("CuraEngine: gcode out of range")
+                fail_flag = True
+                slicer_out = [6, "Gcode area too big MAX_R=%s" % str(m_GcodeToFcode.md['MAX_R'])]  # errorcode 6
 
-                del m_GcodeToFcode
+            del m_GcodeToFcode
 
             if output_type == '-g':
                 with open(tmp_gcode_file, 'rb') as f:
@@ -996,7 +1063,7 @@ class StlSlicerCura(StlSlicer):
             logger.info("CuraEngine: Appended path to status_list (failed)")
         else:
             logger.info("CuraEngine: Appended path to status_list")
-            status_list.append([output, metadata, path])
+            status_list.append([output, metadata, path, path_js, path_bin])
 
     @classmethod
     def generate_cura2_config(cls, file_path, content, delete=None):
@@ -231,7 +231,7 @@ class PcProcess():
 
         elif file_format == 'stl':
             pc_mesh = self.to_mesh(name)
-            mesh_l = pc_mesh.STL_to_List()
+            mesh_l = pc_mesh.triangles()
             if mode == 'ascii':
                 strbuf = StringIO()
                 ##################### fake code ###########################
@@ -293,7 +293,7 @@ class PcProcess():
 
         elif file_format == 'stl':
             pc_mesh = self.to_mesh(name)
-            mesh_l = pc_mesh.STL_to_List()
+            mesh_l = pc_mesh.triangles()
             if mode == 'ascii':
                 strbuf = StringIO()
                 ##################### fake code ###########################
@@ -5,6 +5,8 @@ import sys
 from math import sqrt
 from io import StringIO
 
+import numpy as np
+
 
 # PCL NOTE: http://docs.pointclouds.org/1.7.0/structpcl_1_1_point_x_y_z_r_g_b.html
 # uint32_t rgb = ((uint32_t)r << 16 | (uint32_t)g << 8 | (uint32_t)b);
@@ -48,6 +50,23 @@ def normal(v):
     b = [v[2][0] - v[0][0], v[2][1] - v[0][1], v[2][2] - v[0][2]]  # vector v0 -> v2
     return [a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]]  # cross product -> surface normal vector
 
+def stl_records(tri):
+    """
+    binary stl records of float[M, 3, 3] numpy array tri,
+    same values as normal(), normalize() and struct.pack on each triangle
+    """
+    v = np.asarray(tri, dtype=np.float64)
+    n = np.cross(v[:, 1] - v[:, 0], v[:, 2] - v[:, 0])
+    l = np.sqrt(n[:, 0] ** 2 + n[:, 1] ** 2 + n[:, 2] ** 2)
+    nonzero = l != 0
+    n[nonzero] /= l[nonzero, None]
+
+    records = np.zeros(len(v), dtype=[('normal', 'f4', 3), ('v', 'f4', (3, 3)), ('attr', 'u2')])
+    records['normal'] = n
+    records['v'] = v
+    return records
+
+
 def normalX(v0, v1, v2):
     """
       compute normal of a vangle surface,
@@ -181,6 +200,8 @@ def write_stl(tri, output='model.stl', mode='binary'):
                             (xyz each point, 3 points for each triangle, triangles for a model)
     use bytesIO for binary output
     use StringsIO for ascii output
+    tri can also be a float[M, 3, 3] numpy array, binary mode then writes
+    all records at once
 
     """
     if type(output) == str:
@@ -192,7 +213,12 @@ def write_stl(tri, output='model.stl', mode='binary'):
     else:
         outstl = output
 
-    if mode == 'binary':
+    if mode == 'binary' and isinstance(tri, np.ndarray):
+        outstl.write(b'FLUX 3d printer: flux3dp.com, 2015'.ljust(80, b' '))
+        outstl.write(struct.pack("@I", len(tri)))
+        outstl.write(stl_records(tri).tobytes())
+
+    elif mode == 'binary':
         Header = b'FLUX 3d printer: flux3dp.com, 2015'
 
         for i in range(80):
@@ -262,6 +262,14 @@ def create_pcl_extentions():
         'fluxclient.printer._printer',
         sources=[
             "src/printer/printer_module.cpp",
+            "src/printer/mesh_io.cpp",
+            "src/printer/layer_slicer.cpp",
+            "src/printer/mesh_topology.cpp",
+            "src/printer/mesh_decimate.cpp",
+            "src/printer/mesh_orientation.cpp",
+            "src/printer/plate_arrange.cpp",
+            "src/printer/triangle_bvh.cpp",
+            "src/printer/tree_support.cpp",
             "src/printer/printer.pyx"],
         language="c++",
         extra_compile_args=extra_compile_args,
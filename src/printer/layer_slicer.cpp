@@ -0,0 +1,182 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+
+#include "layer_slicer.h"
+#include "parallel.h"
+
+
+static uint64_t edge_key(uint32_t a, uint32_t b){
+  return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
+
+static void edge_point(const Mesh &triangles, uint32_t a, uint32_t b, float z, float* p){
+  // intersection of edge a, b and plane z
+  // always from the smaller index, the same edge gives the same point in both faces
+  if(a > b){
+    std::swap(a, b);
+  }
+  const float* pa = triangles.point(a);
+  const float* pb = triangles.point(b);
+  float t = (z - pa[2]) / (pb[2] - pa[2]);
+  p[0] = pa[0] + t * (pb[0] - pa[0]);
+  p[1] = pa[1] + t * (pb[1] - pa[1]);
+}
+
+static void slice_one(const Mesh &triangles, const uint32_t* layer_faces, size_t count, Layer &layer){
+  // each crossing face gives a segment from one of its crossing edges to the other,
+  // segments are chained into polygons through an index of the crossing edges,
+  // only edges crossing this plane are indexed
+  float z = layer.z;
+  std::unordered_map<uint64_t, uint32_t> node;  // edge -> segment end point
+  std::vector<float> xy;
+  std::vector<uint32_t> next;
+  std::vector<uint8_t> has_prev;
+  node.reserve(count * 2);
+  xy.reserve(count * 2);
+  next.reserve(count);
+
+  for (size_t k = 0; k < count; k += 1){
+    uint32_t f = layer_faces[k];
+    const uint32_t* v = &triangles.faces[f * 3];
+    int above[3], above_size = 0;
+    for (int j = 0; j < 3; j += 1){
+      // a point on the plane counts as above, so a face never touches the plane
+      // at a single point without crossing it
+      above[j] = triangles.point(v[j])[2] >= z;
+      above_size += above[j];
+    }
+    if(above_size == 0 || above_size == 3){
+      continue;
+    }
+
+    // r: the point alone on its side, the segment crosses edges (r, r + 1) and (r + 2, r)
+    int r = 0;
+    while(above[r] != (above_size == 1)){
+      r += 1;
+    }
+    uint32_t ends[2] = {v[(r + 1) % 3], v[(r + 2) % 3]};
+    if(above_size == 2){
+      // r below, walk the other way to keep solid on the left
+      std::swap(ends[0], ends[1]);
+    }
+
+    uint32_t id[2];
+    for (int j = 0; j < 2; j += 1){
+      std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> ins = node.insert(std::make_pair(edge_key(v[r], ends[j]), (uint32_t)next.size()));
+      if(ins.second){
+        float p[2];
+        edge_point(triangles, v[r], ends[j], z, p);
+        xy.insert(xy.end(), p, p + 2);
+        next.push_back(UINT32_MAX);
+        has_prev.push_back(0);
+      }
+      id[j] = ins.first->second;
+    }
+    if(next[id[0]] == UINT32_MAX && !has_prev[id[1]]){
+      next[id[0]] = id[1];
+      has_prev[id[1]] = 1;
+    }
+  }
+
+  // open chains first, from points without previous, then the closed loops
+  std::vector<uint8_t> used(next.size(), 0);
+  layer.start.push_back(0);
+  for (int pass = 0; pass < 2; pass += 1){
+    for (size_t s = 0; s < next.size(); s += 1){
+      if(used[s] || (pass == 0 && has_prev[s])){
+        continue;
+      }
+      size_t first = layer.points.size();
+      uint32_t cur = s;
+      bool closed = false;
+      while(cur != UINT32_MAX){
+        if(used[cur]){
+          closed = cur == s;
+          break;
+        }
+        used[cur] = 1;
+        size_t size = layer.points.size();
+        // skip repeated points where the plane passes through a vertex
+        if(size == first || layer.points[size - 2] != xy[cur * 2] || layer.points[size - 1] != xy[cur * 2 + 1]){
+          layer.points.push_back(xy[cur * 2]);
+          layer.points.push_back(xy[cur * 2 + 1]);
+        }
+        cur = next[cur];
+      }
+      size_t n = (layer.points.size() - first) / 2;
+      if(closed && n > 1 && layer.points[first] == layer.points[first + n * 2 - 2] && layer.points[first + 1] == layer.points[first + n * 2 - 1]){
+        layer.points.resize(layer.points.size() - 2);
+        n -= 1;
+      }
+      if(n < 2 || (closed && n < 3)){
+        layer.points.resize(first);
+        continue;
+      }
+
+      if(closed){
+        const float* p = &layer.points[first];
+        for (size_t i = 0; i < n; i += 1){
+          size_t j = (i + 1) % n;
+          layer.area += ((double)p[i * 2] * p[j * 2 + 1] - (double)p[j * 2] * p[i * 2 + 1]) / 2;
+          layer.perimeter += hypot(p[j * 2] - p[i * 2], p[j * 2 + 1] - p[i * 2 + 1]);
+        }
+      }
+      layer.start.push_back(layer.points.size() / 2);
+      layer.closed.push_back(closed);
+    }
+  }
+}
+
+int slice_layers(MeshPtr triangles, const float* zs, size_t nz, std::vector<Layer> &layers){
+  // cross sections of the mesh at each z in zs, zs must be ascending
+  for (size_t i = 1; i < nz; i += 1){
+    if(zs[i] < zs[i - 1]){
+      return SLICE_Z_NOT_SORTED;
+    }
+  }
+  layers.assign(nz, Layer());
+  for (size_t i = 0; i < nz; i += 1){
+    layers[i].z = zs[i];
+    layers[i].area = 0;
+    layers[i].perimeter = 0;
+  }
+
+  const Mesh &mesh = *triangles;
+  size_t m = mesh.face_count();
+
+  // bucket faces into layers they cross: zmin < z <= zmax
+  std::vector<uint32_t> first_layer(m), last_layer(m);
+  std::vector<size_t> offset(nz + 1, 0);
+  for (size_t f = 0; f < m; f += 1){
+    float lo = mesh.face_point(f, 0)[2], hi = lo;
+    for (int j = 1; j < 3; j += 1){
+      lo = std::min(lo, mesh.face_point(f, j)[2]);
+      hi = std::max(hi, mesh.face_point(f, j)[2]);
+    }
+    first_layer[f] = std::upper_bound(zs, zs + nz, lo) - zs;
+    last_layer[f] = std::upper_bound(zs, zs + nz, hi) - zs;
+    for (uint32_t l = first_layer[f]; l < last_layer[f]; l += 1){
+      offset[l + 1] += 1;
+    }
+  }
+  for (size_t l = 0; l < nz; l += 1){
+    offset[l + 1] += offset[l];
+  }
+  std::vector<uint32_t> layer_faces(offset[nz]);
+  std::vector<size_t> fill(offset.begin(), offset.end() - 1);
+  for (size_t f = 0; f < m; f += 1){
+    for (uint32_t l = first_layer[f]; l < last_layer[f]; l += 1){
+      layer_faces[fill[l]++] = f;
+    }
+  }
+
+  // layers are independent from here
+  parallel_for(nz, parallel_workers(offset[nz], FACES_PER_WORKER / 4), [&](size_t begin, size_t end, size_t w){
+    for (size_t l = begin; l < end; l += 1){
+      slice_one(mesh, layer_faces.data() + offset[l], offset[l + 1] - offset[l], layers[l]);
+    }
+  });
+  return 0;
+}
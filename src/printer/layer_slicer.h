@@ -0,0 +1,26 @@
+#ifndef LAYER_SLICER_H
+#define LAYER_SLICER_H
+
+#include <stdint.h>
+#include <vector>
+#include "printer_module.h"
+
+struct Layer{
+  // cross section of a mesh at height z
+  // polygon i is points [start[i], start[i + 1]), each point is x, y
+  // closed polygons run counterclockwise around solid and clockwise around holes,
+  // open ones come from holes or non-manifold edges in the mesh
+  float z;
+  std::vector<float> points;
+  std::vector<uint32_t> start;
+  std::vector<uint8_t> closed;
+  double area;  // signed area of closed polygons, holes subtracted
+  double perimeter;  // length of closed polygons
+};
+
+// error code for slice_layers
+#define SLICE_Z_NOT_SORTED -1
+
+int slice_layers(MeshPtr triangles, const float* zs, size_t nz, std::vector<Layer> &layers);
+
+#endif
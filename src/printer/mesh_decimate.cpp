@@ -0,0 +1,424 @@
+#include <math.h>
+#include <algorithm>
+#include <queue>
+#include <utility>
+
+#include "mesh_decimate.h"
+#include "mesh_topology.h"
+#include "parallel.h"
+
+
+struct Quadric{
+  // symmetric 4x4 matrix of sum of squared distance to planes
+  // aa ab ac ad bb bc bd cc cd dd
+  double q[10];
+
+  Quadric(){
+    std::fill(q, q + 10, 0.0);
+  }
+
+  void add_plane(const double n[3], double d, double w){
+    // plane n . p + d = 0, n is unit length
+    q[0] += w * n[0] * n[0]; q[1] += w * n[0] * n[1]; q[2] += w * n[0] * n[2]; q[3] += w * n[0] * d;
+    q[4] += w * n[1] * n[1]; q[5] += w * n[1] * n[2]; q[6] += w * n[1] * d;
+    q[7] += w * n[2] * n[2]; q[8] += w * n[2] * d;
+    q[9] += w * d * d;
+  }
+
+  Quadric& operator+=(const Quadric &other){
+    for (int i = 0; i < 10; i += 1){
+      q[i] += other.q[i];
+    }
+    return *this;
+  }
+
+  double error(const double p[3]) const{
+    double x = p[0], y = p[1], z = p[2];
+    return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+         + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+         + q[7] * z * z + 2 * q[8] * z + q[9];
+  }
+
+  bool optimal(double p[3]) const{
+    // point of minimum error, false if the matrix is close to singular
+    double a = q[0], b = q[1], c = q[2], e = q[4], f = q[5], i = q[7];
+    double det = a * (e * i - f * f) - b * (b * i - f * c) + c * (b * f - e * c);
+    double scale = a * e * i;
+    if(fabs(det) <= 1e-9 * fabs(scale) || det == 0){
+      return false;
+    }
+    double r0 = -q[3], r1 = -q[6], r2 = -q[8];
+    p[0] = (r0 * (e * i - f * f) - b * (r1 * i - f * r2) + c * (r1 * f - e * r2)) / det;
+    p[1] = (a * (r1 * i - f * r2) - r0 * (b * i - f * c) + c * (b * r2 - r1 * c)) / det;
+    p[2] = (a * (e * r2 - r1 * f) - b * (b * r2 - r1 * c) + r0 * (b * f - e * c)) / det;
+    return true;
+  }
+};
+
+struct Candidate{
+  // collapse of edge (u, v), kept small for the heap
+  // stale when cost doesn't match any more, a newer one was pushed then
+  float cost;
+  uint32_t u, v;
+
+  bool operator>(const Candidate &other) const{
+    if(cost != other.cost){
+      return cost > other.cost;
+    }
+    return u != other.u ? u > other.u : v > other.v;
+  }
+};
+
+static void cross_of(const double* a, const double* b, const double* c, double n[3]){
+  // normal of triangle a, b, c, length is twice the area
+  double e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+  double e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+  n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+  n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+  n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static bool plane_of(const double* a, const double* b, const double* c, double n[3], double &d){
+  // unit normal and offset of triangle a, b, c, false if it has no area
+  cross_of(a, b, c, n);
+  double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+  if(len == 0){
+    return false;
+  }
+  n[0] /= len; n[1] /= len; n[2] /= len;
+  d = -(n[0] * a[0] + n[1] * a[1] + n[2] * a[2]);
+  return true;
+}
+
+class Decimator{
+public:
+  Decimator(const Mesh &mesh, const MeshTopology &topo) :
+    pos(mesh.points.begin(), mesh.points.end()), faces(mesh.faces),
+    quadric(mesh.point_count()), vertex_faces(mesh.point_count()),
+    face_alive(mesh.face_count(), 1),
+    locked(mesh.point_count(), 0), boundary(mesh.point_count(), 0),
+    live_faces(mesh.face_count()){
+    size_t m = mesh.face_count();
+    std::vector<double> normal(m * 3);
+    std::vector<uint8_t> has_normal(m);
+    for (size_t f = 0; f < m; f += 1){
+      double d = 0;
+      has_normal[f] = plane_of(p(faces[f * 3]), p(faces[f * 3 + 1]), p(faces[f * 3 + 2]), &normal[f * 3], d);
+      for (int j = 0; j < 3; j += 1){
+        if(has_normal[f]){
+          quadric[faces[f * 3 + j]].add_plane(&normal[f * 3], d, 1.0);
+        }
+        vertex_faces[faces[f * 3 + j]].push_back(f);
+      }
+    }
+
+    // boundary and sharp edges get planes through the edge, perpendicular to the face,
+    // edges shared by more than 2 faces or with flipped winding are never collapsed
+    for (uint32_t h = 0; h < topo.ring.size(); h += 1){
+      uint32_t a = topo.from(mesh, h), b = topo.to(mesh, h), g = topo.ring[h];
+      if(g == h){
+        boundary[a] = boundary[b] = 1;
+        constrain(h / 3, a, b, &normal[0], has_normal);
+      }
+      else if(topo.ring[g] != h || topo.from(mesh, g) == a){
+        locked[a] = locked[b] = 1;
+      }
+      else if(h < g && has_normal[h / 3] && has_normal[g / 3]){
+        const double* n1 = &normal[h / 3 * 3];
+        const double* n2 = &normal[g / 3 * 3];
+        if(n1[0] * n2[0] + n1[1] * n2[1] + n1[2] * n2[2] < DECIMATE_FEATURE_COS){
+          constrain(h / 3, a, b, &normal[0], has_normal);
+          constrain(g / 3, a, b, &normal[0], has_normal);
+        }
+      }
+    }
+
+    // every edge once, costs are independent
+    std::vector<Candidate> initial;
+    initial.reserve(topo.ring.size() / 2);
+    for (uint32_t h = 0; h < topo.ring.size(); h += 1){
+      uint32_t g = topo.ring[h];
+      if(g == h || h < g){
+        uint32_t a = topo.from(mesh, h), b = topo.to(mesh, h);
+        if(a != b){
+          Candidate c;
+          c.u = std::min(a, b);
+          c.v = std::max(a, b);
+          initial.push_back(c);
+        }
+      }
+    }
+    parallel_for(initial.size(), parallel_workers(initial.size(), FACES_PER_WORKER), [&](size_t begin, size_t end, size_t w){
+      for (size_t i = begin; i < end; i += 1){
+        double target[3];
+        initial[i].cost = collapse_cost(initial[i].u, initial[i].v, target);
+      }
+    });
+    heap = std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> >(std::greater<Candidate>(), std::move(initial));
+  }
+
+  void run(size_t target_faces, double max_cost){
+    std::vector<uint32_t> around;
+    while(!heap.empty() && live_faces > target_faces){
+      Candidate c = heap.top();
+      if(max_cost >= 0 && c.cost > max_cost){
+        break;
+      }
+      heap.pop();
+      if(vertex_faces[c.u].empty() || vertex_faces[c.v].empty()){
+        continue;
+      }
+      double target[3];
+      float cost = collapse_cost(c.u, c.v, target);
+      if(cost != c.cost || cost == INFINITY || !can_collapse(c.u, c.v, target)){
+        continue;
+      }
+      collapse(c.u, c.v, target);
+
+      // edges around the kept point have a new cost
+      neighbours(c.u, around);
+      for (size_t i = 0; i < around.size(); i += 1){
+        Candidate n;
+        n.u = std::min(c.u, around[i]);
+        n.v = std::max(c.u, around[i]);
+        n.cost = collapse_cost(n.u, n.v, target);
+        heap.push(n);
+      }
+    }
+  }
+
+  void output(Mesh &out){
+    // alive faces and the points they use, in original order
+    std::vector<uint32_t> remap(quadric.size(), UINT32_MAX);
+    out.points.clear();
+    out.faces.clear();
+    out.faces.reserve(live_faces * 3);
+    for (size_t f = 0; f < face_alive.size(); f += 1){
+      if(!face_alive[f]){
+        continue;
+      }
+      for (int j = 0; j < 3; j += 1){
+        remap[faces[f * 3 + j]] = 0;
+      }
+    }
+    for (size_t v = 0; v < remap.size(); v += 1){
+      if(remap[v] == 0){
+        remap[v] = out.point_count();
+        for (int k = 0; k < 3; k += 1){
+          out.points.push_back(pos[v * 3 + k]);
+        }
+      }
+    }
+    for (size_t f = 0; f < face_alive.size(); f += 1){
+      if(face_alive[f]){
+        for (int j = 0; j < 3; j += 1){
+          out.faces.push_back(remap[faces[f * 3 + j]]);
+        }
+      }
+    }
+    out.points_changed();
+    out.faces_changed();
+  }
+
+private:
+  const double* p(uint32_t v) const{ return &pos[v * 3]; }
+
+  void constrain(uint32_t f, uint32_t a, uint32_t b, const double* normal, const std::vector<uint8_t> &has_normal){
+    if(!has_normal[f]){
+      return;
+    }
+    const double* n = &normal[f * 3];
+    double e[3] = {p(b)[0] - p(a)[0], p(b)[1] - p(a)[1], p(b)[2] - p(a)[2]};
+    double c[3] = {e[1] * n[2] - e[2] * n[1], e[2] * n[0] - e[0] * n[2], e[0] * n[1] - e[1] * n[0]};
+    double len = sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+    if(len == 0){
+      return;
+    }
+    c[0] /= len; c[1] /= len; c[2] /= len;
+    double d = -(c[0] * p(a)[0] + c[1] * p(a)[1] + c[2] * p(a)[2]);
+    quadric[a].add_plane(c, d, DECIMATE_BOUNDARY_WEIGHT);
+    quadric[b].add_plane(c, d, DECIMATE_BOUNDARY_WEIGHT);
+  }
+
+  double collapse_cost(uint32_t u, uint32_t v, double target[3]) const{
+    // cost of merging u and v, target gets the new point
+    // locked points stay where they are
+    Quadric q = quadric[u];
+    q += quadric[v];
+    if(locked[u] || locked[v]){
+      const double* keep = locked[u] ? p(u) : p(v);
+      std::copy(keep, keep + 3, target);
+      return (locked[u] && locked[v]) ? INFINITY : q.error(target);
+    }
+    // an end as good as the optimal point is kept, so flat parts don't drift
+    // by rounding, the middle is the fall back when there's no optimal point
+    double mid[3] = {(p(u)[0] + p(v)[0]) / 2, (p(u)[1] + p(v)[1]) / 2, (p(u)[2] + p(v)[2]) / 2};
+    const double* options[3] = {p(u), p(v), mid};
+    int count = 3;
+    double best = INFINITY;
+    if(q.optimal(target)){
+      best = q.error(target) + DECIMATE_SNAP_ERROR;
+      count = 2;
+    }
+    for (int i = 0; i < count; i += 1){
+      double e = q.error(options[i]);
+      if(e < best){
+        best = e;
+        std::copy(options[i], options[i] + 3, target);
+      }
+    }
+    return best;
+  }
+
+  void neighbours(uint32_t v, std::vector<uint32_t> &out) const{
+    out.clear();
+    const std::vector<uint32_t> &around = vertex_faces[v];
+    for (size_t i = 0; i < around.size(); i += 1){
+      if(!face_alive[around[i]]){
+        continue;
+      }
+      for (int j = 0; j < 3; j += 1){
+        uint32_t w = faces[around[i] * 3 + j];
+        if(w != v){
+          out.push_back(w);
+        }
+      }
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+  }
+
+  bool can_collapse(uint32_t u, uint32_t v, const double target[3]){
+    // link condition, points next to both u and v are exactly the faces on the edge,
+    // otherwise the collapse pinches the surface
+    size_t shared_faces = 0;
+    const std::vector<uint32_t> &fu = vertex_faces[u];
+    for (size_t i = 0; i < fu.size(); i += 1){
+      if(face_alive[fu[i]] && has_point(fu[i], v)){
+        shared_faces += 1;
+      }
+    }
+    neighbours(u, link_u);
+    neighbours(v, link_v);
+    size_t common = 0;
+    for (size_t i = 0, j = 0; i < link_u.size() && j < link_v.size();){
+      if(link_u[i] == link_v[j]){
+        common += 1;
+        i += 1;
+        j += 1;
+      }
+      else if(link_u[i] < link_v[j]){
+        i += 1;
+      }
+      else{
+        j += 1;
+      }
+    }
+    if(shared_faces == 0 || common != shared_faces){
+      return false;
+    }
+    // two boundary points joined by an inner edge
+    if(boundary[u] && boundary[v] && shared_faces != 1){
+      return false;
+    }
+
+    // no face around may turn over
+    uint32_t ends[2] = {u, v};
+    for (int k = 0; k < 2; k += 1){
+      const std::vector<uint32_t> &around = vertex_faces[ends[k]];
+      for (size_t i = 0; i < around.size(); i += 1){
+        uint32_t f = around[i];
+        if(!face_alive[f] || (has_point(f, u) && has_point(f, v))){
+          continue;
+        }
+        const double* before[3];
+        const double* after[3];
+        for (int j = 0; j < 3; j += 1){
+          uint32_t w = faces[f * 3 + j];
+          before[j] = p(w);
+          after[j] = w == ends[k] ? target : p(w);
+        }
+        // cos of the turn >= DECIMATE_FLIP_COS, compared squared to skip the sqrt
+        double n0[3], n1[3];
+        cross_of(before[0], before[1], before[2], n0);
+        cross_of(after[0], after[1], after[2], n1);
+        double dot = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+        double len0 = n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2];
+        double len1 = n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2];
+        if(len0 == 0){
+          continue;
+        }
+        if(dot <= 0 || dot * dot < DECIMATE_FLIP_COS * DECIMATE_FLIP_COS * len0 * len1){
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  bool has_point(uint32_t f, uint32_t v) const{
+    return faces[f * 3] == v || faces[f * 3 + 1] == v || faces[f * 3 + 2] == v;
+  }
+
+  void collapse(uint32_t u, uint32_t v, const double target[3]){
+    // merge v into u at target
+    std::copy(target, target + 3, &pos[u * 3]);
+    quadric[u] += quadric[v];
+    boundary[u] |= boundary[v];
+    locked[u] |= locked[v];
+
+    std::vector<uint32_t> &fu = vertex_faces[u];
+    std::vector<uint32_t> &fv = vertex_faces[v];
+    for (size_t i = 0; i < fv.size(); i += 1){
+      uint32_t f = fv[i];
+      if(!face_alive[f]){
+        continue;
+      }
+      if(has_point(f, u)){
+        face_alive[f] = 0;
+        live_faces -= 1;
+        continue;
+      }
+      for (int j = 0; j < 3; j += 1){
+        if(faces[f * 3 + j] == v){
+          faces[f * 3 + j] = u;
+        }
+      }
+      fu.push_back(f);
+    }
+    std::vector<uint32_t>().swap(fv);
+
+    size_t keep = 0;
+    for (size_t i = 0; i < fu.size(); i += 1){
+      if(face_alive[fu[i]]){
+        fu[keep++] = fu[i];
+      }
+    }
+    fu.resize(keep);
+  }
+
+  std::vector<double> pos;
+  std::vector<uint32_t> faces;
+  std::vector<Quadric> quadric;
+  std::vector< std::vector<uint32_t> > vertex_faces;
+  std::vector<uint8_t> face_alive;
+  std::vector<uint8_t> locked;
+  std::vector<uint8_t> boundary;
+  size_t live_faces;
+  std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> > heap;
+  std::vector<uint32_t> link_u, link_v;
+};
+
+int decimate(MeshPtr input_mesh, MeshPtr out_mesh, size_t target_faces, float max_error){
+  if(target_faces == 0 && max_error <= 0){
+    copy_mesh(input_mesh, out_mesh);
+    return out_mesh->face_count();
+  }
+  TopologyPtr topo = mesh_topology(input_mesh);
+  Decimator decimator(*input_mesh, *topo);
+  // quadric error is a weighted sum of squared distances to the planes of
+  // the merged faces, compared against max_error squared
+  decimator.run(target_faces, max_error > 0 ? (double)max_error * max_error : -1);
+  decimator.output(*out_mesh);
+  return out_mesh->face_count();
+}
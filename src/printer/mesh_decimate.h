@@ -0,0 +1,25 @@
+#ifndef MESH_DECIMATE_H
+#define MESH_DECIMATE_H
+
+#include <stddef.h>
+#include "printer_module.h"
+
+// constraint planes along boundary and sharp edges are weighted by this,
+// so those edges move much less than the surface
+#define DECIMATE_BOUNDARY_WEIGHT 100.0
+// edges with dihedral cos below this are kept as features, about 60 degrees
+#define DECIMATE_FEATURE_COS 0.5
+// squared distance, an end point this close to the optimal error is used instead
+#define DECIMATE_SNAP_ERROR 1e-10
+// a collapse is refused if it turns a face more than this, cos of about 78 degrees
+#define DECIMATE_FLIP_COS 0.2
+
+// quadric edge collapse, out_mesh gets the simplified copy of input_mesh
+// stop when face count <= target_faces or the quadric error of the cheapest
+// collapse passes max_error squared, an approximate threshold in mm rather
+// than a bound on how far any point moves, 0 or negative value turns a limit off,
+// with both off out_mesh is a plain copy
+// return number of faces in out_mesh
+int decimate(MeshPtr input_mesh, MeshPtr out_mesh, size_t target_faces, float max_error);
+
+#endif
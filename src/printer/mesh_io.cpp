@@ -0,0 +1,659 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#include "mesh_io.h"
+#include "parallel.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#endif
+
+
+class VertexWelder{
+  // merge vertices that have exactly the same coordinate
+  // open addressing hash on the float bits, the table stores index + 1
+  // so 0 means empty slot
+public:
+  VertexWelder(std::vector<float> &p, size_t expect) : points(p){
+    size_t cap = 16;
+    while(cap < expect * 2){
+      cap <<= 1;
+    }
+    table.assign(cap, 0);
+    mask = cap - 1;
+  }
+
+  uint32_t weld(const float v[3]){
+    uint32_t key[3];
+    for (int i = 0; i < 3; i += 1){
+      // -0.0 and 0.0 are the same point
+      float f = v[i] == 0 ? 0.0f : v[i];
+      memcpy(&key[i], &f, sizeof(float));
+    }
+    size_t slot = hash(key) & mask;
+    while(table[slot]){
+      if(same(&points[(table[slot] - 1) * 3], key)){
+        return table[slot] - 1;
+      }
+      slot = (slot + 1) & mask;
+    }
+
+    points.insert(points.end(), v, v + 3);
+    uint32_t count = points.size() / 3;
+    table[slot] = count;
+    if(count * 2 > table.size()){
+      grow();
+    }
+    return count - 1;
+  }
+
+private:
+  static size_t hash(const uint32_t key[3]){
+    uint64_t h = key[0] * 0x9E3779B97F4A7C15ULL;
+    h ^= (h >> 29) ^ (key[1] * 0xBF58476D1CE4E5B9ULL);
+    h ^= (h >> 31) ^ (key[2] * 0x94D049BB133111EBULL);
+    return (size_t)(h ^ (h >> 32));
+  }
+
+  static bool same(const float* p, const uint32_t key[3]){
+    uint32_t b[3];
+    memcpy(b, p, sizeof(b));
+    return b[0] == key[0] && b[1] == key[1] && b[2] == key[2];
+  }
+
+  void grow(){
+    table.assign(table.size() * 2, 0);
+    mask = table.size() - 1;
+    for (uint32_t i = 0; i < points.size() / 3; i += 1){
+      uint32_t key[3];
+      memcpy(key, &points[i * 3], sizeof(key));
+      size_t slot = hash(key) & mask;
+      while(table[slot]){
+        slot = (slot + 1) & mask;
+      }
+      table[slot] = i + 1;
+    }
+  }
+
+  std::vector<float> &points;
+  std::vector<uint32_t> table;
+  size_t mask;
+};
+
+static float dotX(const float v[3][3], const float n[3]){
+  // normal of (v0, v1, v2) dot n, same as fluxclient.scanner.tools.dotX
+  float a[3] = {v[1][0] - v[0][0], v[1][1] - v[0][1], v[1][2] - v[0][2]};
+  float b[3] = {v[2][0] - v[0][0], v[2][1] - v[0][1], v[2][2] - v[0][2]};
+  return (a[1] * b[2] - a[2] * b[1]) * n[0] + (a[2] * b[0] - a[0] * b[2]) * n[1] + (a[0] * b[1] - a[1] * b[0]) * n[2];
+}
+
+static void add_facet(VertexWelder &welder, MeshPtr triangles, float v[3][3], const float n[3]){
+  // flip the winding if it doesn't agree with the normal in file
+  int order[3] = {0, 1, 2};
+  if(dotX(v, n) < 0){
+    order[1] = 2;
+    order[2] = 1;
+  }
+  for (int i = 0; i < 3; i += 1){
+    triangles->faces.push_back(welder.weld(v[order[i]]));
+  }
+}
+
+static bool is_ascii_stl(const char* data, size_t size){
+  // same rule as StlSlicer.ascii_or_binary
+  if(size < 6 || memcmp(data, "solid ", 6) != 0){
+    return false;
+  }
+  if(size >= 84){
+    uint32_t length;
+    memcpy(&length, data + 80, sizeof(uint32_t));
+    if(size == 84 + (uint64_t)length * 50){
+      return false;
+    }
+  }
+  return true;
+}
+
+static int read_stl_binary(const char* data, size_t size, MeshPtr triangles){
+  if(size < 84){
+    return MESH_IO_BAD_FORMAT;
+  }
+  uint32_t length;
+  memcpy(&length, data + 80, sizeof(uint32_t));
+  if(size < 84 + (uint64_t)length * 50){
+    return MESH_IO_BAD_FORMAT;
+  }
+
+  triangles->points.reserve((length / 2 + 3) * 3);
+  triangles->faces.reserve(length * 3);
+  VertexWelder welder(triangles->points, length / 2 + 3);
+
+  const char* ptr = data + 84;
+  float n[3], v[3][3];
+  for (uint32_t i = 0; i < length; i += 1){
+    memcpy(n, ptr, sizeof(n));
+    memcpy(v, ptr + sizeof(n), sizeof(v));
+    add_facet(welder, triangles, v, n);
+    ptr += 50;
+  }
+  return length;
+}
+
+class Tokenizer{
+  // whitespace tokenizer on a buffer which is not null terminated
+public:
+  Tokenizer(const char* d, size_t s) : ptr(d), end(d + s){}
+
+  bool next(const char* &tok, size_t &len){
+    while(ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == '\r' || *ptr == '\n')){
+      ptr += 1;
+    }
+    if(ptr == end){
+      return false;
+    }
+    tok = ptr;
+    while(ptr < end && !(*ptr == ' ' || *ptr == '\t' || *ptr == '\r' || *ptr == '\n')){
+      ptr += 1;
+    }
+    len = ptr - tok;
+    return true;
+  }
+
+  bool next_is(const char* word){
+    const char* tok;
+    size_t len;
+    return next(tok, len) && len == strlen(word) && memcmp(tok, word, len) == 0;
+  }
+
+  bool next_float(float &f){
+    const char* tok;
+    size_t len;
+    char buf[64];
+    if(!next(tok, len) || len >= sizeof(buf)){
+      return false;
+    }
+    memcpy(buf, tok, len);
+    buf[len] = 0;
+    char* parse_end;
+    f = strtof(buf, &parse_end);
+    return parse_end == buf + len;
+  }
+
+  bool skip_line(){
+    while(ptr < end && *ptr != '\n'){
+      ptr += 1;
+    }
+    return ptr < end;
+  }
+
+private:
+  const char* ptr;
+  const char* end;
+};
+
+static int read_stl_ascii(const char* data, size_t size, MeshPtr triangles){
+  // solid [name]
+  //   facet normal ni nj nk
+  //     outer loop
+  //       vertex v1x v1y v1z
+  //       ...
+  //     endloop
+  //   endfacet
+  // endsolid [name]
+  // several solids in one file are merged
+  VertexWelder welder(triangles->points, size / 512 + 3);  // ~256 bytes per facet, half vertex per facet
+
+  Tokenizer t(data, size);
+  const char* tok;
+  size_t len;
+  float n[3], v[3][3];
+  int count = 0;
+
+  while(t.next(tok, len)){
+    if(len == 5 && memcmp(tok, "solid", 5) == 0){
+      t.skip_line();  // solid name might contain anything
+    }
+    else if(len == 8 && memcmp(tok, "endsolid", 8) == 0){
+      t.skip_line();
+    }
+    else if(len == 5 && memcmp(tok, "facet", 5) == 0){
+      if(!t.next_is("normal") || !t.next_float(n[0]) || !t.next_float(n[1]) || !t.next_float(n[2])){
+        return MESH_IO_BAD_FORMAT;
+      }
+      if(!t.next_is("outer") || !t.next_is("loop")){
+        return MESH_IO_BAD_FORMAT;
+      }
+      for (int i = 0; i < 3; i += 1){
+        if(!t.next_is("vertex") || !t.next_float(v[i][0]) || !t.next_float(v[i][1]) || !t.next_float(v[i][2])){
+          return MESH_IO_BAD_FORMAT;
+        }
+      }
+      if(!t.next_is("endloop") || !t.next_is("endfacet")){
+        return MESH_IO_BAD_FORMAT;
+      }
+      add_facet(welder, triangles, v, n);
+      count += 1;
+    }
+    else{
+      return MESH_IO_BAD_FORMAT;
+    }
+  }
+  return count;
+}
+
+int read_stl_buffer(const char* data, size_t size, MeshPtr triangles){
+  // read stl into an empty mesh, vertices are welded and faces are flipped
+  // to agree with the normal in file
+  // return number of faces or MESH_IO_* error code
+  triangles->points.clear();
+  triangles->faces.clear();
+  triangles->points_changed();
+  triangles->faces_changed();
+  if(is_ascii_stl(data, size)){
+    return read_stl_ascii(data, size, triangles);
+  }
+  return read_stl_binary(data, size, triangles);
+}
+
+int read_stl(const char* filename, MeshPtr triangles){
+  int ret;
+#ifdef _WIN32
+  HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if(file == INVALID_HANDLE_VALUE){
+    return MESH_IO_OPEN_FAILED;
+  }
+  LARGE_INTEGER size;
+  if(!GetFileSizeEx(file, &size)){
+    CloseHandle(file);
+    return MESH_IO_OPEN_FAILED;
+  }
+  if(size.QuadPart == 0){
+    CloseHandle(file);
+    return read_stl_buffer("", 0, triangles);
+  }
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  const char* data = mapping ? (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+  if(data == NULL){
+    if(mapping){
+      CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    return MESH_IO_OPEN_FAILED;
+  }
+  ret = read_stl_buffer(data, (size_t)size.QuadPart, triangles);
+  UnmapViewOfFile(data);
+  CloseHandle(mapping);
+  CloseHandle(file);
+#else
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0){
+    return MESH_IO_OPEN_FAILED;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0){
+    close(fd);
+    return MESH_IO_OPEN_FAILED;
+  }
+  if(st.st_size == 0){
+    close(fd);
+    return read_stl_buffer("", 0, triangles);
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED){
+    return MESH_IO_OPEN_FAILED;
+  }
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  ret = read_stl_buffer((const char*)data, st.st_size, triangles);
+  munmap(data, st.st_size);
+#endif
+  return ret;
+}
+
+
+// faces per normal batch, normals of a batch stay on the stack
+#define NORMAL_BATCH 256
+// faces moved and written at a time by write_instances, 50 bytes each
+#define INSTANCE_WRITE_FACES 65536
+
+static void face_normals(const Mesh &triangles, size_t begin, size_t count, float* normals){
+  // unit normals of faces [begin, begin + count), 3 floats per face
+  // same result as xnormal + xnormalize
+  size_t i = 0;
+#ifdef PRINTER_USE_SSE
+  // 4 faces per iteration, lanes hold the same coordinate of 4 faces
+  for (; i + 4 <= count; i += 4){
+    float v[3][3][4];  // [vertex][axis][face]
+    for (int f = 0; f < 4; f += 1){
+      for (int j = 0; j < 3; j += 1){
+        const float* p = triangles.face_point(begin + i + f, j);
+        v[j][0][f] = p[0];
+        v[j][1][f] = p[1];
+        v[j][2][f] = p[2];
+      }
+    }
+    __m128 a[3], b[3], n[3];
+    for (int k = 0; k < 3; k += 1){
+      __m128 p0 = _mm_loadu_ps(v[0][k]);
+      a[k] = _mm_sub_ps(_mm_loadu_ps(v[1][k]), p0);
+      b[k] = _mm_sub_ps(_mm_loadu_ps(v[2][k]), p0);
+    }
+    n[0] = _mm_sub_ps(_mm_mul_ps(a[1], b[2]), _mm_mul_ps(a[2], b[1]));
+    n[1] = _mm_sub_ps(_mm_mul_ps(a[2], b[0]), _mm_mul_ps(a[0], b[2]));
+    n[2] = _mm_sub_ps(_mm_mul_ps(a[0], b[1]), _mm_mul_ps(a[1], b[0]));
+    __m128 l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(n[0], n[0]), _mm_mul_ps(n[1], n[1])), _mm_mul_ps(n[2], n[2])));
+    __m128 nonzero = _mm_cmpneq_ps(l, _mm_setzero_ps());
+    float out[3][4];
+    for (int k = 0; k < 3; k += 1){
+      // degenerate faces keep the unnormalized cross product
+      n[k] = _mm_or_ps(_mm_and_ps(nonzero, _mm_div_ps(n[k], l)), _mm_andnot_ps(nonzero, n[k]));
+      _mm_storeu_ps(out[k], n[k]);
+    }
+    for (int f = 0; f < 4; f += 1){
+      normals[(i + f) * 3] = out[0][f];
+      normals[(i + f) * 3 + 1] = out[1][f];
+      normals[(i + f) * 3 + 2] = out[2][f];
+    }
+  }
+#endif
+  for (; i < count; i += 1){
+    float v[3][3];
+    for (int j = 0; j < 3; j += 1){
+      memcpy(v[j], triangles.face_point(begin + i, j), sizeof(float) * 3);
+    }
+    xnormal(v, normals + i * 3);
+    xnormalize(normals + i * 3);
+  }
+}
+
+static void encode_stl_binary(const Mesh &triangles, std::vector<char> &out){
+  // 80 bytes header, uint32 face count, 50 bytes per face
+  // records have fixed size, so each worker fills its own part of out
+  const char header[] = "FLUX 3d printer: flux3dp.com, 2015";
+  size_t m = triangles.face_count();
+  out.resize(84 + m * 50);
+  char* data = out.data();
+  memset(data, ' ', 80);
+  memcpy(data, header, strlen(header));
+  uint32_t face_count = m;
+  memcpy(data + 80, &face_count, sizeof(uint32_t));
+
+  parallel_for(m, parallel_workers(m, FACES_PER_WORKER), [&](size_t begin, size_t end, size_t w){
+    float normals[NORMAL_BATCH * 3];
+    for (size_t i = begin; i < end; i += NORMAL_BATCH){
+      size_t count = std::min((size_t)NORMAL_BATCH, end - i);
+      face_normals(triangles, i, count, normals);
+      for (size_t f = 0; f < count; f += 1){
+        char* record = data + 84 + (i + f) * 50;
+        memcpy(record, normals + f * 3, sizeof(float) * 3);
+        for (int j = 0; j < 3; j += 1){
+          memcpy(record + 12 + j * 12, triangles.face_point(i + f, j), sizeof(float) * 3);
+        }
+        record[48] = 0;
+        record[49] = 0;
+      }
+    }
+  });
+}
+
+static void append_format(std::string &s, const char* format, const float* v){
+  char buf[128];
+  int len = snprintf(buf, sizeof(buf), format, v[0], v[1], v[2]);
+  s.append(buf, len);
+}
+
+static void format_points(const Mesh &triangles, std::string &text, std::vector<size_t> &offset){
+  // "x y z" of every point, point i is text[offset[i], offset[i + 1])
+  // a point is shared by ~6 faces, so it's formatted once here instead of in every face
+  size_t n = triangles.point_count();
+  size_t workers = parallel_workers(n, POINTS_PER_WORKER / 8);
+  std::vector<std::string> parts(workers);
+  offset.resize(n + 1);
+  parallel_for(n, workers, [&](size_t begin, size_t end, size_t w){
+    for (size_t i = begin; i < end; i += 1){
+      offset[i] = parts[w].size();
+      append_format(parts[w], "%.9g %.9g %.9g", triangles.point(i));
+    }
+  });
+
+  // join the parts, then shift offsets of each block by where its part starts
+  std::vector<size_t> base(workers);
+  text.clear();
+  for (size_t w = 0; w < workers; w += 1){
+    base[w] = text.size();
+    text.append(parts[w]);
+    std::string().swap(parts[w]);
+  }
+  parallel_for(n, workers, [&](size_t begin, size_t end, size_t w){
+    for (size_t i = begin; i < end; i += 1){
+      offset[i] += base[w];
+    }
+  });
+  offset[n] = text.size();
+}
+
+static void encode_stl_ascii(const Mesh &triangles, std::vector<char> &out){
+  // same layout as fluxclient.scanner.tools.write_stl, %.9g keeps every float
+  // workers format their faces into their own string, then joined in order
+  std::string point_text;
+  std::vector<size_t> offset;
+  format_points(triangles, point_text, offset);
+
+  size_t m = triangles.face_count();
+  size_t workers = parallel_workers(m, FACES_PER_WORKER / 8);
+  std::vector<std::string> parts(workers);
+  parallel_for(m, workers, [&](size_t begin, size_t end, size_t w){
+    std::string &s = parts[w];
+    s.reserve((end - begin) * 200);
+    float normals[NORMAL_BATCH * 3];
+    for (size_t i = begin; i < end; i += NORMAL_BATCH){
+      size_t count = std::min((size_t)NORMAL_BATCH, end - i);
+      face_normals(triangles, i, count, normals);
+      for (size_t f = 0; f < count; f += 1){
+        append_format(s, " facet normal %e %e %e\n", normals + f * 3);
+        s.append("  outer loop\n");
+        for (int j = 0; j < 3; j += 1){
+          uint32_t v = triangles.faces[(i + f) * 3 + j];
+          s.append("   vertex ");
+          s.append(point_text, offset[v], offset[v + 1] - offset[v]);
+          s.append("\n");
+        }
+        s.append("  endloop\n endfacet\n");
+      }
+    }
+  });
+
+  const char head[] = "solid ascii\n", tail[] = "endsolid\n";
+  size_t size = strlen(head) + strlen(tail);
+  for (size_t w = 0; w < workers; w += 1){
+    size += parts[w].size();
+  }
+  out.clear();
+  out.reserve(size);
+  out.insert(out.end(), head, head + strlen(head));
+  for (size_t w = 0; w < workers; w += 1){
+    out.insert(out.end(), parts[w].begin(), parts[w].end());
+    std::string().swap(parts[w]);
+  }
+  out.insert(out.end(), tail, tail + strlen(tail));
+}
+
+static void encode_ply(const Mesh &triangles, std::vector<char> &out){
+  // binary little endian ply, shared vertices and triangle faces
+  // vertex: float x, y, z; face: uchar 3, int v0, v1, v2
+  size_t n = triangles.point_count(), m = triangles.face_count();
+  char header[256];
+  int header_len = snprintf(header, sizeof(header),
+    "ply\nformat binary_little_endian 1.0\ncomment FLUX 3d printer: flux3dp.com\n"
+    "element vertex %lu\nproperty float x\nproperty float y\nproperty float z\n"
+    "element face %lu\nproperty list uchar int vertex_indices\nend_header\n",
+    (unsigned long)n, (unsigned long)m);
+  out.resize(header_len + n * 12 + m * 13);
+  char* data = out.data();
+  memcpy(data, header, header_len);
+  data += header_len;
+  memcpy(data, triangles.points.data(), n * 12);
+  data += n * 12;
+
+  parallel_for(m, parallel_workers(m, FACES_PER_WORKER), [&](size_t begin, size_t end, size_t w){
+    for (size_t i = begin; i < end; i += 1){
+      char* record = data + i * 13;
+      record[0] = 3;
+      memcpy(record + 1, &triangles.faces[i * 3], sizeof(uint32_t) * 3);
+    }
+  });
+}
+
+int encode_mesh(MeshPtr triangles, int format, std::vector<char> &out){
+  // encode the whole mesh into out, return MESH_IO_BAD_FORMAT for unknown format
+  if(format == MESH_FORMAT_STL_BINARY){
+    encode_stl_binary(*triangles, out);
+  }
+  else if(format == MESH_FORMAT_STL_ASCII){
+    encode_stl_ascii(*triangles, out);
+  }
+  else if(format == MESH_FORMAT_PLY){
+    encode_ply(*triangles, out);
+  }
+  else{
+    return MESH_IO_BAD_FORMAT;
+  }
+  return 0;
+}
+
+static int write_all(int fd, const char* data, size_t size){
+  // write size bytes, retrying short writes
+  size_t done = 0;
+  while(done < size){
+#ifdef _WIN32
+    int len = _write(fd, data + done, (unsigned int)std::min(size - done, (size_t)1 << 30));
+#else
+    ssize_t len = write(fd, data + done, size - done);
+    if(len < 0 && errno == EINTR){
+      continue;
+    }
+#endif
+    if(len <= 0){
+      return MESH_IO_WRITE_FAILED;
+    }
+    done += len;
+  }
+  return 0;
+}
+
+static int open_for_write(const char* filename){
+#ifdef _WIN32
+  return _open(filename, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+  return open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+#endif
+}
+
+static int close_written(int fd, int ret){
+  // close fd opened by open_for_write, a failed close fails a successful write
+#ifdef _WIN32
+  if(_close(fd) != 0 && ret == 0){
+#else
+  if(close(fd) != 0 && ret == 0){
+#endif
+    ret = MESH_IO_WRITE_FAILED;
+  }
+  return ret;
+}
+
+int write_mesh(MeshPtr triangles, int format, int fd){
+  // encode into one buffer, then write it to fd, the fd is not closed
+  std::vector<char> out;
+  int ret = encode_mesh(triangles, format, out);
+  if(ret < 0){
+    return ret;
+  }
+  return write_all(fd, out.data(), out.size());
+}
+
+int write_mesh_file(MeshPtr triangles, int format, const char* filename){
+  int fd = open_for_write(filename);
+  if(fd < 0){
+    return MESH_IO_OPEN_FAILED;
+  }
+  return close_written(fd, write_mesh(triangles, format, fd));
+}
+
+static void encode_instance_block(const Mesh &triangles, const float m[12], size_t begin, size_t count, char* data){
+  // binary stl records of faces [begin, begin + count) moved by m, which only turns about z
+  // so normals of the shared mesh are turned by the same matrix
+  parallel_for(count, parallel_workers(count, FACES_PER_WORKER), [&](size_t block_begin, size_t block_end, size_t w){
+    float normals[NORMAL_BATCH * 3];
+    for (size_t i = block_begin; i < block_end; i += NORMAL_BATCH){
+      size_t batch = std::min((size_t)NORMAL_BATCH, block_end - i);
+      face_normals(triangles, begin + i, batch, normals);
+      for (size_t f = 0; f < batch; f += 1){
+        char* record = data + (i + f) * 50;
+        const float* n = normals + f * 3;
+        float v[3] = {m[0] * n[0] + m[1] * n[1], m[4] * n[0] + m[5] * n[1], n[2]};
+        memcpy(record, v, sizeof(v));
+        for (int j = 0; j < 3; j += 1){
+          const float* p = triangles.face_point(begin + i + f, j);
+          for (int k = 0; k < 3; k += 1){
+            v[k] = m[k * 4] * p[0] + m[k * 4 + 1] * p[1] + m[k * 4 + 2] * p[2] + m[k * 4 + 3];
+          }
+          memcpy(record + 12 + j * 12, v, sizeof(v));
+        }
+        record[48] = 0;
+        record[49] = 0;
+      }
+    }
+  });
+}
+
+int write_instances(const std::vector<MeshInstance> &instances, int fd){
+  // binary stl of every instance in order, the fd is not closed
+  // faces are moved and written INSTANCE_WRITE_FACES at a time,
+  // so memory stays the same however many instances there are
+  const char header[] = "FLUX 3d printer: flux3dp.com, 2015";
+  char head[84];
+  memset(head, ' ', 80);
+  memcpy(head, header, strlen(header));
+  uint32_t face_count = 0;
+  for (size_t i = 0; i < instances.size(); i += 1){
+    face_count += instances[i].mesh->face_count();
+  }
+  memcpy(head + 80, &face_count, sizeof(uint32_t));
+  int ret = write_all(fd, head, sizeof(head));
+
+  std::vector<char> block;
+  for (size_t i = 0; i < instances.size() && ret == 0; i += 1){
+    const Mesh &triangles = *instances[i].mesh;
+    float m[12];
+    instance_matrix(instances[i], m);
+    size_t total = triangles.face_count();
+    for (size_t begin = 0; begin < total && ret == 0; begin += INSTANCE_WRITE_FACES){
+      size_t count = std::min((size_t)INSTANCE_WRITE_FACES, total - begin);
+      block.resize(count * 50);
+      encode_instance_block(triangles, m, begin, count, block.data());
+      ret = write_all(fd, block.data(), block.size());
+    }
+  }
+  return ret;
+}
+
+int write_instances_file(const std::vector<MeshInstance> &instances, const char* filename){
+  int fd = open_for_write(filename);
+  if(fd < 0){
+    return MESH_IO_OPEN_FAILED;
+  }
+  return close_written(fd, write_instances(instances, fd));
+}
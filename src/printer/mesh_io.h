@@ -0,0 +1,28 @@
+#ifndef MESH_IO_H
+#define MESH_IO_H
+
+#include <stddef.h>
+#include <vector>
+#include "printer_module.h"
+
+// error code for mesh readers and writers
+#define MESH_IO_OPEN_FAILED -1
+#define MESH_IO_BAD_FORMAT -2
+#define MESH_IO_WRITE_FAILED -3
+
+// output format of mesh writers
+#define MESH_FORMAT_STL_BINARY 0
+#define MESH_FORMAT_STL_ASCII 1
+#define MESH_FORMAT_PLY 2
+
+int read_stl(const char* filename, MeshPtr triangles);
+int read_stl_buffer(const char* data, size_t size, MeshPtr triangles);
+
+int encode_mesh(MeshPtr triangles, int format, std::vector<char> &out);
+int write_mesh(MeshPtr triangles, int format, int fd);
+int write_mesh_file(MeshPtr triangles, int format, const char* filename);
+// binary stl of instances, streamed without expanding them into one mesh
+int write_instances(const std::vector<MeshInstance> &instances, int fd);
+int write_instances_file(const std::vector<MeshInstance> &instances, const char* filename);
+
+#endif
@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <map>
+
+#include "mesh_orientation.h"
+#include "parallel.h"
+
+// candidates scored per thread
+#define ORIENT_CANDIDATES_PER_WORKER 16
+
+struct OrientData{
+  // the mesh as flat arrays for scoring
+  // p: x, y, z of points
+  // n: unit normal of faces, c: centroid of faces, area: area of faces
+  std::vector<float> px, py, pz;
+  std::vector<float> nx, ny, nz, cx, cy, cz, area;
+  double total_area;
+  float diagonal;
+  float sin_alpha;
+};
+
+static void prepare(const Mesh &mesh, float alpha, OrientData &d){
+  size_t n = mesh.point_count(), m = mesh.face_count();
+  d.px.resize(n);
+  d.py.resize(n);
+  d.pz.resize(n);
+  for (size_t i = 0; i < n; i += 1){
+    const float* p = mesh.point(i);
+    d.px[i] = p[0];
+    d.py[i] = p[1];
+    d.pz[i] = p[2];
+  }
+
+  d.nx.resize(m);
+  d.ny.resize(m);
+  d.nz.resize(m);
+  d.cx.resize(m);
+  d.cy.resize(m);
+  d.cz.resize(m);
+  d.area.resize(m);
+  parallel_for(m, parallel_workers(m, FACES_PER_WORKER), [&](size_t begin, size_t end, size_t w){
+    for (size_t f = begin; f < end; f += 1){
+      const float* v0 = mesh.face_point(f, 0);
+      const float* v1 = mesh.face_point(f, 1);
+      const float* v2 = mesh.face_point(f, 2);
+      float a[3], b[3];
+      for (int k = 0; k < 3; k += 1){
+        a[k] = v1[k] - v0[k];
+        b[k] = v2[k] - v0[k];
+      }
+      float c[3] = {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+      float l = sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+      float inv = l > 0 ? 1 / l : 0;  // a degenerate face has no area and no normal
+      d.nx[f] = c[0] * inv;
+      d.ny[f] = c[1] * inv;
+      d.nz[f] = c[2] * inv;
+      d.area[f] = l / 2;
+      d.cx[f] = (v0[0] + v1[0] + v2[0]) / 3;
+      d.cy[f] = (v0[1] + v1[1] + v2[1]) / 3;
+      d.cz[f] = (v0[2] + v1[2] + v2[2]) / 3;
+    }
+  });
+
+  d.total_area = 0;
+  for (size_t f = 0; f < m; f += 1){
+    d.total_area += d.area[f];
+  }
+  float box[6] = {INFINITY, INFINITY, INFINITY, -INFINITY, -INFINITY, -INFINITY};
+  for (size_t i = 0; i < n; i += 1){
+    const float* p = mesh.point(i);
+    for (int k = 0; k < 3; k += 1){
+      box[k] = std::min(box[k], p[k]);
+      box[k + 3] = std::max(box[k + 3], p[k]);
+    }
+  }
+  d.diagonal = n ? sqrt(pow(box[3] - box[0], 2) + pow(box[4] - box[1], 2) + pow(box[5] - box[2], 2)) : 0;
+  d.sin_alpha = sin(alpha);
+}
+
+static void score(const OrientData &d, const float u[3], Orientation &o){
+  // cost of the orientation with u up
+  size_t n = d.px.size(), m = d.area.size();
+  float lo = INFINITY, hi = -INFINITY;
+  size_t i = 0;
+#ifdef PRINTER_USE_SSE
+  __m128 ux = _mm_set1_ps(u[0]), uy = _mm_set1_ps(u[1]), uz = _mm_set1_ps(u[2]);
+  __m128 lo4 = _mm_set1_ps(lo), hi4 = _mm_set1_ps(hi);
+  for (; i + 4 <= n; i += 4){
+    __m128 h = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ux, _mm_loadu_ps(&d.px[i])), _mm_mul_ps(uy, _mm_loadu_ps(&d.py[i]))), _mm_mul_ps(uz, _mm_loadu_ps(&d.pz[i])));
+    lo4 = _mm_min_ps(lo4, h);
+    hi4 = _mm_max_ps(hi4, h);
+  }
+  float l[4], h[4];
+  _mm_storeu_ps(l, lo4);
+  _mm_storeu_ps(h, hi4);
+  lo = std::min(std::min(l[0], l[1]), std::min(l[2], l[3]));
+  hi = std::max(std::max(h[0], h[1]), std::max(h[2], h[3]));
+#endif
+  for (; i < n; i += 1){
+    float h = u[0] * d.px[i] + u[1] * d.py[i] + u[2] * d.pz[i];
+    lo = std::min(lo, h);
+    hi = std::max(hi, h);
+  }
+
+  // a face facing down at least alpha from the vertical, same as find_support_point,
+  // is on the plate if its centroid is, otherwise it needs support
+  float top = lo + ORIENT_CONTACT_GAP;
+  float overhang = 0, contact = 0;
+  i = 0;
+#ifdef PRINTER_USE_SSE
+  __m128 down_cos = _mm_set1_ps(-d.sin_alpha), top4 = _mm_set1_ps(top);
+  __m128 overhang4 = _mm_setzero_ps(), contact4 = _mm_setzero_ps();
+  for (; i + 4 <= m; i += 4){
+    __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ux, _mm_loadu_ps(&d.nx[i])), _mm_mul_ps(uy, _mm_loadu_ps(&d.ny[i]))), _mm_mul_ps(uz, _mm_loadu_ps(&d.nz[i])));
+    __m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ux, _mm_loadu_ps(&d.cx[i])), _mm_mul_ps(uy, _mm_loadu_ps(&d.cy[i]))), _mm_mul_ps(uz, _mm_loadu_ps(&d.cz[i])));
+    __m128 down = _mm_and_ps(_mm_cmple_ps(dot, down_cos), _mm_loadu_ps(&d.area[i]));
+    __m128 on = _mm_cmple_ps(c, top4);
+    contact4 = _mm_add_ps(contact4, _mm_and_ps(on, down));
+    overhang4 = _mm_add_ps(overhang4, _mm_andnot_ps(on, down));
+  }
+  float s[4];
+  _mm_storeu_ps(s, contact4);
+  contact = (s[0] + s[1]) + (s[2] + s[3]);
+  _mm_storeu_ps(s, overhang4);
+  overhang = (s[0] + s[1]) + (s[2] + s[3]);
+#endif
+  for (; i < m; i += 1){
+    float dot = u[0] * d.nx[i] + u[1] * d.ny[i] + u[2] * d.nz[i];
+    if(!(dot <= -d.sin_alpha)){
+      continue;
+    }
+    if(u[0] * d.cx[i] + u[1] * d.cy[i] + u[2] * d.cz[i] <= top){
+      contact += d.area[i];
+    }
+    else{
+      overhang += d.area[i];
+    }
+  }
+
+  for (int k = 0; k < 3; k += 1){
+    o.up[k] = u[k];
+  }
+  // turning by rx about x, then ry about y brings u = (-sin ry, cos ry sin rx, cos ry cos rx) to +z
+  o.ry = -asin(std::max(-1.f, std::min(1.f, u[0])));
+  o.rx = atan2(u[1], u[2]);
+  o.overhang = overhang;
+  o.contact = contact;
+  o.height = hi - lo;
+  o.cost = (overhang - contact) / d.total_area + ORIENT_HEIGHT_WEIGHT * o.height / std::max(d.diagonal, 1e-6f);
+}
+
+static void normalize(float u[3]){
+  float l = sqrt(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+  for (int k = 0; k < 3; k += 1){
+    u[k] /= l;
+  }
+}
+
+static void geodesic(int level, std::vector<float> &dirs){
+  // vertices of an icosahedron subdivided level times, projected to the unit sphere
+  const float t = (1 + sqrt(5.f)) / 2;
+  const float ico[12][3] = {
+    {-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0},
+    {0, -1, t}, {0, 1, t}, {0, -1, -t}, {0, 1, -t},
+    {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1}
+  };
+  const uint32_t ico_faces[20][3] = {
+    {0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11},
+    {1, 5, 9}, {5, 11, 4}, {11, 10, 2}, {10, 7, 6}, {7, 1, 8},
+    {3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8}, {3, 8, 9},
+    {4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1}
+  };
+  dirs.clear();
+  for (int i = 0; i < 12; i += 1){
+    float u[3] = {ico[i][0], ico[i][1], ico[i][2]};
+    normalize(u);
+    dirs.insert(dirs.end(), u, u + 3);
+  }
+  std::vector<uint32_t> faces(&ico_faces[0][0], &ico_faces[0][0] + 60);
+  for (int l = 0; l < level; l += 1){
+    // every edge gets its middle point once, every face is split into 4
+    std::map<std::pair<uint32_t, uint32_t>, uint32_t> middle;
+    std::vector<uint32_t> next;
+    for (size_t f = 0; f < faces.size(); f += 3){
+      uint32_t v[3] = {faces[f], faces[f + 1], faces[f + 2]}, mid[3];
+      for (int j = 0; j < 3; j += 1){
+        uint32_t a = std::min(v[j], v[(j + 1) % 3]), b = std::max(v[j], v[(j + 1) % 3]);
+        std::pair<std::map<std::pair<uint32_t, uint32_t>, uint32_t>::iterator, bool> ins = middle.insert(std::make_pair(std::make_pair(a, b), (uint32_t)(dirs.size() / 3)));
+        if(ins.second){
+          float u[3] = {dirs[a * 3] + dirs[b * 3], dirs[a * 3 + 1] + dirs[b * 3 + 1], dirs[a * 3 + 2] + dirs[b * 3 + 2]};
+          normalize(u);
+          dirs.insert(dirs.end(), u, u + 3);
+        }
+        mid[j] = ins.first -> second;
+      }
+      uint32_t split[12] = {v[0], mid[0], mid[2], v[1], mid[1], mid[0], v[2], mid[2], mid[1], mid[0], mid[1], mid[2]};
+      next.insert(next.end(), split, split + 12);
+    }
+    faces.swap(next);
+  }
+}
+
+static void refine(const OrientData &d, float step, Orientation &o){
+  // local search: try 6 directions step away from the best so far, then halve the step
+  for (int r = 0; r < ORIENT_REFINE_ROUNDS; r += 1, step /= 2){
+    // t1, t2: tangent plane of up
+    float u[3] = {o.up[0], o.up[1], o.up[2]};
+    float t1[3];
+    if(fabs(u[0]) < 0.9f){
+      t1[0] = 0; t1[1] = u[2]; t1[2] = -u[1];  // (1, 0, 0) x u
+    }
+    else{
+      t1[0] = -u[2]; t1[1] = 0; t1[2] = u[0];  // (0, 1, 0) x u
+    }
+    normalize(t1);
+    float t2[3] = {u[1] * t1[2] - u[2] * t1[1], u[2] * t1[0] - u[0] * t1[2], u[0] * t1[1] - u[1] * t1[0]};
+
+    Orientation best = o;
+    for (int j = 0; j < 6; j += 1){
+      float a = M_PI / 3 * j;
+      float v[3];
+      for (int k = 0; k < 3; k += 1){
+        v[k] = u[k] * cos(step) + (t1[k] * cos(a) + t2[k] * sin(a)) * sin(step);
+      }
+      normalize(v);
+      Orientation c;
+      score(d, v, c);
+      if(c.cost < best.cost){
+        best = c;
+      }
+    }
+    o = best;
+  }
+}
+
+static bool by_cost(const Orientation &a, const Orientation &b){
+  return a.cost < b.cost;
+}
+
+static void pick(std::vector<Orientation> &sorted, size_t k, std::vector<Orientation> &out){
+  // the best of sorted that are at least ORIENT_MIN_ANGLE apart, up to k
+  float min_cos = cos(ORIENT_MIN_ANGLE);
+  out.clear();
+  for (size_t i = 0; i < sorted.size() && out.size() < k; i += 1){
+    bool far = true;
+    for (size_t j = 0; j < out.size() && far; j += 1){
+      far = sorted[i].up[0] * out[j].up[0] + sorted[i].up[1] * out[j].up[1] + sorted[i].up[2] * out[j].up[2] < min_cos;
+    }
+    if(far){
+      out.push_back(sorted[i]);
+    }
+  }
+}
+
+int best_orientations(MeshPtr triangles, float alpha, size_t k, std::vector<Orientation> &out){
+  // candidates are the vertices of a geodesic sphere and the down side of the largest faces,
+  // the best distinct ones are refined by local search, all candidates are scored in parallel
+  if(!(alpha > 0 && alpha < M_PI / 2)){
+    return ORIENT_BAD_PARAMETER;
+  }
+  out.clear();
+  OrientData d;
+  prepare(*triangles, alpha, d);
+  if(k == 0 || !(d.total_area > 0)){
+    return 0;
+  }
+
+  std::vector<float> dirs;
+  geodesic(ORIENT_SUBDIVISION, dirs);
+  std::vector<uint32_t> largest(d.area.size());
+  for (size_t f = 0; f < largest.size(); f += 1){
+    largest[f] = f;
+  }
+  size_t face_candidates = std::min(largest.size(), (size_t)ORIENT_FACE_CANDIDATES);
+  std::partial_sort(largest.begin(), largest.begin() + face_candidates, largest.end(), [&](uint32_t a, uint32_t b){
+    return d.area[a] > d.area[b] || (d.area[a] == d.area[b] && a < b);
+  });
+  for (size_t i = 0; i < face_candidates; i += 1){
+    uint32_t f = largest[i];
+    if(d.area[f] > 0){
+      float u[3] = {-d.nx[f], -d.ny[f], -d.nz[f]};
+      dirs.insert(dirs.end(), u, u + 3);
+    }
+  }
+
+  size_t count = dirs.size() / 3;
+  std::vector<Orientation> all(count);
+  parallel_for(count, parallel_workers(count, ORIENT_CANDIDATES_PER_WORKER), [&](size_t begin, size_t end, size_t w){
+    for (size_t i = begin; i < end; i += 1){
+      score(d, &dirs[i * 3], all[i]);
+    }
+  });
+  std::stable_sort(all.begin(), all.end(), by_cost);
+
+  // about half the angle between neighbors on the geodesic sphere
+  float step = atan(2.f) / (1 << ORIENT_SUBDIVISION) / 2;
+  std::vector<Orientation> seeds;
+  pick(all, k, seeds);
+  parallel_for(seeds.size(), parallel_workers(seeds.size(), 1), [&](size_t begin, size_t end, size_t w){
+    for (size_t i = begin; i < end; i += 1){
+      refine(d, step, seeds[i]);
+    }
+  });
+
+  seeds.insert(seeds.end(), all.begin(), all.end());
+  std::stable_sort(seeds.begin(), seeds.end(), by_cost);
+  pick(seeds, k, out);
+  return out.size();
+}
@@ -0,0 +1,41 @@
+#ifndef MESH_ORIENTATION_H
+#define MESH_ORIENTATION_H
+
+#include <stddef.h>
+#include <vector>
+#include "printer_module.h"
+
+// the icosahedron is subdivided this many times for the first candidates, 642 directions
+#define ORIENT_SUBDIVISION 3
+// largest faces whose downward normal is also tried, so a flat side can lie exactly on the plate
+#define ORIENT_FACE_CANDIDATES 64
+// rounds of local search around the best candidates, the step is halved every round
+#define ORIENT_REFINE_ROUNDS 6
+// faces with the centroid this close to the plate, in mm, lie on it
+#define ORIENT_CONTACT_GAP 0.05f
+// weight of the build height against overhang area in the cost
+#define ORIENT_HEIGHT_WEIGHT 0.25f
+// orientations returned are at least this far apart, in radians
+#define ORIENT_MIN_ANGLE 0.35f
+
+// error code for best_orientations
+#define ORIENT_BAD_PARAMETER -1
+
+struct Orientation{
+  // up: unit direction of the model that ends up pointing up
+  // rx, ry: rotation for apply_transform that turns up to +z, rz is 0
+  // overhang: area of faces that need support, by the same angle test as find_support_point
+  // contact: area of faces lying on the plate, they need no support
+  // height: build height in mm
+  // cost: (overhang - contact) / total area + ORIENT_HEIGHT_WEIGHT * height / diagonal of the bounding box
+  float up[3];
+  float rx, ry;
+  float overhang, contact, height, cost;
+};
+
+// search for the orientations with the lowest cost, faces overhanging more than alpha radians
+// from the vertical need support, out gets up to k of them, best first
+// return number of orientations in out, or error code
+int best_orientations(MeshPtr triangles, float alpha, size_t k, std::vector<Orientation> &out);
+
+#endif
@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <atomic>
+
+#include "mesh_topology.h"
+
+
+class EdgeTable{
+  // find the first half-edge on each undirected edge
+  // open addressing hash on the vertex pair, the table stores half-edge + 1
+  // so 0 means empty slot, keys are read back from faces
+public:
+  EdgeTable(const std::vector<uint32_t> &f) : faces(f){
+    size_t cap = 16;
+    while(cap < faces.size() * 2){
+      cap <<= 1;
+    }
+    table.assign(cap, 0);
+    mask = cap - 1;
+  }
+
+  uint32_t first(uint32_t h){
+    // the first half-edge inserted on the edge of h, h itself if it's new
+    uint32_t a, b;
+    key(h, a, b);
+    size_t slot = hash(a, b) & mask;
+    while(table[slot]){
+      uint32_t c, d;
+      key(table[slot] - 1, c, d);
+      if(a == c && b == d){
+        return table[slot] - 1;
+      }
+      slot = (slot + 1) & mask;
+    }
+    table[slot] = h + 1;
+    return h;
+  }
+
+private:
+  void key(uint32_t h, uint32_t &a, uint32_t &b) const{
+    a = faces[h];
+    b = faces[h - h % 3 + (h % 3 + 1) % 3];
+    if(a > b){
+      std::swap(a, b);
+    }
+  }
+
+  static size_t hash(uint32_t a, uint32_t b){
+    uint64_t h = a * 0x9E3779B97F4A7C15ULL;
+    h ^= (h >> 29) ^ (b * 0xBF58476D1CE4E5B9ULL);
+    return (size_t)(h ^ (h >> 32));
+  }
+
+  const std::vector<uint32_t> &faces;
+  std::vector<uint32_t> table;
+  size_t mask;
+};
+
+static size_t ring_size(const MeshTopology &topo, uint32_t h){
+  size_t size = 1;
+  for (uint32_t g = topo.ring[h]; g != h; g = topo.ring[g]){
+    size += 1;
+  }
+  return size;
+}
+
+static bool ring_first(const MeshTopology &topo, uint32_t h){
+  // true for the smallest half-edge of its ring, count each edge once
+  for (uint32_t g = topo.ring[h]; g != h; g = topo.ring[g]){
+    if(g < h){
+      return false;
+    }
+  }
+  return true;
+}
+
+TopologyPtr mesh_topology(MeshPtr triangles){
+  // the cached index is shared and never modified, concurrent first calls
+  // may both build it, either result is the same
+  TopologyPtr cached = std::atomic_load(&triangles->topology);
+  if(cached){
+    return cached;
+  }
+
+  const Mesh &mesh = *triangles;
+  std::shared_ptr<MeshTopology> topo(new MeshTopology());
+  size_t n = mesh.faces.size();
+  std::vector<uint32_t> &ring = topo->ring;
+  ring.resize(n);
+  EdgeTable table(mesh.faces);
+  for (uint32_t h = 0; h < n; h += 1){
+    uint32_t first = table.first(h);
+    ring[h] = h;
+    if(first != h){
+      ring[h] = ring[first];
+      ring[first] = h;
+    }
+  }
+
+  topo->boundary_edges = topo->flipped_edges = topo->non_manifold_edges = 0;
+  for (uint32_t h = 0; h < n; h += 1){
+    if(ring[h] == h){
+      topo->boundary_edges += 1;
+    }
+    else if(ring_first(*topo, h)){
+      size_t size = ring_size(*topo, h);
+      if(size > 2){
+        topo->non_manifold_edges += 1;
+      }
+      else if(topo->from(mesh, h) == topo->from(mesh, ring[h])){
+        topo->flipped_edges += 1;
+      }
+    }
+  }
+
+  TopologyPtr result(topo);
+  std::atomic_store(&triangles->topology, result);
+  return result;
+}
+
+int face_neighbours(MeshPtr triangles, uint32_t f, std::vector<uint32_t> &neighbours){
+  // return -1 if f is out of range
+  neighbours.clear();
+  if(f >= triangles->face_count()){
+    return -1;
+  }
+  TopologyPtr topo = mesh_topology(triangles);
+  for (uint32_t h = f * 3; h < f * 3 + 3; h += 1){
+    for (uint32_t g = topo->ring[h]; g != h; g = topo->ring[g]){
+      if(g / 3 != f){
+        neighbours.push_back(g / 3);
+      }
+    }
+  }
+  std::sort(neighbours.begin(), neighbours.end());
+  neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+  return 0;
+}
+
+int boundary_loops(MeshPtr triangles, std::vector<uint32_t> &vertices, std::vector<uint32_t> &start){
+  // follow boundary half-edges head to tail, a loop ends where it can't go on
+  // return number of loops
+  const Mesh &mesh = *triangles;
+  TopologyPtr topo = mesh_topology(triangles);
+  vertices.clear();
+  start.assign(1, 0);
+
+  // boundary half-edges sorted by start vertex
+  std::vector<std::pair<uint32_t, uint32_t> > out;
+  out.reserve(topo->boundary_edges);
+  for (uint32_t h = 0; h < topo->ring.size(); h += 1){
+    if(topo->ring[h] == h){
+      out.push_back(std::make_pair(topo->from(mesh, h), h));
+    }
+  }
+  std::sort(out.begin(), out.end());
+
+  std::vector<uint8_t> used(out.size(), 0);
+  for (size_t i = 0; i < out.size(); i += 1){
+    size_t cur = i;
+    while(!used[cur]){
+      used[cur] = 1;
+      vertices.push_back(out[cur].first);
+      uint32_t v = topo->to(mesh, out[cur].second);
+      std::vector<std::pair<uint32_t, uint32_t> >::iterator it = std::lower_bound(out.begin(), out.end(), std::make_pair(v, (uint32_t)0));
+      for (; it != out.end() && it->first == v && used[it - out.begin()]; ++it);
+      if(it == out.end() || it->first != v){
+        break;
+      }
+      cur = it - out.begin();
+    }
+    if(vertices.size() > start.back()){
+      start.push_back(vertices.size());
+    }
+  }
+  return start.size() - 1;
+}
+
+int non_manifold_edges(MeshPtr triangles, std::vector<uint32_t> &edges){
+  // return number of edges
+  const Mesh &mesh = *triangles;
+  TopologyPtr topo = mesh_topology(triangles);
+  edges.clear();
+  for (uint32_t h = 0; h < topo->ring.size(); h += 1){
+    if(topo->ring[h] != h && topo->ring[topo->ring[h]] != h && ring_first(*topo, h)){
+      edges.push_back(topo->from(mesh, h));
+      edges.push_back(topo->to(mesh, h));
+    }
+  }
+  return edges.size() / 2;
+}
+
+static uint32_t find_root(std::vector<uint32_t> &parent, uint32_t x){
+  while(parent[x] != x){
+    parent[x] = parent[parent[x]];
+    x = parent[x];
+  }
+  return x;
+}
+
+int connected_components(MeshPtr triangles, std::vector<uint32_t> &labels){
+  TopologyPtr topo = mesh_topology(triangles);
+  size_t m = triangles->face_count();
+  std::vector<uint32_t> parent(m);
+  for (uint32_t f = 0; f < m; f += 1){
+    parent[f] = f;
+  }
+  for (uint32_t h = 0; h < topo->ring.size(); h += 1){
+    uint32_t a = find_root(parent, h / 3), b = find_root(parent, topo->ring[h] / 3);
+    if(a != b){
+      parent[std::max(a, b)] = std::min(a, b);
+    }
+  }
+
+  // roots are the smallest face of each component, so labels follow first faces
+  labels.resize(m);
+  uint32_t count = 0;
+  for (uint32_t f = 0; f < m; f += 1){
+    uint32_t root = find_root(parent, f);
+    labels[f] = root == f ? count++ : labels[root];
+  }
+  return count;
+}
+
+int split_components(MeshPtr triangles, std::vector<MeshPtr> &parts){
+  // return number of parts
+  const Mesh &mesh = *triangles;
+  std::vector<uint32_t> labels;
+  size_t count = connected_components(triangles, labels);
+  size_t m = mesh.face_count();
+
+  // faces grouped by component, in original order within each group
+  std::vector<uint32_t> offset(count + 1, 0);
+  for (size_t f = 0; f < m; f += 1){
+    offset[labels[f] + 1] += 1;
+  }
+  for (size_t c = 0; c < count; c += 1){
+    offset[c + 1] += offset[c];
+  }
+  std::vector<uint32_t> order(m);
+  std::vector<uint32_t> fill(offset.begin(), offset.end() - 1);
+  for (uint32_t f = 0; f < m; f += 1){
+    order[fill[labels[f]]++] = f;
+  }
+
+  // a point touched by several components is copied into each,
+  // stamp tells which component the remapped index belongs to
+  std::vector<uint32_t> remap(mesh.point_count()), stamp(mesh.point_count(), UINT32_MAX);
+  parts.resize(count);
+  for (uint32_t c = 0; c < count; c += 1){
+    parts[c] = createMeshPtr();
+    Mesh &part = *parts[c];
+    part.faces.reserve((offset[c + 1] - offset[c]) * 3);
+    for (uint32_t i = offset[c]; i < offset[c + 1]; i += 1){
+      for (int j = 0; j < 3; j += 1){
+        uint32_t v = mesh.faces[order[i] * 3 + j];
+        if(stamp[v] != c){
+          stamp[v] = c;
+          remap[v] = part.point_count();
+          part.points.insert(part.points.end(), mesh.point(v), mesh.point(v) + 3);
+        }
+        part.faces.push_back(remap[v]);
+      }
+    }
+  }
+  return count;
+}
+
+int manifold_report(MeshPtr triangles, ManifoldReport &report){
+  TopologyPtr topo = mesh_topology(triangles);
+  std::vector<uint32_t> labels, vertices, start;
+  report.components = connected_components(triangles, labels);
+  report.boundary_edges = topo->boundary_edges;
+  report.boundary_loops = topo->boundary_edges ? boundary_loops(triangles, vertices, start) : 0;
+  report.flipped_edges = topo->flipped_edges;
+  report.non_manifold_edges = topo->non_manifold_edges;
+  return 0;
+}
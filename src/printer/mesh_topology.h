@@ -0,0 +1,49 @@
+#ifndef MESH_TOPOLOGY_H
+#define MESH_TOPOLOGY_H
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include "printer_module.h"
+
+struct MeshTopology{
+  // half-edge index of a triangle mesh
+  // half-edge h = f * 3 + j runs from faces[h] to faces[f * 3 + (j + 1) % 3]
+  // ring[h]: next half-edge on the same undirected edge, the half-edges of
+  // an edge form a cycle, ring[h] == h on a boundary edge
+  std::vector<uint32_t> ring;
+  size_t boundary_edges;  // edges used by one face
+  size_t flipped_edges;  // edges shared by 2 faces in the same direction
+  size_t non_manifold_edges;  // edges shared by more than 2 faces
+
+  uint32_t from(const Mesh &mesh, uint32_t h) const{ return mesh.faces[h]; }
+  uint32_t to(const Mesh &mesh, uint32_t h) const{ return mesh.faces[h - h % 3 + (h % 3 + 1) % 3]; }
+};
+
+typedef std::shared_ptr<const MeshTopology> TopologyPtr;
+
+struct ManifoldReport{
+  size_t components;
+  size_t boundary_edges;
+  size_t boundary_loops;
+  size_t flipped_edges;
+  size_t non_manifold_edges;
+};
+
+// built on first use and cached on the mesh until faces change
+TopologyPtr mesh_topology(MeshPtr triangles);
+
+// faces sharing an edge with face f
+int face_neighbours(MeshPtr triangles, uint32_t f, std::vector<uint32_t> &neighbours);
+// vertices of each boundary loop, loop i is vertices [start[i], start[i + 1])
+int boundary_loops(MeshPtr triangles, std::vector<uint32_t> &vertices, std::vector<uint32_t> &start);
+// vertex pairs of edges shared by more than 2 faces
+int non_manifold_edges(MeshPtr triangles, std::vector<uint32_t> &edges);
+// label of each face, faces sharing an edge have the same label
+// labels count from 0 in order of the first face, return number of components
+int connected_components(MeshPtr triangles, std::vector<uint32_t> &labels);
+// one mesh for each component, only with the points it uses
+int split_components(MeshPtr triangles, std::vector<MeshPtr> &parts);
+int manifold_report(MeshPtr triangles, ManifoldReport &report);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef PRINTER_PARALLEL_H
+#define PRINTER_PARALLEL_H
+
+#include <stddef.h>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+// items per thread when processing a large mesh
+#define POINTS_PER_WORKER 65536
+#define FACES_PER_WORKER 65536
+
+// 4-wide kernels are used when SSE is available
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define PRINTER_USE_SSE
+#endif
+
+inline size_t parallel_workers(size_t n, size_t grain){
+  // number of threads worth starting for n items, at least grain items each
+  size_t hw = std::thread::hardware_concurrency();
+  if(hw == 0){
+    hw = 1;
+  }
+  size_t workers = grain ? n / grain : n;
+  return std::max((size_t)1, std::min(hw, workers));
+}
+
+template <typename F>
+void parallel_for(size_t n, size_t workers, F f){
+  // split [0, n) into workers contiguous blocks, call f(begin, end, worker)
+  // block boundaries are deterministic, the last block runs on the caller
+  if(workers <= 1 || n == 0){
+    f((size_t)0, n, (size_t)0);
+    return;
+  }
+  size_t block = (n + workers - 1) / workers;
+  std::vector<std::thread> threads;
+  for (size_t w = 0; w + 1 < workers; w += 1){
+    size_t begin = std::min(n, w * block), end = std::min(n, begin + block);
+    threads.push_back(std::thread(f, begin, end, w));
+  }
+  f(std::min(n, (workers - 1) * block), n, workers - 1);
+  for (size_t i = 0; i < threads.size(); i += 1){
+    threads[i].join();
+  }
+}
+
+#endif
@@ -0,0 +1,386 @@
+#include <algorithm>
+
+#include "plate_arrange.h"
+#include "parallel.h"
+
+// vertices of a convex polygon, x, y pairs
+typedef std::vector<double> Poly;
+
+struct Directions{
+  // unit vectors of the directions
+  double x[ARRANGE_DIRECTIONS], y[ARRANGE_DIRECTIONS];
+  Directions(){
+    for (int k = 0; k < ARRANGE_DIRECTIONS; k += 1){
+      x[k] = cos(2 * M_PI * k / ARRANGE_DIRECTIONS);
+      y[k] = sin(2 * M_PI * k / ARRANGE_DIRECTIONS);
+    }
+  }
+};
+static const Directions dirs;
+
+static inline void direction(int k, double &dx, double &dy){
+  dx = dirs.x[k];
+  dy = dirs.y[k];
+}
+
+static void clip(Poly &p, double dx, double dy, double c){
+  // keep the part of p where dx * x + dy * y <= c
+  Poly out;
+  size_t n = p.size() / 2;
+  for (size_t i = 0; i < n; i += 1){
+    size_t j = (i + 1) % n;
+    double a = dx * p[i * 2] + dy * p[i * 2 + 1] - c;
+    double b = dx * p[j * 2] + dy * p[j * 2 + 1] - c;
+    if(a <= 0){
+      out.push_back(p[i * 2]);
+      out.push_back(p[i * 2 + 1]);
+    }
+    if((a < 0 && b > 0) || (a > 0 && b < 0)){
+      double t = a / (a - b);
+      out.push_back(p[i * 2] + t * (p[j * 2] - p[i * 2]));
+      out.push_back(p[i * 2 + 1] + t * (p[j * 2 + 1] - p[i * 2 + 1]));
+    }
+  }
+  p.swap(out);
+}
+
+static void outline(const double* c, Poly &p){
+  // polygon where d_k . t <= c[k] for every direction k
+  double bound = 1;
+  for (int k = 0; k < ARRANGE_DIRECTIONS; k += 1){
+    bound = std::max(bound, 2 * fabs(c[k]) + 1);
+  }
+  double square[8] = {-bound, -bound, bound, -bound, bound, bound, -bound, bound};
+  p.assign(square, square + 8);
+  for (int k = 0; k < ARRANGE_DIRECTIONS && !p.empty(); k += 1){
+    double dx, dy;
+    direction(k, dx, dy);
+    clip(p, dx, dy, c[k]);
+  }
+}
+
+static double area(const Poly &p){
+  double a = 0;
+  size_t n = p.size() / 2;
+  for (size_t i = 0; i < n; i += 1){
+    size_t j = (i + 1) % n;
+    a += p[i * 2] * p[j * 2 + 1] - p[j * 2] * p[i * 2 + 1];
+  }
+  return a / 2;
+}
+
+int footprint(MeshPtr triangles, float margin, Footprint &f){
+  size_t n = triangles -> point_count();
+  if(n == 0){
+    return -1;
+  }
+  size_t workers = parallel_workers(n, POINTS_PER_WORKER);
+  std::vector<float> h(workers * ARRANGE_DIRECTIONS, -INFINITY);
+  float dx[ARRANGE_DIRECTIONS], dy[ARRANGE_DIRECTIONS];
+  for (int k = 0; k < ARRANGE_DIRECTIONS; k += 1){
+    double x, y;
+    direction(k, x, y);
+    dx[k] = x;
+    dy[k] = y;
+  }
+  parallel_for(n, workers, [&](size_t begin, size_t end, size_t w){
+    float* hw = &h[w * ARRANGE_DIRECTIONS];
+    for (size_t i = begin; i < end; i += 1){
+      const float* p = triangles -> point(i);
+      for (int k = 0; k < ARRANGE_DIRECTIONS; k += 1){
+        hw[k] = std::max(hw[k], dx[k] * p[0] + dy[k] * p[1]);
+      }
+    }
+  });
+
+  // the margin is added along each direction, so the polygon grows by a bit more than margin at its corners
+  double c[ARRANGE_DIRECTIONS];
+  for (int k = 0; k < ARRANGE_DIRECTIONS; k += 1){
+    f.h[k] = h[k];
+    for (size_t w = 1; w < workers; w += 1){
+      f.h[k] = std::max(f.h[k], h[w * ARRANGE_DIRECTIONS + k]);
+    }
+    f.h[k] += margin;
+    c[k] = f.h[k];
+  }
+  Poly p;
+  outline(c, p);
+  f.area = area(p);
+  return 0;
+}
+
+struct Region{
+  // inside of a no-fit polygon, where the origin of the moving footprint would overlap a placed one
+  // d_k . t < c[k] for every k
+  double c[ARRANGE_DIRECTIONS];
+  Poly p;
+  double lo[2], hi[2];
+};
+
+static bool inside(const Region &r, double x, double y){
+  if(x <= r.lo[0] + ARRANGE_TOLERANCE || x >= r.hi[0] - ARRANGE_TOLERANCE || y <= r.lo[1] + ARRANGE_TOLERANCE || y >= r.hi[1] - ARRANGE_TOLERANCE){
+    return false;
+  }
+  for (int k = 0; k < ARRANGE_DIRECTIONS; k += 1){
+    double dx, dy;
+    direction(k, dx, dy);
+    if(dx * x + dy * y >= r.c[k] - ARRANGE_TOLERANCE){
+      return false;
+    }
+  }
+  return true;
+}
+
+static void set_box(Region &r){
+  r.lo[0] = r.lo[1] = INFINITY;
+  r.hi[0] = r.hi[1] = -INFINITY;
+  for (size_t i = 0; i < r.p.size(); i += 2){
+    for (int k = 0; k < 2; k += 1){
+      r.lo[k] = std::min(r.lo[k], r.p[i + k]);
+      r.hi[k] = std::max(r.hi[k], r.p[i + k]);
+    }
+  }
+}
+
+static bool boxes_meet(const Region &a, const Region &b){
+  return a.lo[0] <= b.hi[0] && b.lo[0] <= a.hi[0] && a.lo[1] <= b.hi[1] && b.lo[1] <= a.hi[1];
+}
+
+static bool edge_meets(const double* p0, const double* p1, const Region &r){
+  return std::max(p0[0], p1[0]) >= r.lo[0] && std::min(p0[0], p1[0]) <= r.hi[0] && std::max(p0[1], p1[1]) >= r.lo[1] && std::min(p0[1], p1[1]) <= r.hi[1];
+}
+
+static void cross_edges(const Region &a, const Region &b, Poly &out){
+  // points where the edges of a and b cross, only edges in the box of the other are tried
+  size_t n = a.p.size() / 2, m = b.p.size() / 2;
+  std::vector<size_t> near;
+  for (size_t j = 0; j < m; j += 1){
+    if(edge_meets(&b.p[j * 2], &b.p[(j + 1) % m * 2], a)){
+      near.push_back(j);
+    }
+  }
+  for (size_t i = 0; i < n && !near.empty(); i += 1){
+    const double* p0 = &a.p[i * 2];
+    const double* p1 = &a.p[(i + 1) % n * 2];
+    if(!edge_meets(p0, p1, b)){
+      continue;
+    }
+    double ex = p1[0] - p0[0], ey = p1[1] - p0[1];
+    for (size_t t = 0; t < near.size(); t += 1){
+      size_t j = near[t];
+      const double* q0 = &b.p[j * 2];
+      const double* q1 = &b.p[(j + 1) % m * 2];
+      double fx = q1[0] - q0[0], fy = q1[1] - q0[1];
+      double det = ex * fy - ey * fx;
+      if(det == 0){
+        continue;
+      }
+      double gx = q0[0] - p0[0], gy = q0[1] - p0[1];
+      double s = (gx * fy - gy * fx) / det, u = (gx * ey - gy * ex) / det;
+      if(s >= 0 && s <= 1 && u >= 0 && u <= 1){
+        out.push_back(p0[0] + s * ex);
+        out.push_back(p0[1] + s * ey);
+      }
+    }
+  }
+}
+
+static void closest_on_edges(const Poly &a, Poly &out){
+  // point of each edge of a closest to the center
+  size_t n = a.size() / 2;
+  for (size_t i = 0; i < n; i += 1){
+    const double* p0 = &a[i * 2];
+    const double* p1 = &a[(i + 1) % n * 2];
+    double ex = p1[0] - p0[0], ey = p1[1] - p0[1];
+    double l = ex * ex + ey * ey;
+    double s = l > 0 ? std::max(0., std::min(1., -(p0[0] * ex + p0[1] * ey) / l)) : 0;
+    out.push_back(p0[0] + s * ex);
+    out.push_back(p0[1] + s * ey);
+  }
+}
+
+struct Placed{
+  // a placed footprint, h turned by its rotation
+  float h[ARRANGE_DIRECTIONS];
+  double x, y;
+};
+
+static bool place(const Footprint &f, int shift, double plate, const std::vector<Placed> &placed, Placed &best){
+  // best position of f turned by shift directions, return whether it fits
+  // the free point closest to the center is the center, or on an edge of the free space:
+  // at a corner, where edges of the inner-fit and no-fit polygons cross, or closest to the center on an edge
+  const int N = ARRANGE_DIRECTIONS;
+  for (int k = 0; k < N; k += 1){
+    best.h[k] = f.h[(k - shift + N) % N];
+  }
+
+  // inner-fit polygon, where the origin can go with the footprint on the plate
+  Region fit;
+  for (int k = 0; k < N; k += 1){
+    fit.c[k] = plate - best.h[k];
+  }
+  outline(fit.c, fit.p);
+  if(fit.p.empty()){
+    return false;
+  }
+
+  std::vector<Region> nfp(placed.size());
+  for (size_t i = 0; i < placed.size(); i += 1){
+    for (int k = 0; k < N; k += 1){
+      double dx, dy;
+      direction(k, dx, dy);
+      nfp[i].c[k] = placed[i].h[k] + best.h[(k + N / 2) % N] + dx * placed[i].x + dy * placed[i].y;
+    }
+    outline(nfp[i].c, nfp[i].p);
+    set_box(nfp[i]);
+  }
+  set_box(fit);
+
+  Poly candidates(2, 0);
+  candidates.insert(candidates.end(), fit.p.begin(), fit.p.end());
+  closest_on_edges(fit.p, candidates);
+  for (size_t i = 0; i < nfp.size(); i += 1){
+    if(!boxes_meet(nfp[i], fit)){
+      continue;
+    }
+    candidates.insert(candidates.end(), nfp[i].p.begin(), nfp[i].p.end());
+    closest_on_edges(nfp[i].p, candidates);
+    cross_edges(nfp[i], fit, candidates);
+    for (size_t j = i + 1; j < nfp.size(); j += 1){
+      if(boxes_meet(nfp[i], nfp[j])){
+        cross_edges(nfp[i], nfp[j], candidates);
+      }
+    }
+  }
+
+  // no-fit polygons by cells of a grid over the inner-fit polygon, so a candidate is only tested against its cell
+  size_t g = std::max((size_t)1, std::min((size_t)ARRANGE_GRID_MAX, (size_t)sqrt((double)nfp.size())));
+  double cell[2] = {(fit.hi[0] - fit.lo[0]) / g + 1e-9, (fit.hi[1] - fit.lo[1]) / g + 1e-9};
+  std::vector<std::vector<uint32_t> > grid(g * g);
+  for (size_t i = 0; i < nfp.size(); i += 1){
+    if(!boxes_meet(nfp[i], fit)){
+      continue;
+    }
+    size_t c0[2], c1[2];
+    for (int k = 0; k < 2; k += 1){
+      c0[k] = std::min(g - 1, (size_t)std::max(0., (nfp[i].lo[k] - fit.lo[k]) / cell[k]));
+      c1[k] = std::min(g - 1, (size_t)std::max(0., (nfp[i].hi[k] - fit.lo[k]) / cell[k]));
+    }
+    for (size_t y = c0[1]; y <= c1[1]; y += 1){
+      for (size_t x = c0[0]; x <= c1[0]; x += 1){
+        grid[y * g + x].push_back(i);
+      }
+    }
+  }
+
+  // only candidates in the inner-fit polygon are kept, closest to the center first,
+  // ties by y then x so the result doesn't depend on the order found
+  std::vector<size_t> order;
+  for (size_t i = 0; i < candidates.size() / 2; i += 1){
+    bool in = true;
+    for (int k = 0; k < N && in; k += 1){
+      in = dirs.x[k] * candidates[i * 2] + dirs.y[k] * candidates[i * 2 + 1] <= fit.c[k] + ARRANGE_TOLERANCE;
+    }
+    if(in){
+      order.push_back(i);
+    }
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b){
+    double ra = candidates[a * 2] * candidates[a * 2] + candidates[a * 2 + 1] * candidates[a * 2 + 1];
+    double rb = candidates[b * 2] * candidates[b * 2] + candidates[b * 2 + 1] * candidates[b * 2 + 1];
+    if(ra != rb){
+      return ra < rb;
+    }
+    if(candidates[a * 2 + 1] != candidates[b * 2 + 1]){
+      return candidates[a * 2 + 1] < candidates[b * 2 + 1];
+    }
+    return candidates[a * 2] < candidates[b * 2];
+  });
+  for (size_t i = 0; i < order.size(); i += 1){
+    double x = candidates[order[i] * 2], y = candidates[order[i] * 2 + 1];
+    size_t cx = std::min(g - 1, (size_t)std::max(0., (x - fit.lo[0]) / cell[0]));
+    size_t cy = std::min(g - 1, (size_t)std::max(0., (y - fit.lo[1]) / cell[1]));
+    const std::vector<uint32_t> &near = grid[cy * g + cx];
+    bool free = true;
+    for (size_t j = 0; j < near.size() && free; j += 1){
+      free = !inside(nfp[near[j]], x, y);
+    }
+    if(free){
+      best.x = x;
+      best.y = y;
+      return true;
+    }
+  }
+  return false;
+}
+
+int arrange_footprints(const std::vector<Footprint> &footprints, float radius, std::vector<Placement> &out){
+  size_t n = footprints.size();
+  out.assign(n, Placement());
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i += 1){
+    order[i] = i;
+    out[i].placed = false;
+    out[i].x = out[i].y = out[i].rz = 0;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b){
+    return footprints[a].area > footprints[b].area;
+  });
+
+  // inscribed polygon of the plate
+  double plate = radius * cos(M_PI / ARRANGE_DIRECTIONS);
+  std::vector<Placed> placed;
+  std::vector<const Footprint*> failed;
+  int count = 0;
+  for (size_t i = 0; i < n; i += 1){
+    const Footprint &f = footprints[order[i]];
+    // copies of a model that didn't fit won't fit either
+    bool copy = false;
+    for (size_t j = 0; j < failed.size() && !copy; j += 1){
+      copy = true;
+      for (int k = 0; k < ARRANGE_DIRECTIONS && copy; k += 1){
+        copy = f.h[k] == failed[j] -> h[k];
+      }
+    }
+    if(copy){
+      continue;
+    }
+    // every rotation is tried in parallel, the closest to the center wins, then the smaller turn
+    std::vector<Placed> turned(ARRANGE_ROTATIONS);
+    std::vector<uint8_t> fits(ARRANGE_ROTATIONS);
+    // a turn that gives the same footprint as a smaller one is left out, like half turns of a rectangle
+    std::vector<uint8_t> same(ARRANGE_ROTATIONS, 0);
+    for (int r = 1; r < ARRANGE_ROTATIONS; r += 1){
+      for (int q = 0; q < r && !same[r]; q += 1){
+        same[r] = 1;
+        for (int k = 0; k < ARRANGE_DIRECTIONS && same[r]; k += 1){
+          int step = ARRANGE_DIRECTIONS / ARRANGE_ROTATIONS;
+          same[r] = fabs(f.h[(k + r * step) % ARRANGE_DIRECTIONS] - f.h[(k + q * step) % ARRANGE_DIRECTIONS]) <= ARRANGE_TOLERANCE;
+        }
+      }
+    }
+    parallel_for(ARRANGE_ROTATIONS, parallel_workers(ARRANGE_ROTATIONS, 1), [&](size_t begin, size_t end, size_t w){
+      for (size_t r = begin; r < end; r += 1){
+        fits[r] = !same[r] && place(f, r * (ARRANGE_DIRECTIONS / ARRANGE_ROTATIONS), plate, placed, turned[r]);
+      }
+    });
+    int best = -1;
+    for (int r = 0; r < ARRANGE_ROTATIONS; r += 1){
+      if(fits[r] && (best < 0 || turned[r].x * turned[r].x + turned[r].y * turned[r].y < turned[best].x * turned[best].x + turned[best].y * turned[best].y)){
+        best = r;
+      }
+    }
+    if(best < 0){
+      failed.push_back(&f);
+      continue;
+    }
+    placed.push_back(turned[best]);
+    Placement &p = out[order[i]];
+    p.placed = true;
+    p.x = turned[best].x;
+    p.y = turned[best].y;
+    p.rz = 2 * M_PI * best / ARRANGE_ROTATIONS;
+    count += 1;
+  }
+  return count;
+}
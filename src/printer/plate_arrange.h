@@ -0,0 +1,40 @@
+#ifndef PLATE_ARRANGE_H
+#define PLATE_ARRANGE_H
+
+#include <stddef.h>
+#include <vector>
+#include "printer_module.h"
+
+// footprints are convex polygons with edges facing these many evenly spaced directions,
+// the circular plate is the inscribed polygon with the same edges
+#define ARRANGE_DIRECTIONS 32
+// rotations about z tried for each model, evenly spaced, must divide ARRANGE_DIRECTIONS
+#define ARRANGE_ROTATIONS 8
+// in mm, a position closer than this to a forbidden region still counts as free
+#define ARRANGE_TOLERANCE 1e-3f
+// largest number of cells on a side of the grid that finds no-fit polygons near a position
+#define ARRANGE_GRID_MAX 64
+
+struct Footprint{
+  // xy outline of a model as the support function over the directions,
+  // h[k]: largest p . (cos(2 pi k / ARRANGE_DIRECTIONS), sin(2 pi k / ARRANGE_DIRECTIONS))
+  // over the projected points p, so the polygon contains their convex hull
+  float h[ARRANGE_DIRECTIONS];
+  float area;
+};
+
+struct Placement{
+  // placed: whether the model fits on the plate, x, y: where its origin goes, rz: turn about z
+  bool placed;
+  float x, y, rz;
+};
+
+// footprint of the points of a mesh, grown by margin on every side
+// return 0, or -1 if the mesh has no point
+int footprint(MeshPtr triangles, float margin, Footprint &f);
+// place footprints on a circular plate of radius centered at the origin, larger ones first,
+// each as close to the center as it fits beside the ones already placed
+// return number of placed footprints
+int arrange_footprints(const std::vector<Footprint> &footprints, float radius, std::vector<Placement> &out);
+
+#endif
@@ -1,7 +1,12 @@
 import cython
 from libcpp.vector cimport vector
+from libc.stdint cimport uint8_t, uint32_t
+from libc.string cimport memcpy
+from cpython.buffer cimport PyBUF_WRITABLE
 import logging
 
+import numpy as np
+
 logger = logging.getLogger(__name__)
 
 cdef extern from "printer_module.h":
@@ -11,52 +16,296 @@ cdef extern from "printer_module.h":
         pass
     MeshPtr createMeshPtr()
     CloudPtr createCloudPtr(vector[vector [float]] points)
+    CloudPtr createCloudPtrFromArray(const float* points, size_t n) nogil
     int setCloud(MeshPtr triangles, CloudPtr cloud)
     int setPoints(MeshPtr triangles, vector[vector [float]] points)
+    int setPointsFromArray(MeshPtr triangles, const float* points, size_t n) nogil
     int push_backFace(MeshPtr triangles, int v0, int v1, int v2)
+    int setFaces(MeshPtr triangles, const int* faces, size_t m, size_t point_count) nogil
     int add_on(MeshPtr base, MeshPtr new_mesh)
-    int STL_to_List(MeshPtr triangles, vector[vector [vector [float]]] &data)
+    int export_triangles(MeshPtr triangles, float* data) nogil
+    int export_points(MeshPtr triangles, float* data) nogil
+    int export_faces(MeshPtr triangles, int* data) nogil
     int apply_transform(MeshPtr triangles, float x, float y, float z, float rx, float ry, float rz, float sc_x, float sc_y, float sc_z)
     int bounding_box(MeshPtr triangles, vector[float] &b_box)
     int cut(MeshPtr input_mesh, MeshPtr out_mesh, float floor_v)
     int mesh_len(MeshPtr input_mesh)
+    int mesh_point_count(MeshPtr input_mesh)
+    int copy_mesh(MeshPtr src, MeshPtr dst)
+    cdef cppclass MeshInstance:
+        MeshPtr mesh
+        float x, y, rz
+    int instances_bounding_box "bounding_box"(const vector[MeshInstance] &instances, vector[float] &b_box) nogil
+    int expand_instances(const vector[MeshInstance] &instances, MeshPtr out_mesh) nogil
+
+cdef extern from "mesh_io.h":
+    int MESH_IO_OPEN_FAILED
+    int MESH_IO_BAD_FORMAT
+    int read_stl(const char* filename, MeshPtr triangles) nogil
+    int read_stl_buffer(const char* data, size_t size, MeshPtr triangles) nogil
+    int MESH_IO_WRITE_FAILED
+    int MESH_FORMAT_STL_BINARY
+    int MESH_FORMAT_STL_ASCII
+    int MESH_FORMAT_PLY
+    int encode_mesh(MeshPtr triangles, int format, vector[char] &out) nogil
+    int write_mesh(MeshPtr triangles, int format, int fd) nogil
+    int write_mesh_file(MeshPtr triangles, int format, const char* filename) nogil
+    int write_instances(const vector[MeshInstance] &instances, int fd) nogil
+    int write_instances_file(const vector[MeshInstance] &instances, const char* filename) nogil
+
+cdef extern from "layer_slicer.h":
+    cdef cppclass Layer:
+        float z
+        vector[float] points
+        vector[uint32_t] start
+        vector[uint8_t] closed
+        double area
+        double perimeter
+    int SLICE_Z_NOT_SORTED
+    int slice_layers(MeshPtr triangles, const float* zs, size_t nz, vector[Layer] &layers) nogil
+
+cdef extern from "mesh_topology.h":
+    cdef cppclass ManifoldReport:
+        size_t components
+        size_t boundary_edges
+        size_t boundary_loops
+        size_t flipped_edges
+        size_t non_manifold_edges
+    int split_components(MeshPtr triangles, vector[MeshPtr] &parts) nogil
+    int manifold_report(MeshPtr triangles, ManifoldReport &report) nogil
+
+cdef extern from "mesh_decimate.h":
+    int decimate(MeshPtr input_mesh, MeshPtr out_mesh, size_t target_faces, float max_error) nogil
 
-    int write_stl_binary(MeshPtr triangles, char* filename)
+cdef extern from "mesh_orientation.h":
+    cdef cppclass Orientation:
+        float up[3]
+        float rx, ry
+        float overhang, contact, height, cost
+    int ORIENT_BAD_PARAMETER
+    int best_orientations(MeshPtr triangles, float alpha, size_t k, vector[Orientation] &out) nogil
+
+cdef extern from "plate_arrange.h":
+    cdef cppclass Footprint:
+        pass
+    cdef cppclass Placement:
+        bint placed
+        float x, y, rz
+    int footprint(MeshPtr triangles, float margin, Footprint &f) nogil
+    int arrange_footprints(const vector[Footprint] &footprints, float radius, vector[Placement] &out) nogil
+
+cdef extern from "tree_support.h":
+    cdef cppclass SupportProgress:
+        # std::atomic members, read and written through their implicit conversions
+        float value
+        bint cancel
+    int SUPPORT_CANCELLED
+    int SUPPORT_BAD_PARAMETER
+    int SUPPORT_TOO_MANY_VOXELS
+    cdef cppclass CSupportCache "SupportCache":
+        pass
+    int add_support(MeshPtr input_mesh, MeshPtr out_mesh, float alpha, float sample_rate, SupportProgress* progress, CSupportCache* cache) nogil
 
-# cdef extern from "tree_support.h":
-#     int add_support(MeshPtr input_mesh, MeshPtr out_mesh, float alpha)
+cdef as_points(point_list):
+    # float32[N, 3], C-contiguous
+    return np.ascontiguousarray(point_list, dtype=np.float32).reshape(-1, 3)
+
+cdef as_faces(f):
+    # int32[M, 3], C-contiguous
+    return np.ascontiguousarray(f, dtype=np.int32).reshape(-1, 3)
+
+cdef int mesh_format(fmt) except -1:
+    if fmt == 'stl':
+        return MESH_FORMAT_STL_BINARY
+    elif fmt == 'stl_ascii':
+        return MESH_FORMAT_STL_ASCII
+    elif fmt == 'ply':
+        return MESH_FORMAT_PLY
+    raise ValueError('unknown mesh format: %s' % fmt)
+
+cdef class MeshBuffer:
+    # encoded mesh, exposed through the buffer protocol without copy
+    cdef vector[char] data
+    cdef Py_ssize_t shape[1]
+    cdef Py_ssize_t strides[1]
+
+    def __getbuffer__(self, Py_buffer *buffer, int flags):
+        if flags & PyBUF_WRITABLE:
+            raise BufferError("MeshBuffer is read only")
+        self.shape[0] = self.data.size()
+        self.strides[0] = 1
+        buffer.buf = self.data.data()
+        buffer.format = 'B'
+        buffer.internal = NULL
+        buffer.itemsize = 1
+        buffer.len = self.data.size()
+        buffer.ndim = 1
+        buffer.obj = self
+        buffer.readonly = 1
+        buffer.shape = self.shape
+        buffer.strides = self.strides
+        buffer.suboffsets = NULL
+
+    def __releasebuffer__(self, Py_buffer *buffer):
+        pass
+
+    def __len__(self):
+        return self.data.size()
 
 cdef class MeshCloud:
     cdef CloudPtr cloud
-    
+    cdef size_t size
+
     def __init__(self, point_list):
-        logger.info("Create Cloud Ptr %d" % len(point_list))
-        self.cloud = createCloudPtr(point_list)
+        """
+        point_list[in]: float32[N, 3] numpy array or list of [x, y, z]
+        """
+        cdef const float[:, ::1] points = as_points(point_list)
+        cdef size_t n = points.shape[0]
+        cdef const float* ptr = &points[0, 0] if n else NULL
+        logger.info("Create Cloud Ptr %d" % n)
+        with nogil:
+            self.cloud = createCloudPtrFromArray(ptr, n)
+        self.size = n
+
+    def __len__(self):
+        return self.size
+
+cdef class SupportTask:
+    """
+    progress of MeshObj.add_support, can be read and cancelled from another thread
+    """
+    cdef SupportProgress state
+
+    @property
+    def progress(self):
+        """
+        fraction of the work done, 0 to 1
+        """
+        return self.state.value
+
+    @property
+    def cancelled(self):
+        return bool(self.state.cancel)
+
+    def cancel(self):
+        self.state.cancel = True
+
+cdef class SupportCache:
+    """
+    keeps what MeshObj.add_support found for one model, pass it again after the model
+    is turned about the z axis or moved and only the parts the move changes are redone,
+    any other change of the model starts over
+    """
+    cdef CSupportCache state
+    # set under the gil while an add_support uses state
+    cdef readonly bint busy
 
 cdef class MeshObj:
     cdef MeshPtr meshobj
 
-    def __init__(self, MeshCloud point_list, f):
+    def __cinit__(self):
         self.meshobj = createMeshPtr()
-        setCloud(self.meshobj, point_list.cloud)
 
-        if type(f).__name__ == 'list':
-            logger.info("Create STL from pylist size %d " % len(f))
-            #iterate all faces as [faceIndex1, faceIndex2, faceIndex3]
-            for v in f:
-                push_backFace(self.meshobj, v[0], v[1], v[2])
+    def __init__(self, point_list=None, f=None):
+        """
+        point_list[in]: MeshCloud, float32[N, 3] numpy array or list of [x, y, z]
+        f[in]: int32[M, 3] numpy array, flat numpy array or list of [i0, i1, i2]
+        """
+        if point_list is None:
+            return
+
+        cdef const float[:, ::1] points
+        cdef const float* points_ptr
+        cdef size_t n
+
+        if isinstance(point_list, MeshCloud):
+            setCloud(self.meshobj, (<MeshCloud>point_list).cloud)
+            n = (<MeshCloud>point_list).size
+        else:
+            points = as_points(point_list)
+            n = points.shape[0]
+            points_ptr = &points[0, 0] if n else NULL
+            with nogil:
+                setPointsFromArray(self.meshobj, points_ptr, n)
+
+        cdef const int[:, ::1] faces = as_faces(f if f is not None else [])
+        cdef size_t m = faces.shape[0]
+        cdef const int* faces_ptr = &faces[0, 0] if m else NULL
+        cdef int ret
+        logger.info("Create STL faces %d" % m)
+        with nogil:
+            ret = setFaces(self.meshobj, faces_ptr, m, n)
+        if ret < 0:
+            raise ValueError("Face index out of range")
+
+    @staticmethod
+    def from_stl(file_data):
+        """
+        file_data[in]: str indicating a file path, or bytes that is the content of stl file
+        read binary or ascii stl, vertices are welded and faces flipped to agree with the normals
+        """
+        cdef MeshObj mesh = MeshObj()
+        cdef const char* buf
+        cdef size_t size
+        cdef int ret
+
+        if type(file_data) == str:
+            path = file_data.encode()
+            buf = path
+            with nogil:
+                ret = read_stl(buf, mesh.meshobj)
+        elif type(file_data) == bytes:
+            buf = file_data
+            size = len(file_data)
+            with nogil:
+                ret = read_stl_buffer(buf, size, mesh.meshobj)
         else:
-            logger.info("Create STL from numpy array size %d " % f.size)
-            # note: numpy optimized, do not use range
-            i = 0
-            while i < f.size:
-                push_backFace(self.meshobj, f[i], f[i+1], f[i+2])
-                i += 3
-
-    # def add_support(self, alpha):
-    #     out_mesh = MeshObj([], [])
-    #     add_support(self.meshobj, out_mesh.meshobj, alpha)
-    #     return out_mesh
+            raise ValueError('wrong stl data type: %s' % str(type(file_data)))
+
+        if ret == MESH_IO_OPEN_FAILED:
+            raise IOError("Can not open %s" % file_data)
+        elif ret < 0:
+            raise ValueError("Bad stl data")
+        logger.info("Read stl faces %d" % ret)
+        return mesh
+
+    def copy(self):
+        cdef MeshObj mesh = MeshObj()
+        copy_mesh(self.meshobj, mesh.meshobj)
+        return mesh
+
+    def add_support(self, float alpha, float sample_rate=1, SupportTask task=None, SupportCache cache=None):
+        """
+        alpha[in]: faces overhanging more than this from the vertical get supported, in radians
+        sample_rate[in]: spacing of support points on overhangs, in mm
+        task[in]: SupportTask to watch progress or cancel from another thread
+        cache[in]: SupportCache of this model, used by one call at a time
+        return MeshObj of the tree support struts, or None if cancelled
+        """
+        if task is None:
+            task = SupportTask()
+        out_mesh = MeshObj()
+        cdef CSupportCache* cache_ptr = NULL
+        cdef int ret
+        if cache is not None:
+            if cache.busy:
+                raise RuntimeError("SupportCache is used by another add_support")
+            cache.busy = True
+            cache_ptr = &cache.state
+        try:
+            with nogil:
+                ret = add_support(self.meshobj, out_mesh.meshobj, alpha, sample_rate, &task.state, cache_ptr)
+        finally:
+            if cache is not None:
+                cache.busy = False
+        if ret == SUPPORT_CANCELLED:
+            return None
+        elif ret == SUPPORT_BAD_PARAMETER:
+            raise ValueError("alpha must be in (0, pi / 2) and sample_rate positive")
+        elif ret == SUPPORT_TOO_MANY_VOXELS:
+            raise ValueError("sample_rate %g is too small for the size of this model" % sample_rate)
+        return out_mesh
 
     def apply_transform(self, transform_param):
         # transform_param:  x, y, z, rx, ry, rz, scale
@@ -74,8 +323,200 @@ cdef class MeshObj:
     def __len__(self):
         return mesh_len(self.meshobj)
 
+    def decimate(self, size_t target_faces=0, float max_error=0):
+        """
+        target_faces[in]: stop when there are no more faces than this
+        max_error[in]: approximate quadric error threshold in mm, stop once the cheapest collapse
+                       costs more than max_error squared, not a bound on how far any point moves
+        return a simplified MeshObj, boundaries and sharp edges are kept
+        """
+        if target_faces == 0 and max_error <= 0:
+            raise ValueError("target_faces or max_error must be given")
+        out_mesh = MeshObj()
+        with nogil:
+            decimate(self.meshobj, out_mesh.meshobj, target_faces, max_error)
+        return out_mesh
+
+    def split_components(self):
+        """
+        return a list of MeshObj, one for each group of faces connected by edges,
+        in order of their first face
+        """
+        cdef vector[MeshPtr] parts
+        cdef MeshObj part
+        with nogil:
+            split_components(self.meshobj, parts)
+        result = []
+        for i in range(parts.size()):
+            part = MeshObj()
+            part.meshobj = parts[i]
+            result.append(part)
+        return result
+
+    def manifold_report(self):
+        """
+        return a dict about the topology of the mesh
+        components: groups of faces connected by edges
+        boundary_edges, boundary_loops: edges used by one face and the holes they form
+        flipped_edges: edges shared by 2 faces with inconsistent winding
+        non_manifold_edges: edges shared by more than 2 faces
+        watertight: no boundary, flipped or non-manifold edge
+        """
+        cdef ManifoldReport report
+        with nogil:
+            manifold_report(self.meshobj, report)
+        return {
+            'components': report.components,
+            'boundary_edges': report.boundary_edges,
+            'boundary_loops': report.boundary_loops,
+            'flipped_edges': report.flipped_edges,
+            'non_manifold_edges': report.non_manifold_edges,
+            'watertight': report.boundary_edges == report.flipped_edges == report.non_manifold_edges == 0
+        }
+
+    def best_orientations(self, size_t k=1, float alpha=np.pi / 4):
+        """
+        k[in]: number of orientations wanted
+        alpha[in]: faces overhanging more than this from the vertical need support, in radians
+        return list of up to k dicts, lowest cost first
+        rotation: rx, ry, rz for apply_transform
+        up: direction of the model that points up after the rotation
+        overhang, contact: area of faces needing support and lying on the plate, in mm^2
+        height: build height in mm
+        cost: lower is better, weighs overhang, contact and height
+        """
+        cdef vector[Orientation] out
+        cdef int ret
+        with nogil:
+            ret = best_orientations(self.meshobj, alpha, k, out)
+        if ret == ORIENT_BAD_PARAMETER:
+            raise ValueError("alpha must be in (0, pi / 2)")
+        return [{
+            'rotation': (o.rx, o.ry, 0.),
+            'up': (o.up[0], o.up[1], o.up[2]),
+            'overhang': o.overhang,
+            'contact': o.contact,
+            'height': o.height,
+            'cost': o.cost
+        } for o in out]
+
+    cdef vector[Layer] slice_to(self, zs) except *:
+        cdef const float[::1] z_view = np.ascontiguousarray(zs, dtype=np.float32)
+        cdef size_t nz = z_view.shape[0]
+        cdef const float* z_ptr = &z_view[0] if nz else NULL
+        cdef vector[Layer] layers
+        cdef int ret
+        with nogil:
+            ret = slice_layers(self.meshobj, z_ptr, nz, layers)
+        if ret == SLICE_Z_NOT_SORTED:
+            raise ValueError("z of layers must be ascending")
+        return layers
+
+    def slice_layers(self, zs):
+        """
+        zs[in]: ascending z of slicing planes
+        return a list of (polygons, open_chains) for each z, both are lists of
+        float32[K, 2] numpy arrays. polygons are closed, counterclockwise around
+        solid and clockwise around holes. open_chains only come from a mesh that
+        is not watertight
+        """
+        cdef vector[Layer] layers = self.slice_to(zs)
+        cdef size_t i, j
+        cdef float[:, ::1] view
+        result = []
+        for i in range(layers.size()):
+            points = np.empty((layers[i].points.size() // 2, 2), dtype=np.float32)
+            view = points
+            if view.shape[0]:
+                memcpy(&view[0, 0], layers[i].points.data(), layers[i].points.size() * sizeof(float))
+            polygons, open_chains = [], []
+            for j in range(layers[i].closed.size()):
+                poly = points[layers[i].start[j]:layers[i].start[j + 1]]
+                (polygons if layers[i].closed[j] else open_chains).append(poly)
+            result.append((polygons, open_chains))
+        return result
+
+    def layer_stats(self, zs):
+        """
+        zs[in]: ascending z of slicing planes
+        return float64[L, 2] numpy array, area and perimeter of the cross section at each z
+        """
+        cdef vector[Layer] layers = self.slice_to(zs)
+        out = np.empty((layers.size(), 2), dtype=np.float64)
+        cdef size_t i
+        for i in range(layers.size()):
+            out[i, 0] = layers[i].area
+            out[i, 1] = layers[i].perimeter
+        return out
+
+    def triangles(self):
+        """
+        return float32[M, 3, 3] numpy array, x, y, z of the 3 points of each face
+        """
+        out = np.empty((mesh_len(self.meshobj), 3, 3), dtype=np.float32)
+        cdef float[:, :, ::1] view = out
+        if view.shape[0]:
+            with nogil:
+                export_triangles(self.meshobj, &view[0, 0, 0])
+        return out
+
+    def arrays(self):
+        """
+        return (float32[N, 3], int32[M, 3]) numpy arrays, points and vertex indices of each face
+        """
+        points = np.empty((mesh_point_count(self.meshobj), 3), dtype=np.float32)
+        faces = np.empty((mesh_len(self.meshobj), 3), dtype=np.int32)
+        cdef float[:, ::1] points_view = points
+        cdef int[:, ::1] faces_view = faces
+        if points_view.shape[0]:
+            with nogil:
+                export_points(self.meshobj, &points_view[0, 0])
+        if faces_view.shape[0]:
+            with nogil:
+                export_faces(self.meshobj, &faces_view[0, 0])
+        return points, faces
+
     cpdef write_stl(self, filename):
-        write_stl_binary(self.meshobj, filename.encode())
+        self.write(filename, 'stl')
+
+    def write(self, target, fmt='stl'):
+        """
+        target[in]: file path, file descriptor or file object with fileno()
+        fmt[in]: 'stl', 'stl_ascii' or 'ply'
+        """
+        cdef int format = mesh_format(fmt)
+        cdef int fd
+        cdef const char* path
+        cdef int ret
+
+        if isinstance(target, str):
+            encoded = target.encode()
+            path = encoded
+            with nogil:
+                ret = write_mesh_file(self.meshobj, format, path)
+        else:
+            if not isinstance(target, int):
+                target.flush()
+                target = target.fileno()
+            fd = target
+            with nogil:
+                ret = write_mesh(self.meshobj, format, fd)
+
+        if ret == MESH_IO_OPEN_FAILED:
+            raise IOError("Can not open %s" % target)
+        elif ret < 0:
+            raise IOError("Write mesh failed")
+
+    def dumps(self, fmt='stl'):
+        """
+        fmt[in]: 'stl', 'stl_ascii' or 'ply'
+        return a read only memoryview of the encoded mesh
+        """
+        cdef int format = mesh_format(fmt)
+        cdef MeshBuffer buf = MeshBuffer()
+        with nogil:
+            encode_mesh(self.meshobj, format, buf.data)
+        return memoryview(buf)
 
     cpdef bounding_box(self):
         cpdef vector[float] tmp_b_box
@@ -86,3 +527,115 @@ cdef class MeshObj:
             b_box[i // 3][i % 3] = tmp_b_box[i]
 
         return b_box
+
+
+cdef class MeshInstances:
+    """
+    models placed as copies of shared meshes, each copy turned rz about the z axis
+    then moved by x, y. the geometry is only expanded by merge() or when written
+    """
+    cdef vector[MeshInstance] instances
+    cdef list meshes
+
+    def __cinit__(self):
+        self.meshes = []
+
+    def add(self, MeshObj mesh, float x, float y, float rz=0):
+        cdef MeshInstance instance
+        instance.mesh = mesh.meshobj
+        instance.x, instance.y, instance.rz = x, y, rz
+        self.instances.push_back(instance)
+        self.meshes.append(mesh)
+
+    def __len__(self):
+        return sum(len(m) for m in self.meshes)
+
+    cpdef bounding_box(self):
+        cdef vector[float] tmp_b_box
+        with nogil:
+            instances_bounding_box(self.instances, tmp_b_box)
+        return [[tmp_b_box[j * 3 + i] for i in range(3)] for j in range(2)]
+
+    def layer_stats(self, zs):
+        """
+        zs[in]: ascending z of slicing planes
+        return float64[L, 2] numpy array, area and perimeter of the cross section at each z
+        """
+        # turning about z and moving in xy keep the cross sections, so each mesh is sliced once
+        stats = np.zeros((len(zs), 2), dtype=np.float64)
+        counted = {}
+        for m in self.meshes:
+            if id(m) not in counted:
+                counted[id(m)] = m.layer_stats(zs)
+            stats += counted[id(m)]
+        return stats
+
+    def merge(self):
+        """
+        return a MeshObj holding the geometry of every instance
+        """
+        cdef MeshObj mesh = MeshObj(MeshCloud([]), [])
+        with nogil:
+            expand_instances(self.instances, mesh.meshobj)
+        return mesh
+
+    def write_stl(self, target):
+        """
+        write every instance into one binary stl
+        target[in]: file path, file descriptor or file object with fileno()
+        """
+        cdef int fd
+        cdef const char* path
+        cdef int ret
+
+        if isinstance(target, str):
+            encoded = target.encode()
+            path = encoded
+            with nogil:
+                ret = write_instances_file(self.instances, path)
+        else:
+            if not isinstance(target, int):
+                target.flush()
+                target = target.fileno()
+            fd = target
+            with nogil:
+                ret = write_instances(self.instances, fd)
+
+        if ret == MESH_IO_OPEN_FAILED:
+            raise IOError("Can not open %s" % target)
+        elif ret < 0:
+            raise IOError("Write mesh failed")
+
+
+def arrange(meshes, float radius, float margin=0):
+    """
+    place meshes side by side on a circular plate, turning them about z
+    meshes[in]: MeshObj of each model, placed by the origin of its coordinates
+    radius[in]: radius of the plate centered at the origin
+    margin[in]: the outline of each mesh is grown by this, so models are 2 * margin apart
+    return list of (x, y, rz) for each mesh, move it by x, y after turning it rz about the origin,
+    None for the ones without room or points
+    """
+    cdef vector[Footprint] footprints = vector[Footprint](len(meshes))
+    cdef vector[uint8_t] ok = vector[uint8_t](len(meshes))
+    cdef vector[Placement] out
+    cdef MeshObj mesh
+    cdef size_t i
+    for i in range(len(meshes)):
+        mesh = meshes[i]
+        with nogil:
+            ok[i] = footprint(mesh.meshobj, margin, footprints[i]) == 0
+    # a mesh without points takes no room, it's not placed
+    cdef vector[Footprint] kept
+    cdef vector[size_t] index
+    for i in range(len(meshes)):
+        if ok[i]:
+            kept.push_back(footprints[i])
+            index.push_back(i)
+    with nogil:
+        arrange_footprints(kept, radius, out)
+    result = [None] * len(meshes)
+    for i in range(out.size()):
+        if out[i].placed:
+            result[index[i]] = (out[i].x, out[i].y, out[i].rz)
+    return result
@@ -3,15 +3,61 @@
 #include <map>
 #include <algorithm>
 #include <limits>
+#include <unordered_map>
+#include <string.h>
 
 #include "printer_module.h"
+#include "parallel.h"
 
 
 MeshPtr createMeshPtr(){
-  MeshPtr mesh(new pcl::PolygonMesh);
+  MeshPtr mesh(new Mesh);
   return mesh;
 }
 
+pcl::PolygonMesh::Ptr to_polygon_mesh(MeshPtr triangles){
+  // build the pcl form, only for pcl algorithms that need it
+  pcl::PolygonMesh::Ptr polygon_mesh(new pcl::PolygonMesh);
+  pcl::PointCloud<pcl::PointXYZ> cloud;
+  cloud.points.resize(triangles->point_count());
+  for (size_t i = 0; i < cloud.points.size(); i += 1){
+    cloud.points[i].x = triangles->points[i * 3];
+    cloud.points[i].y = triangles->points[i * 3 + 1];
+    cloud.points[i].z = triangles->points[i * 3 + 2];
+  }
+  cloud.width = cloud.points.size();
+  cloud.height = 1;
+  toPCLPointCloud2(cloud, polygon_mesh->cloud);
+
+  polygon_mesh->polygons.resize(triangles->face_count());
+  for (size_t i = 0; i < polygon_mesh->polygons.size(); i += 1){
+    polygon_mesh->polygons[i].vertices.assign(triangles->faces.begin() + i * 3, triangles->faces.begin() + i * 3 + 3);
+  }
+  return polygon_mesh;
+}
+
+int from_polygon_mesh(const pcl::PolygonMesh &polygon_mesh, MeshPtr triangles){
+  // polygons other than triangles are skipped
+  pcl::PointCloud<pcl::PointXYZ> cloud;
+  fromPCLPointCloud2(polygon_mesh.cloud, cloud);
+  triangles->points.resize(cloud.size() * 3);
+  for (size_t i = 0; i < cloud.size(); i += 1){
+    triangles->points[i * 3] = cloud[i].x;
+    triangles->points[i * 3 + 1] = cloud[i].y;
+    triangles->points[i * 3 + 2] = cloud[i].z;
+  }
+  triangles->points_changed();
+  triangles->faces.clear();
+  triangles->faces_changed();
+  triangles->faces.reserve(polygon_mesh.polygons.size() * 3);
+  for (size_t i = 0; i < polygon_mesh.polygons.size(); i += 1){
+    if(polygon_mesh.polygons[i].vertices.size() == 3){
+      triangles->faces.insert(triangles->faces.end(), polygon_mesh.polygons[i].vertices.begin(), polygon_mesh.polygons[i].vertices.end());
+    }
+  }
+  return 0;
+}
+
 CloudPtr createCloudPtr(std::vector< std::vector<float> > points){
   CloudPtr cloud(new pcl::PointCloud<pcl::PointXYZ>());
   for (uint32_t i = 0; i < points.size(); i += 1){
@@ -24,135 +70,219 @@ CloudPtr createCloudPtr(std::vector< std::vector<float> > points){
   return cloud;
 }
 
+CloudPtr createCloudPtrFromArray(const float* points, size_t n){
+  // points: n * 3 contiguous floats
+  CloudPtr cloud(new pcl::PointCloud<pcl::PointXYZ>());
+  cloud->points.resize(n);
+  for (size_t i = 0; i < n; i += 1){
+    cloud->points[i].x = points[i * 3];
+    cloud->points[i].y = points[i * 3 + 1];
+    cloud->points[i].z = points[i * 3 + 2];
+  }
+  cloud->width = n;
+  cloud->height = 1;
+  return cloud;
+}
+
 int setCloud(MeshPtr triangles, CloudPtr cloud){
-  toPCLPointCloud2(*cloud, triangles->cloud);
+  triangles->points.resize(cloud->size() * 3);
+  for (size_t i = 0; i < cloud->size(); i += 1){
+    triangles->points[i * 3] = (*cloud)[i].x;
+    triangles->points[i * 3 + 1] = (*cloud)[i].y;
+    triangles->points[i * 3 + 2] = (*cloud)[i].z;
+  }
+  triangles->points_changed();
   return 1;
 }
 
 int setPoints(MeshPtr triangles, std::vector< std::vector<float> > points){
-  pcl::PointCloud<pcl::PointXYZ>* cloud = new pcl::PointCloud<pcl::PointXYZ>();
-  for (uint32_t i = 0; i < points.size(); i += 1){
-    pcl::PointXYZ p;
-    p.x = points[i][0];
-    p.y = points[i][1];
-    p.z = points[i][2];
-    cloud -> push_back(p);
+  triangles->points.resize(points.size() * 3);
+  for (size_t i = 0; i < points.size(); i += 1){
+    triangles->points[i * 3] = points[i][0];
+    triangles->points[i * 3 + 1] = points[i][1];
+    triangles->points[i * 3 + 2] = points[i][2];
   }
+  triangles->points_changed();
+  return 0;
+}
 
-  toPCLPointCloud2(*cloud, triangles->cloud);
-  delete cloud;
+int setPointsFromArray(MeshPtr triangles, const float* points, size_t n){
+  triangles->points.assign(points, points + n * 3);
+  triangles->points_changed();
+  return 0;
+}
+
+int setFaces(MeshPtr triangles, const int* faces, size_t m, size_t point_count){
+  // faces: m * 3 contiguous vertex indices, replace all faces of the mesh
+  // return -1 if any index is out of range, the mesh is not changed
+  for (size_t i = 0; i < m * 3; i += 1){
+    if(faces[i] < 0 || (size_t)faces[i] >= point_count){
+      return -1;
+    }
+  }
+  triangles->faces.assign(faces, faces + m * 3);
+  triangles->faces_changed();
+  return 0;
 }
 
 int push_backFace(MeshPtr triangles, int v0, int v1, int v2){
-  pcl::Vertices v;
-  v.vertices.resize(3);
-  v.vertices[0] = v0;
-  v.vertices[1] = v1;
-  v.vertices[2] = v2;
-  triangles->polygons.push_back(v);
+  triangles->faces.push_back(v0);
+  triangles->faces.push_back(v1);
+  triangles->faces.push_back(v2);
+  triangles->faces_changed();
   return 0;
 }
 
 int add_on(MeshPtr base, MeshPtr add_on_mesh){
-  pcl::PointCloud<pcl::PointXYZ>* cloud = new pcl::PointCloud<pcl::PointXYZ>();
-  fromPCLPointCloud2(base->cloud, *cloud);
-  int size_to_add_on = cloud->size();
-
-  pcl::PointCloud<pcl::PointXYZ>* cloud2 = new pcl::PointCloud<pcl::PointXYZ>();
-  fromPCLPointCloud2(add_on_mesh->cloud, *cloud2);
+  uint32_t size_to_add_on = base->point_count();
 
     // add cloud together
-  *cloud += *cloud2;
+  base->points.insert(base->points.end(), add_on_mesh->points.begin(), add_on_mesh->points.end());
 
-  pcl::Vertices v;
-  v.vertices.resize(3);
     // add faces, but shift the index for add on mesh
-  for (uint32_t i = 0; i < add_on_mesh->polygons.size(); i += 1){
-    v.vertices[0] = add_on_mesh->polygons[i].vertices[0] + size_to_add_on;
-    v.vertices[1] = add_on_mesh->polygons[i].vertices[1] + size_to_add_on;
-    v.vertices[2] = add_on_mesh->polygons[i].vertices[2] + size_to_add_on;
-    base->polygons.push_back(v);
+  size_t start = base->faces.size();
+  base->faces.resize(start + add_on_mesh->faces.size());
+  for (size_t i = 0; i < add_on_mesh->faces.size(); i += 1){
+    base->faces[start + i] = add_on_mesh->faces[i] + size_to_add_on;
   }
+  base->faces_changed();
 
-  toPCLPointCloud2(*cloud, base->cloud);
-  delete cloud;
-  delete cloud2;
+    // bounds of the union, no need to scan again
+  if(base->bbox_valid && add_on_mesh->bbox_valid){
+    for (int i = 0; i < 3; i += 1){
+      base->bbox[i] = std::min(base->bbox[i], add_on_mesh->bbox[i]);
+      base->bbox[i + 3] = std::max(base->bbox[i + 3], add_on_mesh->bbox[i + 3]);
+    }
+  }
+  else{
+    base->points_changed();
+  }
   return 0;
 }
 
-int bounding_box(MeshPtr triangles, std::vector<float> &b_box){
-  pcl::PointCloud<pcl::PointXYZ>* cloud = new pcl::PointCloud<pcl::PointXYZ>();
-  fromPCLPointCloud2(triangles->cloud, *cloud);
-  float minx = std::numeric_limits<double>::infinity(), miny = std::numeric_limits<double>::infinity(), minz = std::numeric_limits<double>::infinity();
-  float maxx = -1 * std::numeric_limits<double>::infinity(), maxy = -1 * std::numeric_limits<double>::infinity(), maxz = -1 * std::numeric_limits<double>::infinity();
-
-  for (uint32_t i = 0; i < cloud->size(); i += 1){
-    if((*cloud)[i].x > maxx){
-      maxx = (*cloud)[i].x;
-    }
-    if((*cloud)[i].y > maxy){
-      maxy = (*cloud)[i].y;
-    }
-    if((*cloud)[i].z > maxz){
-      maxz = (*cloud)[i].z;
-    }
+static void empty_box(float box[6]){
+  for (int i = 0; i < 3; i += 1){
+    box[i] = std::numeric_limits<float>::infinity();
+    box[i + 3] = -std::numeric_limits<float>::infinity();
+  }
+}
 
-    if((*cloud)[i].x < minx){
-      minx = (*cloud)[i].x;
-    }
-    if((*cloud)[i].y < miny){
-      miny = (*cloud)[i].y;
-    }
-    if((*cloud)[i].z < minz){
-      minz = (*cloud)[i].z;
+static void merge_box(float box[6], const float other[6]){
+  for (int i = 0; i < 3; i += 1){
+    box[i] = std::min(box[i], other[i]);
+    box[i + 3] = std::max(box[i + 3], other[i + 3]);
+  }
+}
+
+static void scan_block(const float* p, size_t n, float box[6]){
+  empty_box(box);
+  for (size_t i = 0; i < n; i += 1, p += 3){
+    for (int j = 0; j < 3; j += 1){
+      box[j] = std::min(box[j], p[j]);
+      box[j + 3] = std::max(box[j + 3], p[j]);
     }
   }
+}
 
-  b_box.resize(6);
-  b_box[0] = minx;
-  b_box[1] = miny;
-  b_box[2] = minz;
-  b_box[3] = maxx;
-  b_box[4] = maxy;
-  b_box[5] = maxz;
-  delete cloud;
+int bounding_box(MeshPtr triangles, std::vector<float> &b_box){
+  // O(1) unless points changed since last transform or scan
+  if(!triangles->bbox_valid){
+    bounding_box(triangles->points.data(), triangles->point_count(), b_box);
+    std::copy(b_box.begin(), b_box.end(), triangles->bbox);
+    triangles->bbox_valid = true;
+  }
+  b_box.assign(triangles->bbox, triangles->bbox + 6);
   return 0;
 }
 
-int bounding_box(pcl::PointCloud<pcl::PointXYZ>* cloud, std::vector<float> &b_box){
-  float minx = std::numeric_limits<double>::infinity(), miny = std::numeric_limits<double>::infinity(), minz = std::numeric_limits<double>::infinity();
-  float maxx = -1 * std::numeric_limits<double>::infinity(), maxy = -1 * std::numeric_limits<double>::infinity(), maxz = -1 * std::numeric_limits<double>::infinity();
+int bounding_box(const float* points, size_t n, std::vector<float> &b_box){
+  size_t workers = parallel_workers(n, POINTS_PER_WORKER);
+  std::vector<float> boxes(workers * 6);
+  parallel_for(n, workers, [&](size_t begin, size_t end, size_t w){
+    scan_block(points + begin * 3, end - begin, &boxes[w * 6]);
+  });
 
-  for (uint32_t i = 0; i < cloud->size(); i += 1){
-    if((*cloud)[i].x > maxx){
-      maxx = (*cloud)[i].x;
-    }
-    if((*cloud)[i].y > maxy){
-      maxy = (*cloud)[i].y;
-    }
-    if((*cloud)[i].z > maxz){
-      maxz = (*cloud)[i].z;
-    }
+  b_box.resize(6);
+  empty_box(&b_box[0]);
+  for (size_t w = 0; w < workers; w += 1){
+    merge_box(&b_box[0], &boxes[w * 6]);
+  }
+  return 0;
+}
 
-    if((*cloud)[i].x < minx){
-      minx = (*cloud)[i].x;
-    }
-    if((*cloud)[i].y < miny){
-      miny = (*cloud)[i].y;
+static void transform_block(float* p, size_t n, const float m[12], float box[6]){
+  // p = m * p for n points, m is a row major 3x4 affine matrix
+  // box: bounds of the transformed points
+  size_t i = 0;
+  empty_box(box);
+#ifdef PRINTER_USE_SSE
+  // 4 points per iteration: 12 floats are loaded as 3 registers
+  // and shuffled into x, y, z lanes, then shuffled back to store
+  __m128 r[12];
+  for (int k = 0; k < 12; k += 1){
+    r[k] = _mm_set1_ps(m[k]);
+  }
+  __m128 lo[3], hi[3];
+  for (int k = 0; k < 3; k += 1){
+    lo[k] = _mm_set1_ps(box[k]);
+    hi[k] = _mm_set1_ps(box[k + 3]);
+  }
+  for (; i + 4 <= n; i += 4){
+    float* q = p + i * 3;
+    __m128 a = _mm_loadu_ps(q);      // x0 y0 z0 x1
+    __m128 b = _mm_loadu_ps(q + 4);  // y1 z1 x2 y2
+    __m128 c = _mm_loadu_ps(q + 8);  // z2 x3 y3 z3
+
+    __m128 x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+    __m128 y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), c, _MM_SHUFFLE(3, 0, 2, 0));
+
+    __m128 v[3];
+    for (int k = 0; k < 3; k += 1){
+      v[k] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r[k * 4], x), _mm_mul_ps(r[k * 4 + 1], y)), _mm_mul_ps(r[k * 4 + 2], z)), r[k * 4 + 3]);
+      lo[k] = _mm_min_ps(lo[k], v[k]);
+      hi[k] = _mm_max_ps(hi[k], v[k]);
     }
-    if((*cloud)[i].z < minz){
-      minz = (*cloud)[i].z;
+
+    a = _mm_shuffle_ps(_mm_shuffle_ps(v[0], v[1], _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_ps(v[2], v[0], _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+    b = _mm_shuffle_ps(_mm_shuffle_ps(v[1], v[2], _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(v[0], v[1], _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+    c = _mm_shuffle_ps(_mm_shuffle_ps(v[2], v[0], _MM_SHUFFLE(3, 3, 2, 2)), _mm_shuffle_ps(v[1], v[2], _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+    _mm_storeu_ps(q, a);
+    _mm_storeu_ps(q + 4, b);
+    _mm_storeu_ps(q + 8, c);
+  }
+  for (int k = 0; k < 3; k += 1){
+    float l[4], h[4];
+    _mm_storeu_ps(l, lo[k]);
+    _mm_storeu_ps(h, hi[k]);
+    box[k] = std::min(std::min(l[0], l[1]), std::min(l[2], l[3]));
+    box[k + 3] = std::max(std::max(h[0], h[1]), std::max(h[2], h[3]));
+  }
+#endif
+  for (; i < n; i += 1){
+    float* q = p + i * 3;
+    float v[3];
+    for (int k = 0; k < 3; k += 1){
+      v[k] = m[k * 4] * q[0] + m[k * 4 + 1] * q[1] + m[k * 4 + 2] * q[2] + m[k * 4 + 3];
+      box[k] = std::min(box[k], v[k]);
+      box[k + 3] = std::max(box[k + 3], v[k]);
     }
+    memcpy(q, v, sizeof(v));
   }
-  b_box.resize(6);
-  b_box[0] = minx;
-  b_box[1] = miny;
-  b_box[2] = minz;
-  b_box[3] = maxx;
-  b_box[4] = maxy;
-  b_box[5] = maxz;
+}
 
-  return 0;
+static void transform_points(float* points, size_t n, const float m[12], float box[6]){
+  // transform_block split among workers, box: bounds of all transformed points
+  size_t workers = parallel_workers(n, POINTS_PER_WORKER);
+  std::vector<float> boxes(workers * 6);
+  parallel_for(n, workers, [&](size_t begin, size_t end, size_t w){
+    transform_block(points + begin * 3, end - begin, m, &boxes[w * 6]);
+  });
+
+  empty_box(box);
+  for (size_t w = 0; w < workers; w += 1){
+    merge_box(box, &boxes[w * 6]);
+  }
 }
 
 Eigen::Affine3f create_rotation_matrix(float ax, float ay, float az) {
@@ -166,16 +296,12 @@ Eigen::Affine3f create_rotation_matrix(float ax, float ay, float az) {
 }
 
 int apply_transform(MeshPtr triangles, float x, float y, float z, float rx, float ry, float rz, float sc_x, float sc_y, float sc_z){
-  pcl::PointCloud<pcl::PointXYZ>* cloud = new pcl::PointCloud<pcl::PointXYZ>();
-  fromPCLPointCloud2(triangles->cloud, *cloud);
-
   std::vector<float> b_box;
-  b_box.resize(3);
   std::vector<float> center;
   center.resize(3);
 
   // move to origin
-  bounding_box(cloud, b_box);
+  bounding_box(triangles, b_box);
   for (int i = 0; i < 3; i += 1){
     center[i] = (b_box[i] + b_box[i + 3]) / 2;
   }
@@ -184,168 +310,333 @@ int apply_transform(MeshPtr triangles, float x, float y, float z, float rx, floa
   Eigen::Affine3f T_0(Eigen::Translation3f(Eigen::Vector3f(-center[0] * sc_x, -center[1] * sc_y, -center[2] * sc_z)));
   Eigen::Affine3f R = create_rotation_matrix(rx, ry, rz);
   Eigen::Affine3f T_1(Eigen::Translation3f(Eigen::Vector3f(x, y, z)));
+  Eigen::Affine3f M = T_1 * R * T_0 * S;
 
-  pcl::transformPointCloud(*cloud, *cloud, (T_1 * R * T_0 * S).matrix());
-
-  toPCLPointCloud2(*cloud, triangles->cloud);
-  delete cloud;
-  return 0;
-}
+  float m[12];
+  for (int r = 0; r < 3; r += 1){
+    for (int c = 0; c < 4; c += 1){
+      m[r * 4 + c] = M(r, c);
+    }
+  }
 
-int find_intersect(pcl::PointXYZ &a, pcl::PointXYZ &b, float floor_v, pcl::PointXYZ &p){
-  // find the intersect between line a, b and plane z=floor_v
-  std::vector<float> v(3);  // vetor a->b
-  v[0] = b.x - a.x;
-  v[1] = b.y - a.y;
-  v[2] = b.z - a.z;
-
-  float t = (floor_v - a.z) / v[2];
-  p.x = a.x + t * v[0];
-  p.y = a.y + t * v[1];
-  p.z = a.z + t * v[2];
+  // the bounds come out of the same pass, so bounding_box() after this is free
+  transform_points(triangles->points.data(), triangles->point_count(), m, triangles->bbox);
+  triangles->bbox_valid = true;
   return 0;
 }
 
-
-int cut(MeshPtr input_mesh, MeshPtr out_mesh, float floor_v){
-  pcl::PointCloud<pcl::PointXYZ>* cloud = new pcl::PointCloud<pcl::PointXYZ>();
-  fromPCLPointCloud2(input_mesh->cloud, *cloud);
-
-  pcl::Vertices v;
-  v.vertices.resize(3);
-  pcl::Vertices on, under;
-  // consider serveral case
-
-  for (uint32_t i = 0; i < input_mesh->polygons.size(); i += 1){
-    // on.vertices.clear();
-    // under.vertices.clear();
-    pcl::Vertices on, under;
-    for (uint32_t j = 0; j < 3; j += 1){
-
-      if ((*cloud)[input_mesh->polygons[i].vertices[j]].z <= floor_v){
-        under.vertices.push_back(input_mesh->polygons[i].vertices[j]);
-      }
-      else{
-        on.vertices.push_back(input_mesh->polygons[i].vertices[j]);
+static void turned_box(MeshPtr triangles, float rz, float box[6]){
+  // bounds of the points turned rz about the z axis, the points are not changed
+  if(rz == 0){
+    std::vector<float> b_box;
+    bounding_box(triangles, b_box);
+    std::copy(b_box.begin(), b_box.end(), box);
+    return;
+  }
+  float c = cos(rz), s = sin(rz);
+  const float* points = triangles->points.data();
+  size_t n = triangles->point_count();
+  size_t workers = parallel_workers(n, POINTS_PER_WORKER);
+  std::vector<float> boxes(workers * 6);
+  parallel_for(n, workers, [&](size_t begin, size_t end, size_t w){
+    float* b = &boxes[w * 6];
+    empty_box(b);
+    for (size_t i = begin; i < end; i += 1){
+      const float* p = points + i * 3;
+      float v[3] = {c * p[0] - s * p[1], s * p[0] + c * p[1], p[2]};
+      for (int k = 0; k < 3; k += 1){
+        b[k] = std::min(b[k], v[k]);
+        b[k + 3] = std::max(b[k + 3], v[k]);
       }
     }
+  });
+  empty_box(box);
+  for (size_t w = 0; w < workers; w += 1){
+    merge_box(box, &boxes[w * 6]);
+  }
+}
 
-    if(on.vertices.size() == 3){
-      out_mesh->polygons.push_back(on);
+int bounding_box(const std::vector<MeshInstance> &instances, std::vector<float> &b_box){
+  // bounds of all instances without expanding them,
+  // instances with the same mesh and turn share one scan of the points
+  std::vector<float> turned(instances.size() * 6);
+  b_box.resize(6);
+  empty_box(&b_box[0]);
+  for (size_t i = 0; i < instances.size(); i += 1){
+    const MeshInstance &a = instances[i];
+    size_t j = 0;
+    while(j < i && !(instances[j].mesh == a.mesh && instances[j].rz == a.rz)){
+      j += 1;
     }
-    else if(under.vertices.size() == 3){
-      // do nothing
+    float* box = &turned[i * 6];
+    if(j < i){
+      memcpy(box, &turned[j * 6], sizeof(float) * 6);
     }
-    else if(under.vertices.size() == 2){
-      pcl::PointXYZ upper_p;
-      upper_p = (*cloud)[on.vertices[0]];
-      for (int j = 0; j < 2; j += 1){
-        pcl::PointXYZ lower_p, new_p;
-        lower_p = (*cloud)[under.vertices[j]];
-        find_intersect(upper_p, lower_p, floor_v, new_p);
-        cloud -> push_back(new_p);
-        on.vertices.push_back(cloud -> size() - 1);
-      }
-      out_mesh->polygons.push_back(on);
+    else{
+      turned_box(a.mesh, a.rz, box);
     }
-    else if(under.vertices.size() == 1){
-      pcl::PointXYZ mid;
-      mid.x = ((*cloud)[on.vertices[0]].x + (*cloud)[on.vertices[1]].x) / 2;
-      mid.y = ((*cloud)[on.vertices[0]].y + (*cloud)[on.vertices[1]].y) / 2;
-      mid.z = ((*cloud)[on.vertices[0]].z + (*cloud)[on.vertices[1]].z) / 2;
-      cloud -> push_back(mid);
-      int mid_index = cloud -> size() - 1;
-
-      pcl::PointXYZ intersect0, intersect1;
-      find_intersect((*cloud)[on.vertices[0]], (*cloud)[under.vertices[0]], floor_v, intersect0);
-      cloud -> push_back(intersect0);
-      int intersect0_index = cloud -> size() - 1;
-      find_intersect((*cloud)[on.vertices[1]], (*cloud)[under.vertices[0]], floor_v, intersect1);
-      cloud -> push_back(intersect1);
-      int intersect1_index = cloud -> size() - 1;
-
-      pcl::Vertices v1, v2, v3;
-      v1.vertices.push_back(on.vertices[0]);
-      v1.vertices.push_back(intersect0_index);
-      v1.vertices.push_back(mid_index);
-      out_mesh->polygons.push_back(v1);
-
-      v2.vertices.push_back(mid_index);
-      v2.vertices.push_back(intersect0_index);
-      v2.vertices.push_back(intersect1_index);
-      out_mesh->polygons.push_back(v2);
-
-      v3.vertices.push_back(mid_index);
-      v3.vertices.push_back(intersect1_index);
-      v3.vertices.push_back(on.vertices[1]);
-      out_mesh->polygons.push_back(v3);
-    }
-
+    float moved[6] = {box[0] + a.x, box[1] + a.y, box[2], box[3] + a.x, box[4] + a.y, box[5]};
+    merge_box(&b_box[0], moved);
   }
+  return 0;
+}
 
-  toPCLPointCloud2(*cloud, out_mesh->cloud);
-  delete cloud;
+void instance_matrix(const MeshInstance &instance, float m[12]){
+  // row major 3x4 affine matrix that takes the mesh to where the instance is
+  float c = cos(instance.rz), s = sin(instance.rz);
+  float r[12] = {c, -s, 0, instance.x,
+                 s, c, 0, instance.y,
+                 0, 0, 1, 0};
+  memcpy(m, r, sizeof(r));
+}
+
+int expand_instances(const std::vector<MeshInstance> &instances, MeshPtr out_mesh){
+  // out_mesh: geometry of every instance in order, as one mesh
+  // out_mesh should not be the mesh of an instance
+  size_t n = 0, m = 0;
+  for (size_t i = 0; i < instances.size(); i += 1){
+    n += instances[i].mesh->points.size();
+    m += instances[i].mesh->faces.size();
+  }
+  out_mesh->points.resize(n);
+  out_mesh->faces.resize(m);
+  empty_box(out_mesh->bbox);
+
+  size_t point_start = 0, face_start = 0;
+  for (size_t i = 0; i < instances.size(); i += 1){
+    const Mesh &mesh = *instances[i].mesh;
+    float* points = &out_mesh->points[point_start * 3];
+    std::copy(mesh.points.begin(), mesh.points.end(), points);
+    float mtx[12], box[6];
+    instance_matrix(instances[i], mtx);
+    transform_points(points, mesh.point_count(), mtx, box);
+    merge_box(out_mesh->bbox, box);
+
+    for (size_t k = 0; k < mesh.faces.size(); k += 1){
+      out_mesh->faces[face_start + k] = mesh.faces[k] + point_start;
+    }
+    point_start += mesh.point_count();
+    face_start += mesh.faces.size();
+  }
+  out_mesh->bbox_valid = true;
+  out_mesh->faces_changed();
   return 0;
 }
 
-int STL_to_List(MeshPtr triangles, std::vector<std::vector< std::vector<float> > > &data){
-  // point's data
-  // data =[
-  //           t1[p1[x, y, z], p2[x, y, z], p3[x, y, z]],
-  //           t2[p1[x, y, z], p2[x, y, z], p3[x, y, z]],
-  //           t3[p1[x, y, z], p2[x, y, z], p3[x, y, z]],
-  //             ...
-  //       ]
-  pcl::PointCloud<pcl::PointXYZ>* cloud = new pcl::PointCloud<pcl::PointXYZ>();
-  fromPCLPointCloud2(triangles->cloud, *cloud);
+void find_intersect(const float* a, const float* b, float floor_v, float* p){
+  // find the intersect between line a, b and plane z=floor_v
+  float t = (floor_v - a[2]) / (b[2] - a[2]);
+  p[0] = a[0] + t * (b[0] - a[0]);
+  p[1] = a[1] + t * (b[1] - a[1]);
+  p[2] = floor_v;  // exactly on the plane, not a + t * (b - a) with rounding error
+}
 
-  int v0, v1, v2;
+static uint64_t edge_key(uint32_t a, uint32_t b){
+  return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
 
-  std::vector<float> tmpvv(3, 0.0);
-  std::vector< std::vector<float> > tmpv(3, tmpvv);
-  data.resize(triangles->polygons.size());
+static int cut_face_count(const uint32_t* f, const uint8_t* above, const float* cloud, float floor_v){
+  // number of triangles left by cutting face f
+  int above_size = above[f[0]] + above[f[1]] + above[f[2]];
+  if(above_size == 2){
+    // the quad degenerates when the only under point is on the plane
+    for (int j = 0; j < 3; j += 1){
+      if(!above[f[j]] && cloud[f[j] * 3 + 2] == floor_v){
+        return 1;
+      }
+    }
+    return 2;
+  }
+  return above_size == 0 ? 0 : 1;
+}
 
-  for (size_t i = 0; i < triangles->polygons.size(); i += 1){
-    data[i] = tmpv;
+int cut(MeshPtr input_mesh, MeshPtr out_mesh, float floor_v){
+  // keep the part above z=floor_v
+  // an edge crossing the plane gets one intersection point shared by both
+  // faces on it, and a point lying on the plane is used as is, so the open
+  // boundary on the plane is a closed loop of shared points ready for a cap
+  // winding of every face is kept, unused points are dropped
+  const float* cloud = input_mesh->points.data();
+  const uint32_t* faces = input_mesh->faces.data();
+  size_t n = input_mesh->point_count(), m = input_mesh->face_count();
+
+  // classify points and give the ones above a new index
+  std::vector<uint8_t> above(n);
+  std::vector<uint32_t> new_index(n);
+  size_t p_workers = parallel_workers(n, POINTS_PER_WORKER);
+  std::vector<size_t> p_offset(p_workers + 1, 0);
+  parallel_for(n, p_workers, [&](size_t begin, size_t end, size_t w){
+    size_t count = 0;
+    for (size_t i = begin; i < end; i += 1){
+      above[i] = cloud[i * 3 + 2] > floor_v;
+      count += above[i];
+    }
+    p_offset[w + 1] = count;
+  });
+  for (size_t w = 0; w < p_workers; w += 1){
+    p_offset[w + 1] += p_offset[w];
+  }
+  parallel_for(n, p_workers, [&](size_t begin, size_t end, size_t w){
+    uint32_t index = p_offset[w];
+    for (size_t i = begin; i < end; i += 1){
+      new_index[i] = above[i] ? index++ : UINT32_MAX;
+    }
+  });
+
+  // count output faces of each block
+  size_t f_workers = parallel_workers(m, FACES_PER_WORKER);
+  std::vector<size_t> f_offset(f_workers + 1, 0);
+  parallel_for(m, f_workers, [&](size_t begin, size_t end, size_t w){
+    size_t count = 0;
+    for (size_t i = begin; i < end; i += 1){
+      count += cut_face_count(faces + i * 3, above.data(), cloud, floor_v);
+    }
+    f_offset[w + 1] = count;
+  });
+  for (size_t w = 0; w < f_workers; w += 1){
+    f_offset[w + 1] += f_offset[w];
+  }
 
-    v0 = triangles->polygons[i].vertices[0];
-    v1 = triangles->polygons[i].vertices[1];
-    v2 = triangles->polygons[i].vertices[2];
+  // crossing edges, serial so new points come in a fixed order
+  // only faces along the plane get here
+  std::unordered_map<uint64_t, uint32_t> edge_point;
+  std::vector<float> new_points;
+  uint32_t next_index = p_offset[p_workers];
+  for (size_t i = 0; i < m; i += 1){
+    const uint32_t* f = faces + i * 3;
+    if(above[f[0]] == above[f[1]] && above[f[1]] == above[f[2]]){
+      continue;
+    }
+    for (int j = 0; j < 3; j += 1){
+      uint32_t a = f[j], u = f[(j + 1) % 3];
+      if(above[a] == above[u]){
+        continue;
+      }
+      if(!above[a]){
+        std::swap(a, u);
+      }
+      uint64_t key = edge_key(a, u);
+      if(edge_point.count(key)){
+        continue;
+      }
+      if(cloud[u * 3 + 2] == floor_v){
+        if(new_index[u] == UINT32_MAX){
+          new_index[u] = next_index++;
+          new_points.insert(new_points.end(), cloud + u * 3, cloud + u * 3 + 3);
+        }
+        edge_point[key] = new_index[u];
+      }
+      else{
+        float p[3];
+        // always from the point above, the same edge gives the same point
+        find_intersect(cloud + a * 3, cloud + u * 3, floor_v, p);
+        edge_point[key] = next_index++;
+        new_points.insert(new_points.end(), p, p + 3);
+      }
+    }
+  }
 
-    data[i][0][0] = (*cloud)[v0].x;
-    data[i][0][1] = (*cloud)[v0].y;
-    data[i][0][2] = (*cloud)[v0].z;
+  std::vector<float> &out_cloud = out_mesh->points;
+  std::vector<uint32_t> &out_faces = out_mesh->faces;
+  out_cloud.resize((size_t)next_index * 3);
+  out_faces.resize(f_offset[f_workers] * 3);
+  parallel_for(n, p_workers, [&](size_t begin, size_t end, size_t w){
+    for (size_t i = begin; i < end; i += 1){
+      if(above[i]){
+        memcpy(&out_cloud[(size_t)new_index[i] * 3], cloud + i * 3, sizeof(float) * 3);
+      }
+    }
+  });
+  std::copy(new_points.begin(), new_points.end(), out_cloud.begin() + p_offset[p_workers] * 3);
+
+  // faces keep their input order, edge_point is only read from here
+  parallel_for(m, f_workers, [&](size_t begin, size_t end, size_t w){
+    uint32_t* out = out_faces.data() + f_offset[w] * 3;
+    for (size_t i = begin; i < end; i += 1){
+      const uint32_t* f = faces + i * 3;
+      int above_size = above[f[0]] + above[f[1]] + above[f[2]];
+      if(above_size == 0){
+        continue;
+      }
+      if(above_size == 3){
+        out[0] = new_index[f[0]];
+        out[1] = new_index[f[1]];
+        out[2] = new_index[f[2]];
+        out += 3;
+        continue;
+      }
 
-    data[i][1][0] = (*cloud)[v1].x;
-    data[i][1][1] = (*cloud)[v1].y;
-    data[i][1][2] = (*cloud)[v1].z;
+      // rotate (v0, v1, v2) so the single point above or under comes first
+      int r = 0;
+      while(above[f[r]] != (above_size == 1)){
+        r += 1;
+      }
+      uint32_t v0 = f[r], v1 = f[(r + 1) % 3], v2 = f[(r + 2) % 3];
+      uint32_t i1 = edge_point.find(edge_key(v0, v1))->second;
+      uint32_t i2 = edge_point.find(edge_key(v0, v2))->second;
+      if(above_size == 1){
+        // v0 above
+        out[0] = new_index[v0];
+        out[1] = i1;
+        out[2] = i2;
+        out += 3;
+      }
+      else{
+        // v0 under, quad (i1, v1, v2, i2)
+        out[0] = i1;
+        out[1] = new_index[v1];
+        out[2] = new_index[v2];
+        out += 3;
+        if(i1 != i2){
+          out[0] = i1;
+          out[1] = new_index[v2];
+          out[2] = i2;
+          out += 3;
+        }
+      }
+    }
+  });
+  out_mesh->points_changed();
+  out_mesh->faces_changed();
+  return 0;
+}
 
-    data[i][2][0] = (*cloud)[v2].x;
-    data[i][2][1] = (*cloud)[v2].y;
-    data[i][2][2] = (*cloud)[v2].z;
-      // std::cout << "  polygons[" << i << "]: " <<std::endl;
-  }
-  delete cloud;
+int export_triangles(MeshPtr triangles, float* data){
+  // data: face_count * 9 floats, x, y, z of the 3 points of each face
+  size_t m = triangles->face_count();
+  parallel_for(m, parallel_workers(m, FACES_PER_WORKER), [&](size_t begin, size_t end, size_t w){
+    for (size_t i = begin; i < end; i += 1){
+      for (int j = 0; j < 3; j += 1){
+        memcpy(data + i * 9 + j * 3, triangles->face_point(i, j), sizeof(float) * 3);
+      }
+    }
+  });
   return 0;
 }
 
-// int STL_to_Faces(MeshPtr triangles, std::vector< std::vector<int> > &data){
-//   // index of faces
-//   // data = [ f1[p1_index, p2_index, p3_index],
-//   //          f2[p1_index, p2_index, p3_index], ...
-//   //        ]
-//   data.resize(triangles->polygons.size());
-//   for (size_t i = 0; i < triangles->polygons.size(); i += 1){
-//     data[i].resize(3);
-//     data[i][0] = triangles->polygons[i].vertices[0];
-//     data[i][1] = triangles->polygons[i].vertices[1];
-//     data[i][2] = triangles->polygons[i].vertices[2];
-//   }
-//   return 0;
-// }
+int export_points(MeshPtr triangles, float* data){
+  // data: point_count * 3 floats
+  memcpy(data, triangles->points.data(), triangles->points.size() * sizeof(float));
+  return 0;
+}
+
+int export_faces(MeshPtr triangles, int* data){
+  // data: face_count * 3 vertex indices
+  memcpy(data, triangles->faces.data(), triangles->faces.size() * sizeof(uint32_t));
+  return 0;
+}
 
 int mesh_len(MeshPtr triangles){
-  return triangles->polygons.size();
+  return triangles->face_count();
+}
+
+int mesh_point_count(MeshPtr triangles){
+  return triangles->point_count();
+}
+
+int copy_mesh(MeshPtr src, MeshPtr dst){
+  *dst = *src;
+  return 0;
 }
 
 
@@ -365,48 +656,3 @@ void xnormalize(float *v){
         v[2] /= l;
     }
 }
-
-int write_stl_binary(MeshPtr triangles, const char* filename) {
-    int v0, v1, v2, face_count = triangles->polygons.size();
-    short padding = 0;
-
-    FILE* ptr_stl = fopen(filename, "wb");
-
-    fprintf(stderr, "Writing STL Binary %s\n", filename);
-    fprintf(ptr_stl, "%-80s", "FLUX 3d printer: flux3dp.com, 2015");
-
-    pcl::PointCloud<pcl::PointXYZ>* cloud = new pcl::PointCloud<pcl::PointXYZ>();
-    fromPCLPointCloud2(triangles->cloud, *cloud);
-
-    fwrite(&face_count, sizeof(int), 1, ptr_stl);
-    fprintf(stderr, "Triangle Faces %d\n", face_count);
-
-    for (int i = 0; i < face_count; i += 1){
-
-      v0 = triangles->polygons[i].vertices[0];
-      v1 = triangles->polygons[i].vertices[1];
-      v2 = triangles->polygons[i].vertices[2];
-
-      float n[3];
-      // output normal
-
-      float vecs[3][3] = {
-        {(*cloud)[v0].x, (*cloud)[v0].y, (*cloud)[v0].z},
-        {(*cloud)[v1].x, (*cloud)[v1].y, (*cloud)[v1].z},
-        {(*cloud)[v2].x, (*cloud)[v2].y, (*cloud)[v2].z}
-      };
-
-      xnormal(vecs, n);
-      xnormalize(n);
-      fwrite(n, sizeof(float), 3, ptr_stl);
-
-      fwrite(vecs[0], sizeof(float), 3, ptr_stl);
-      fwrite(vecs[1], sizeof(float), 3, ptr_stl);
-      fwrite(vecs[2], sizeof(float), 3, ptr_stl);
-
-      fwrite(&padding, sizeof(short), 1, ptr_stl);
-    }
-
-    delete cloud;
-    fclose(ptr_stl);
-}
\ No newline at end of file
@@ -1,29 +1,82 @@
+#ifndef PRINTER_MODULE_H
+#define PRINTER_MODULE_H
+
 #include <stdio.h>
+#include <stdint.h>
 #include <math.h>
 #include <vector>
+#include <memory>
 
 #include <pcl/point_types.h>
 #include <pcl/PolygonMesh.h>
 #include <pcl/common/transforms.h>
 #include <pcl/conversions.h>
 
-typedef pcl::PolygonMesh::Ptr MeshPtr;
+struct MeshTopology;
+
+struct Mesh{
+  // triangle mesh stored as flat typed arrays, the primary storage of MeshObj
+  // points: x, y, z of each vertex
+  // faces: 3 vertex indices of each triangle
+  // use to_polygon_mesh() when a pcl algorithm needs pcl::PolygonMesh
+  std::vector<float> points;
+  std::vector<uint32_t> faces;
+  // cached bounding box of points: min x, y, z, max x, y, z
+  // call points_changed() after writing points directly
+  float bbox[6];
+  bool bbox_valid;
+  // cached adjacency of faces, see mesh_topology.h
+  // call faces_changed() after writing faces directly
+  std::shared_ptr<const MeshTopology> topology;
+
+  Mesh() : bbox_valid(false){}
+  void points_changed(){ bbox_valid = false; }
+  void faces_changed(){ topology.reset(); }
+
+  size_t point_count() const{ return points.size() / 3; }
+  size_t face_count() const{ return faces.size() / 3; }
+  float* point(size_t i){ return &points[i * 3]; }
+  const float* point(size_t i) const{ return &points[i * 3]; }
+  const float* face_point(size_t f, int j) const{ return &points[faces[f * 3 + j] * 3]; }
+};
+
+typedef std::shared_ptr<Mesh> MeshPtr;
 MeshPtr createMeshPtr();
 
+struct MeshInstance{
+  // a copy of mesh turned rz about the z axis, then moved by x, y
+  // the geometry is shared with every other instance of the same mesh
+  MeshPtr mesh;
+  float x, y, rz;
+};
+pcl::PolygonMesh::Ptr to_polygon_mesh(MeshPtr triangles);
+int from_polygon_mesh(const pcl::PolygonMesh &polygon_mesh, MeshPtr triangles);
+
 typedef pcl::PointCloud<pcl::PointXYZ>::Ptr CloudPtr;
 CloudPtr createCloudPtr(std::vector< std::vector<float> > points);
+CloudPtr createCloudPtrFromArray(const float* points, size_t n);
 
 int setCloud(MeshPtr triangles, CloudPtr cloud);
 int setPoints(MeshPtr triangles, std::vector< std::vector<float> > points);
+int setPointsFromArray(MeshPtr triangles, const float* points, size_t n);
 int push_backFace(MeshPtr triangles, int v0, int v1, int v2);
+int setFaces(MeshPtr triangles, const int* faces, size_t m, size_t point_count);
 int add_on(MeshPtr base, MeshPtr new_mesh);
-int STL_to_List(MeshPtr triangles, std::vector<std::vector< std::vector<float> > > &data);
+int export_triangles(MeshPtr triangles, float* data);
+int export_points(MeshPtr triangles, float* data);
+int export_faces(MeshPtr triangles, int* data);
 int apply_transform(MeshPtr triangles, float x, float y, float z, float rx, float ry, float rz, float sc_x, float sc_y, float sc_z);
 int bounding_box(MeshPtr triangles, std::vector<float> &b_box);
-int bounding_box(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, std::vector<float> &b_box);
+int bounding_box(const float* points, size_t n, std::vector<float> &b_box);
+int bounding_box(const std::vector<MeshInstance> &instances, std::vector<float> &b_box);
+void instance_matrix(const MeshInstance &instance, float m[12]);
+int expand_instances(const std::vector<MeshInstance> &instances, MeshPtr out_mesh);
 int cut(MeshPtr input_mesh, MeshPtr out_mesh, float floor_v);
 int mesh_len(MeshPtr triangles);
+int mesh_point_count(MeshPtr triangles);
+int copy_mesh(MeshPtr src, MeshPtr dst);
 
-void xnormal(std::vector< std::vector<float> > &v, float* result);
+void xnormal(float v[3][3], float* result);
 void xnormalize(float *v);
-int write_stl_binary(MeshPtr triangles, const char* filename);
+
+#endif
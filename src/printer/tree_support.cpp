@@ -1,7 +1,8 @@
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
 #include "tree_support.h"
-#include <pcl/filters/voxel_grid.h>
-//fake
-#include <pcl/io/pcd_io.h>
+#include "parallel.h"
 // ref: http://hpcg.purdue.edu/bbenes/papers/Vanek14SGP.pdf
 
 float d_v3(Eigen::Vector3f &a, Eigen::Vector3f &b){
@@ -36,18 +37,8 @@ struct cone{
   }
 };
 
-struct tri_data{
-  // store data for each triangle in stl
-  // ok:whether it's a valid triangle
-  // tri_after: where the triangle at after transform to xy-plane
-  // tri_trans: the transform matrix
-  // L: key =
-  bool ok;
-  Eigen::Matrix3f tri_after;
-  Eigen::Affine3f tri_trans;
-  std::map<int, Eigen::Vector3f> L;
-  std::map<int, bool> in_tri;
-};
+// vertices of edge 12, 13 and 23
+static const int tri_edge[3][2] = {{0, 1}, {0, 2}, {1, 2}};
 
 struct tree_node{
   // a tree node structure that consist its children's index
@@ -78,7 +69,7 @@ class SupportTree{
 public:
   SupportTree(pcl::PointCloud<pcl::PointXYZ>::Ptr P);
   ~SupportTree();
-  void out_as_js();
+  void out_as_js(std::ostream &out);
 
   pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;
   std::vector<tree_node> tree;
@@ -91,32 +82,32 @@ SupportTree::SupportTree(pcl::PointCloud<pcl::PointXYZ>::Ptr P){
 SupportTree::~SupportTree(){
 }
 
-void SupportTree::out_as_js(){
-  // output a tree as a json list
-  std::cout<< "tree = [";
+void SupportTree::out_as_js(std::ostream &out){
+  // output a tree as a json list, for debugging
+  out<< "tree = [";
   for (size_t i = 0; i < tree.size(); i += 1){
     if(tree[i].left != -1){
-      std::cout<< "[";
+      out<< "[";
 
-      std::cout << "[" << (*cloud)[tree[i].index].x << "," << (*cloud)[tree[i].index].y << "," << (*cloud)[tree[i].index].z << "]";
-      std::cout<< ",";
+      out << "[" << (*cloud)[tree[i].index].x << "," << (*cloud)[tree[i].index].y << "," << (*cloud)[tree[i].index].z << "]";
+      out<< ",";
 
       if(tree[i].left >= 0){
-        std::cout << "[" << (*cloud)[tree[i].left].x << "," << (*cloud)[tree[i].left].y << "," << (*cloud)[tree[i].left].z << "]";
-        std::cout<< ",";
+        out << "[" << (*cloud)[tree[i].left].x << "," << (*cloud)[tree[i].left].y << "," << (*cloud)[tree[i].left].z << "]";
+        out<< ",";
       }
       else{
       }
-      std::cout << "[" << (*cloud)[tree[i].right].x << "," << (*cloud)[tree[i].right].y << "," << (*cloud)[tree[i].right].z << "]";
-      std::cout<< ",";
+      out << "[" << (*cloud)[tree[i].right].x << "," << (*cloud)[tree[i].right].y << "," << (*cloud)[tree[i].right].z << "]";
+      out<< ",";
 
-      std::cout<< tree[i].height;
+      out<< tree[i].height;
 
-      std::cout<< "],";
-      // std::cout<< std::endl;
+      out<< "],";
+      // out<< std::endl;
     }
   }
-  std::cout<< "]";
+  out<< "]";
   return;
 }
 
@@ -131,14 +122,6 @@ bool sort_by_z(const pcl::PointXYZ a,const pcl::PointXYZ b)
 {
    return a.z < b.z;
 }
-bool sort_by_second(const std::pair<int, float> a, const std::pair<int, float> b){
-  if(a.second != b.second){
-    return a.second < b.second;
-  }
-  else{
-    return a.first < b.first;
-  }
-}
 
 Eigen::Vector3f sol_2(float x1, float y1, float x2, float y2){
   // solve the equation pass through (x1, y1), (x2, y2)
@@ -163,397 +146,710 @@ bool check_valid_tri(float a, float b, float c){
   }
 }
 
-int add_support(MeshPtr input_mesh, MeshPtr out_mesh, float alpha){
-  // Eigen::Matrix3f tmp;
-  // tmp.setZero();
-  // Eigen::Vector3f start(1,2,3);
-  // tmp.block<3, 1>(0, 0) = start;
-  // std::cerr<< "tmp " << tmp << std::endl;
-  // return 0;
-  ////////////////// TODO: read paper to find out what's this /////////////////
-  double m_threshold = std::numeric_limits<double>::infinity();
-  //////////////////////////////////////////////////////
+class ConeGrid{
+  // uniform xy grid over the vertices of cones waiting for support,
+  // cells on the border reach to infinity so every point has a cell
+  // z_max: highest point ever put in a cell, an upper bound after erase
+public:
+  ConeGrid(pcl::PointCloud<pcl::PointXYZ>::Ptr P, float alpha);
+  void insert(int i);
+  void erase(int i);
+  // cone of P with the smallest cone_intersect distance from a, a has to be the highest
+  // ties go to the lower one, then to the smaller index
+  // only distance <= limit counts, limit and c are updated when found
+  // return index of P, -1 for none
+  int nearest(const cone &a, float &limit, cone &c);
+
+private:
+  size_t cell_of(float x, float y, int &cx, int &cy);
+  float box_distance(int cx, int cy, float x, float y);
 
-  pcl::PointCloud<pcl::PointXYZ>::Ptr P(new pcl::PointCloud<pcl::PointXYZ>);  // recording every point's xyz data
-  find_support_point(input_mesh, alpha, 1, P);
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;
+  float alpha, inv_sin2, inv_cos2;  // 1 / (2 sin(alpha)), 1 / (2 cos(alpha))
+  float lo[2], size;
+  int nx, ny;
+  std::vector<std::vector<int> > cells;
+  std::vector<float> z_max;
+};
 
-  std::vector<tri_data> preprocess_tri;
-  preprocess(input_mesh, preprocess_tri);
+ConeGrid::ConeGrid(pcl::PointCloud<pcl::PointXYZ>::Ptr P, float alpha){
+  cloud = P;
+  this -> alpha = alpha;
+  inv_sin2 = 1 / (2 * sin(alpha));
+  inv_cos2 = 1 / (2 * cos(alpha));
 
-  std::cerr<< "P size need to be supported:"<< P->size() << std::endl;
-  SupportTree support_tree(P);
+  float hi[2];
+  lo[0] = lo[1] = INFINITY;
+  hi[0] = hi[1] = -INFINITY;
+  for (size_t i = 0; i < P -> points.size(); i += 1){
+    lo[0] = std::min(lo[0], P -> points[i].x);
+    lo[1] = std::min(lo[1], P -> points[i].y);
+    hi[0] = std::max(hi[0], P -> points[i].x);
+    hi[1] = std::max(hi[1], P -> points[i].y);
+  }
+  size_t n = std::max(P -> points.size(), (size_t)1);
+  float w = std::max(hi[0] - lo[0], 0.0f), h = std::max(hi[1] - lo[1], 0.0f);
+  size = std::max(sqrt(w * h * CONE_GRID_POINTS / n), std::max(w, h) * CONE_GRID_POINTS / n);
+  if(!(size > 0)){
+    lo[0] = lo[1] = 0;
+    size = 1;
+  }
+  nx = std::min(w / size, (float)n) + 1;
+  ny = std::min(h / size, (float)n) + 1;
+  cells.resize(nx * ny);
+  z_max.assign(nx * ny, -INFINITY);
+  for (size_t i = 0; i < P -> points.size(); i += 1){
+    insert(i);
+  }
+}
 
-  sort(P -> points.begin(), P -> points.end(), sort_by_z);
-  std::map<int, cone> C;  // recording every cone, key = index of P
+size_t ConeGrid::cell_of(float x, float y, int &cx, int &cy){
+  cx = std::max(0.0f, std::min((x - lo[0]) / size, nx - 1.0f));
+  cy = std::max(0.0f, std::min((y - lo[1]) / size, ny - 1.0f));
+  return cy * nx + cx;
+}
 
-  std::vector< std::pair<int, float> > P_v;  // main index list, first = index of P, second = z-coordinate
-  for (size_t i = 0; i < P -> points.size(); i += 1){
-    C[i] = cone((float)P -> points[i].x, (float)P -> points[i].y, (float)P -> points[i].z, alpha);
-    P_v.push_back(std::pair<int, float>(i, P -> points[i].z));
+float ConeGrid::box_distance(int cx, int cy, float x, float y){
+  // xy distance from (x, y) to cell (cx, cy)
+  float dx = 0, dy = 0;
+  if(cx > 0){
+    dx = std::max(dx, lo[0] + cx * size - x);
+  }
+  if(cx < nx - 1){
+    dx = std::max(dx, x - (lo[0] + (cx + 1) * size));
   }
-  sort(P_v.begin(), P_v.end(), sort_by_second);
-  for (size_t i = 0; i < P_v.size(); i += 1){
-    support_tree.tree.push_back(tree_node(-1, -1, P_v[i].first, 1));
+  if(cy > 0){
+    dy = std::max(dy, lo[1] + cy * size - y);
   }
-  // std::cout<< "tree " << support_tree << std::endl;
+  if(cy < ny - 1){
+    dy = std::max(dy, y - (lo[1] + (cy + 1) * size));
+  }
+  return sqrt(dx * dx + dy * dy);
+}
 
-  std::vector<std::pair <int, float> > S;  // candidates for intersetino point, first:index of P_v,second: distance
+void ConeGrid::insert(int i){
+  int cx, cy;
+  size_t k = cell_of(cloud -> points[i].x, cloud -> points[i].y, cx, cy);
+  cells[k].push_back(i);
+  z_max[k] = std::max(z_max[k], cloud -> points[i].z);
+}
 
-  std::map<int, cone> tmp_C;  // cones, key = index of P_v
-  int current_point; // current index of P
-  while(P_v.size() != 0){
-    current_point = P_v.back().first;  // index of P
-    P_v.pop_back();  // erase highest p, can slightly skip some if statement
+void ConeGrid::erase(int i){
+  int cx, cy;
+  std::vector<int> &cell = cells[cell_of(cloud -> points[i].x, cloud -> points[i].y, cx, cy)];
+  std::vector<int>::iterator it = std::find(cell.begin(), cell.end(), i);
+  if(it != cell.end()){
+    *it = cell.back();
+    cell.pop_back();
+  }
+}
 
-    S.clear();
-    tmp_C.clear();
-    // cone-cone intersection
-    for (size_t i = 0; i < P_v.size(); i += 1){
-      cone tmp_cone;
-      S.push_back(std::pair<int, double>(i, cone_intersect(C[current_point], C[P_v[i].first], tmp_cone)));
-      tmp_C[i] = tmp_cone;
+int ConeGrid::nearest(const cone &a, float &limit, cone &c){
+  // cone_intersect distance is h / cos(alpha), where the cones meet h below a and
+  // h = (dxy / tan(alpha) + a.z - b.z) / 2, so a cell can be skipped by its xy distance
+  // and highest point, and a ring of cells by its xy distance
+  int best = -1;
+  float best_z = 0;
+  int cx, cy;
+  cell_of(a.pos[0], a.pos[1], cx, cy);
+  int r_max = std::max(std::max(cx, nx - 1 - cx), std::max(cy, ny - 1 - cy));
+  for (int r = 0; r <= r_max; r += 1){
+    if(std::max(r - 1, 0) * size * inv_sin2 > limit + CONE_BOX_MARGIN){
+      break;
     }
+    for (int y = std::max(cy - r, 0); y <= std::min(cy + r, ny - 1); y += 1){
+      // whole rows at the top and bottom of the ring, two cells on the others
+      int step = (y == cy - r || y == cy + r) ? 1 : 2 * r;
+      for (int x = cx - r; x <= cx + r; x += step){
+        if(x < 0 || x >= nx){
+          continue;
+        }
+        size_t k = y * nx + x;
+        if(cells[k].empty()){
+          continue;
+        }
+        float dz = a.pos[2] - std::min(z_max[k], a.pos[2]);
+        if(box_distance(x, y, a.pos[0], a.pos[1]) * inv_sin2 + dz * inv_cos2 > limit + CONE_BOX_MARGIN){
+          continue;
+        }
+        for (size_t j = 0; j < cells[k].size(); j += 1){
+          int i = cells[k][j];
+          const pcl::PointXYZ &p = cloud -> points[i];
+          cone tmp_cone;
+          float d = cone_intersect(a, cone(p.x, p.y, p.z, alpha), tmp_cone);
+          if(d < limit || (d == limit && (best < 0 || p.z < best_z || (p.z == best_z && i < best)))){
+            limit = d;
+            best = i;
+            best_z = p.z;
+            c = tmp_cone;
+          }
+        }
+      }
+    }
+  }
+  return best;
+}
 
-    // cone-plate intersection
-    S.push_back(std::pair<int, double>(-1, P -> points[current_point].z));
-
-    // cone-mesh intersection, use -2 to indicate it's connected to mesh
-    Eigen::Vector3f cm_point;
-    S.push_back(std::pair<int, double>(-2, cone_mesh_intersect(C[current_point], input_mesh, preprocess_tri, cm_point)));
+static bool find_move(const SupportCache &cache, const Mesh &mesh, float m[12]){
+  // whether mesh is the cached one turned about the z axis and moved,
+  // m gets the transform from the cached points to mesh, by rows
+  if(mesh.faces != cache.faces || mesh.points.size() != cache.points.size()){
+    return false;
+  }
+  size_t n = mesh.point_count();
+  double c0[3] = {0, 0, 0}, c1[3] = {0, 0, 0};
+  for (size_t i = 0; i < n; i += 1){
+    for (int k = 0; k < 3; k += 1){
+      c0[k] += cache.points[i * 3 + k];
+      c1[k] += mesh.points[i * 3 + k];
+    }
+  }
+  for (int k = 0; k < 3; k += 1){
+    c0[k] /= std::max(n, (size_t)1);
+    c1[k] /= std::max(n, (size_t)1);
+  }
 
-    // choose the right candidate
-    std::pair<int, float> m(S[0]);  // first: index of P_v, second: distance
-    for (size_t i = 0; i < S.size(); i += 1){
-      if(S[i].second < m.second){
-        m = S[i];
-      }
-      // std::cout<< "S:" << S[i].first << " " << S[i].second << std::endl;
+  // the point farthest from the z axis through the centroid gives the angle
+  size_t far = 0;
+  double far_d = 0;
+  for (size_t i = 0; i < n; i += 1){
+    double d = pow(cache.points[i * 3] - c0[0], 2) + pow(cache.points[i * 3 + 1] - c0[1], 2);
+    if(d > far_d){
+      far_d = d;
+      far = i;
     }
-    if(m.second > m_threshold){
-        // C.erase(current_point);
+  }
+  double theta = 0;
+  if(far_d > 0){
+    theta = atan2(mesh.points[far * 3 + 1] - c1[1], mesh.points[far * 3] - c1[0]) - atan2(cache.points[far * 3 + 1] - c0[1], cache.points[far * 3] - c0[0]);
+  }
+  double c = cos(theta), s = sin(theta);
+  double r[12] = {
+    c, -s, 0, c1[0] - (c * c0[0] - s * c0[1]),
+    s, c, 0, c1[1] - (s * c0[0] + c * c0[1]),
+    0, 0, 1, c1[2] - c0[2]
+  };
+  for (size_t i = 0; i < n; i += 1){
+    const float* p = &cache.points[i * 3];
+    for (int k = 0; k < 3; k += 1){
+      double v = r[k * 4] * p[0] + r[k * 4 + 1] * p[1] + r[k * 4 + 2] * p[2] + r[k * 4 + 3];
+      if(!(fabs(v - mesh.points[i * 3 + k]) <= SUPPORT_MOVE_TOLERANCE)){
+        return false;
+      }
     }
-    else{
-      if(m.first >= 0){  // cone-cone
-        // tmp_C[m.first]
-        // std::cout<< "m.first " << m.first << std::endl;
-        cone c(tmp_C[m.first]);
-        C[P->points.size()] = c;
+  }
+  for (int k = 0; k < 12; k += 1){
+    m[k] = r[k];
+  }
+  return true;
+}
 
-        P -> points.push_back(pcl::PointXYZ(c.pos[0], c.pos[1], c.pos[2]));
-        std::pair<int, double> new_pv(P->size() - 1, c.pos[2]);
+static void move_mesh(const Mesh &src, const float m[12], Mesh &dst){
+  // dst = src transformed by m, by rows
+  size_t n = src.point_count();
+  dst.points.resize(n * 3);
+  for (size_t i = 0; i < n; i += 1){
+    const float* p = src.point(i);
+    for (int k = 0; k < 3; k += 1){
+      dst.points[i * 3 + k] = m[k * 4] * p[0] + m[k * 4 + 1] * p[1] + m[k * 4 + 2] * p[2] + m[k * 4 + 3];
+    }
+  }
+  dst.faces = src.faces;
+  dst.points_changed();
+  dst.faces_changed();
+}
 
-        support_tree.tree.push_back(tree_node(current_point, P_v[m.first].first, new_pv.first, support_tree.tree[current_point].height + support_tree.tree[P_v[m.first].first].height));
-        P_v.erase(P_v.begin() + m.first);
+int add_support(MeshPtr input_mesh, MeshPtr out_mesh, float alpha, float sample_rate, SupportProgress* progress, SupportCache* cache){
+  if(!(alpha > 0 && alpha < M_PI / 2 && sample_rate > 0)){
+    return SUPPORT_BAD_PARAMETER;
+  }
+  SupportProgress no_progress;
+  if(progress == NULL){
+    progress = &no_progress;
+  }
+  // without a cache the work is kept in scratch, in the coordinates of input_mesh
+  bool keep = cache != NULL;
+  SupportCache scratch;
+  if(!keep){
+    cache = &scratch;
+  }
 
-        std::vector< std::pair<int, float> >::iterator low;
+  // m: from the cached model to input_mesh
+  // a turn about the z axis and a move keep the samples and the triangles, only the plate moves
+  float m[12] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0};
+  if(!(cache -> valid && cache -> alpha == alpha && cache -> sample_rate == sample_rate && find_move(*cache, *input_mesh, m))){
+    // progress: 0.2 after sampling, 0.3 after preprocess
+    cache -> valid = false;
+    cache -> samples -> clear();
+    int ret = find_support_point(input_mesh, alpha, sample_rate, cache -> samples, progress);
+    if(ret < 0){
+      return ret;
+    }
+    progress -> value = 0.2;
 
-        low = std::lower_bound (P_v.begin(), P_v.end(), new_pv, sort_by_second);
-        P_v.insert(low, new_pv);
-      }
-      else if(m.first == -1){ // plate-cone
-        // support_tree
-        P -> points.push_back(pcl::PointXYZ(P -> points[current_point].x, P -> points[current_point].y, 0));
-        support_tree.tree.push_back(tree_node(-3, current_point, P->size() - 1, support_tree.tree[current_point].height));
-      }
-      else if(m.first == -2){ // mesh-cone
-        //////////////////// TODO ////////////////////////////////////////
-        P -> points.push_back(pcl::PointXYZ(cm_point[0], cm_point[1], cm_point[2]));
-        // std::cerr<< "P " << P->points.back() << std::endl;
-        support_tree.tree.push_back(tree_node(-2, current_point, P->size() - 1, support_tree.tree[current_point].height));
-        ////////////////////////////////////////////////////////////
-      }
-      else{
-        std::cout<< "GG, this shouldn't  happen"<< std::endl;
-        assert(false);
+    preprocess(input_mesh, cache -> tri);
+    // only valid triangles go into the tree, built once for every cone
+    cache -> bvh.build(*input_mesh, &cache -> tri.ok);
+    if(progress -> cancel){
+      return SUPPORT_CANCELLED;
+    }
+    if(keep){
+      cache -> points = input_mesh -> points;
+      cache -> faces = input_mesh -> faces;
+      cache -> alpha = alpha;
+      cache -> sample_rate = sample_rate;
+      cache -> plate = NAN;
+      cache -> valid = true;
+    }
+  }
+  progress -> value = 0.3;
+
+  // the plate z = 0 is at z = -m[11] for the cached model
+  float plate = -m[11];
+  if(!keep){
+    int ret = grow_tree(*cache -> samples, cache -> bvh, cache -> tri, alpha, plate, progress, out_mesh);
+    if(ret < 0){
+      return ret;
+    }
+  }
+  else{
+    if(!(fabs(plate - cache -> plate) <= SUPPORT_MOVE_TOLERANCE)){
+      int ret = grow_tree(*cache -> samples, cache -> bvh, cache -> tri, alpha, plate, progress, cache -> strut);
+      if(ret < 0){
+        return ret;
       }
+      cache -> plate = plate;
     }
+    move_mesh(*cache -> strut, m, *out_mesh);
   }
-
-  // std::cout<< "tree " << support_tree << std::endl;
-  // std::cout<< "support_tree.cloud " << support_tree.cloud -> size() << std::endl;
-  genearte_strut(P, support_tree, out_mesh);
-  support_tree.out_as_js();
-  return 0;
+  progress -> value = 1;
+  return out_mesh -> face_count();
 }
 
-int preprocess(MeshPtr input_mesh, std::vector<tri_data> &preprocess_tri){
-  // ref:http://citeseerx.ist.psu.edu/viewdoc/download?doi=10.1.1.479.8237&rep=rep1&type=pdf
-  // preprocess the triangls, compute transform matrix that can transform them to xy-plane
-  // and some other data such as the eautations for 3 edge and line that pass through vertex and perpendicular to each edge
-  // 9 lines in total
-  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud (new pcl::PointCloud<pcl::PointXYZ>);
-  fromPCLPointCloud2(input_mesh->cloud, *cloud);
-  for (size_t i = 0; i < input_mesh -> polygons.size(); i += 1){
-  // for (size_t i = 825; i < 826; i += 1){
-    tri_data a;
-    Eigen::Matrix3f tri_before;
-    Eigen::Matrix3f tri_after;
-    tri_after.setZero();
-    for (size_t j = 0; j < 3; j += 1){
-      tri_before(0, j) = (*cloud)[(input_mesh->polygons[i]).vertices[j]].x;
-      tri_before(1, j) = (*cloud)[(input_mesh->polygons[i]).vertices[j]].y;
-      tri_before(2, j) = (*cloud)[(input_mesh->polygons[i]).vertices[j]].z;
-    }
-
-    float d12 = sqrt(pow(tri_before(0, 0) - tri_before(0, 1), 2) + pow(tri_before(1, 0) - tri_before(1, 1), 2) + pow(tri_before(2, 0) - tri_before(2, 1), 2));
-    float d13 = sqrt(pow(tri_before(0, 0) - tri_before(0, 2), 2) + pow(tri_before(1, 0) - tri_before(1, 2), 2) + pow(tri_before(2, 0) - tri_before(2, 2), 2));
-    float d23 = sqrt(pow(tri_before(0, 1) - tri_before(0, 2), 2) + pow(tri_before(1, 1) - tri_before(1, 2), 2) + pow(tri_before(2, 1) - tri_before(2, 2), 2));
-    a.ok = check_valid_tri(d12, d13, d23);
-    if(a.ok){
-      tri_after(2, 1) = d12;
-      tri_after(2, 2) = (pow(d13, 2) - pow(d23, 2) + pow(d12, 2)) / 2 / d12;
-      tri_after(1, 2) = sqrt(pow(d13, 2) - pow(tri_after(2, 2), 2));
-      a.tri_after = tri_after;
-
-      for (size_t i = 0; i < 3; i += 1){
-        for (size_t j = 0; j < 3; j += 1){
-          tri_after(i, j) -= tri_before(i, 0);
-        }
-      }
-      Eigen::Matrix4f tri_trans;
-      tri_trans.setIdentity();
-      tri_trans.block<3,3>(0,0) = tri_after * tri_before.inverse();
-      for (size_t j = 0; j < 3; j += 1){
-        tri_trans(j, 3) = tri_before(j, 0);
-      }
-      a.tri_trans = tri_trans;
-      tri_after = a.tri_after;
-      // std::cerr<< "tri_before " << tri_before << std::endl;
-      // std::cerr<< "a " << a.tri_trans * tri_before << std::endl;
-      // std::cerr<< "tri_after " << tri_after << std::endl;
+int grow_tree(const pcl::PointCloud<pcl::PointXYZ> &samples, const TriangleBvh &bvh, const tri_data &preprocess_tri, float alpha, float plate, SupportProgress* progress, MeshPtr strut_stl){
+  // grow the support tree from the samples above the plate at z = plate down to the plate or the mesh,
+  // strut_stl gets the struts
+  // progress goes from 0.3 to 0.9
+  ////////////////// TODO: read paper to find out what's this /////////////////
+  double m_threshold = std::numeric_limits<double>::infinity();
+  //////////////////////////////////////////////////////
 
-      float tmp;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr P(new pcl::PointCloud<pcl::PointXYZ>);  // recording every point's xyz data
+  for (size_t i = 0; i < samples.size(); i += 1){
+    if(samples.points[i].z > plate){
+      P -> push_back(samples.points[i]);
+    }
+  }
+  SupportTree support_tree(P);
 
-      a.L[13] = sol_2(tri_after(1, 0), tri_after(2, 0), tri_after(1, 2), tri_after(2, 2));
-      // std::cerr<< "a[13] " << a.L[13] << std::endl;
-      a.in_tri[13] = sub_in(tri_after(1, 1), tri_after(2, 1), a.L[13]) >= 0;
-      // std::cerr<< "t " << sub_in(tri_after(1, 1), tri_after(2, 1), a.L[13]) << std::endl;
-      // std::cerr<< "in 13 " << a.in_tri[13] << std::endl;
+  sort(P -> points.begin(), P -> points.end(), sort_by_z);
+  // every cone has its vertex at a point of P and angle alpha, so P is the cone storage
+  // queue: cones waiting for support, highest first, ties on the larger index
+  // merged cones are left in the queue and skipped by waiting[]
+  std::priority_queue<std::pair<float, int> > queue;
+  std::vector<uint8_t> waiting(P -> points.size(), 1);
+  for (size_t i = 0; i < P -> points.size(); i += 1){
+    support_tree.tree.push_back(tree_node(-1, -1, i, 1));
+    queue.push(std::pair<float, int>(P -> points[i].z, i));
+  }
+  ConeGrid grid(P, alpha);
 
-      tmp = -sub_in(tri_after(1, 0), tri_after(2, 0) , Eigen::Vector3f(a.L[13](1), -a.L[13](0), 0));
-      a.L[111] = Eigen::Vector3f(a.L[13](1), -a.L[13](0), tmp);
-      a.in_tri[111] = sub_in(tri_after(1, 2), tri_after(2, 2), a.L[111]) >= 0;
+  // every step settles one waiting cone, so there are as many steps as sampled points
+  size_t steps = 0, total_steps = waiting.size();
+  int current_point; // current index of P
+  while(!queue.empty()){
+    if(progress -> cancel){
+      return SUPPORT_CANCELLED;
+    }
+    current_point = queue.top().second;
+    queue.pop();
+    if(!waiting[current_point]){
+      continue;
+    }
+    waiting[current_point] = 0;
+    grid.erase(current_point);
+    steps += 1;
+    if(steps % 1024 == 0){
+      progress -> value = 0.3 + 0.6 * steps / total_steps;
+    }
+    cone current_cone(P -> points[current_point].x, P -> points[current_point].y, P -> points[current_point].z, alpha);
 
-      tmp = -sub_in(tri_after(1, 2), tri_after(2, 2) , Eigen::Vector3f(a.L[13](1), -a.L[13](0), 0));
-      a.L[331] = Eigen::Vector3f(a.L[13](1), -a.L[13](0), tmp);
-      a.in_tri[331] = sub_in(tri_after(1, 0), tri_after(2, 0), a.L[331]) >= 0;
+    // cone-plate intersection
+    float plate_d = P -> points[current_point].z - plate;
 
+    // cone-mesh intersection
+    Eigen::Vector3f cm_point;
+    float mesh_d = cone_mesh_intersect(current_cone, bvh, preprocess_tri, cm_point);
 
-      a.L[23] = sol_2(tri_after(1, 1), tri_after(2, 1), tri_after(1, 2), tri_after(2, 2));
-      // std::cerr<< "a[23] " << a.L[23] << std::endl;
-      a.in_tri[23] = sub_in(tri_after(1, 0), tri_after(2, 0), a.L[23]) >= 0;
+    // cone-cone intersection, only the cones that can beat plate and mesh are tried,
+    // a cone wins a tie, then plate wins over mesh
+    float m = std::min(plate_d, mesh_d);
+    cone c;
+    int other = grid.nearest(current_cone, m, c);  // index of P, -1 for none
 
-      tmp = -sub_in(tri_after(1, 1), tri_after(2, 1) , Eigen::Vector3f(a.L[23](1), -a.L[23](0), 0));
-      a.L[223] = Eigen::Vector3f(a.L[23](1), -a.L[23](0), tmp);
-      a.in_tri[223] = sub_in(tri_after(1, 2), tri_after(2, 2), a.L[223]) >= 0;
+    if(m > m_threshold){
+    }
+    else if(other >= 0){  // cone-cone
+      P -> points.push_back(pcl::PointXYZ(c.pos[0], c.pos[1], c.pos[2]));
+      int new_point = P -> size() - 1;
+      support_tree.tree.push_back(tree_node(current_point, other, new_point, support_tree.tree[current_point].height + support_tree.tree[other].height));
+
+      waiting[other] = 0;
+      grid.erase(other);
+      waiting.resize(P -> size(), 0);
+      waiting[new_point] = 1;
+      grid.insert(new_point);
+      queue.push(std::pair<float, int>(c.pos[2], new_point));
+    }
+    else if(plate_d <= mesh_d){ // plate-cone
+      P -> points.push_back(pcl::PointXYZ(P -> points[current_point].x, P -> points[current_point].y, plate));
+      support_tree.tree.push_back(tree_node(-3, current_point, P->size() - 1, support_tree.tree[current_point].height));
+    }
+    else{ // mesh-cone
+      P -> points.push_back(pcl::PointXYZ(cm_point[0], cm_point[1], cm_point[2]));
+      support_tree.tree.push_back(tree_node(-2, current_point, P->size() - 1, support_tree.tree[current_point].height));
+    }
+  }
 
-      tmp = -sub_in(tri_after(1, 2), tri_after(2, 2) , Eigen::Vector3f(a.L[23](1), -a.L[23](0), 0));
-      a.L[332] = Eigen::Vector3f(a.L[23](1), -a.L[23](0), tmp);
-      a.in_tri[332] = sub_in(tri_after(1, 1), tri_after(2, 1), a.L[332]) >= 0;
+  progress -> value = 0.9;
 
+  genearte_strut(P, support_tree, strut_stl);
+  return 0;
+}
 
-      a.L[12] = sol_2(tri_after(1, 0), tri_after(2, 0), tri_after(1, 1), tri_after(2, 1));
-      // std::cerr<< "a[12] " << a.L[12] << std::endl;
-      a.in_tri[12] = sub_in(tri_after(1, 2), tri_after(2, 2), a.L[12]) >= 0;
+int preprocess(MeshPtr input_mesh, tri_data &preprocess_tri){
+  // ref:http://citeseerx.ist.psu.edu/viewdoc/download?doi=10.1.1.479.8237&rep=rep1&type=pdf
+  // preprocess the triangles, compute the rigid transform that moves each of them onto the yz-plane
+  // and the equations of its 3 edges there
+  size_t n = input_mesh -> face_count();
+  tri_data &t = preprocess_tri;
+  t.ok.assign(n, 0);
+  t.rot.resize(n * 9);
+  t.origin.resize(n * 3);
+  t.after.resize(n * 6);
+  t.line.resize(n * 9);
+  t.inside.assign(n, 0);
+
+  parallel_for(n, parallel_workers(n, FACES_PER_WORKER), [&](size_t begin, size_t end, size_t w){
+    for (size_t i = begin; i < end; i += 1){
+      Eigen::Vector3f v[3];
+      for (int j = 0; j < 3; j += 1){
+        const float* p = input_mesh -> face_point(i, j);
+        v[j] = Eigen::Vector3f(p[0], p[1], p[2]);
+      }
+      float d12 = (v[1] - v[0]).norm();
+      float d13 = (v[2] - v[0]).norm();
+      float d23 = (v[2] - v[1]).norm();
+      t.ok[i] = check_valid_tri(d12, d13, d23);
+      if(!t.ok[i]){
+        continue;
+      }
 
-      tmp = -sub_in(tri_after(1, 0), tri_after(2, 0) , Eigen::Vector3f(a.L[12](1), -a.L[12](0), 0));
-      a.L[112] = Eigen::Vector3f(a.L[12](1), -a.L[12](0), tmp);
-      a.in_tri[112] = sub_in(tri_after(1, 1), tri_after(2, 1), a.L[112]) >= 0;
+      float* after = &t.after[i * 6];
+      after[0] = 0;
+      after[1] = 0;
+      after[2] = 0;
+      after[3] = d12;
+      after[5] = (d13 * d13 - d23 * d23 + d12 * d12) / 2 / d12;
+      after[4] = sqrt(std::max(d13 * d13 - after[5] * after[5], 0.0f));
+
+      // rows e_x, e_y, e_z of the frame, e_z along edge 12 and v2 on the yz-plane
+      Eigen::Vector3f e_z = (v[1] - v[0]).normalized();
+      Eigen::Vector3f e_2 = v[2] - v[0];
+      Eigen::Vector3f e_y = (e_2 - e_2.dot(e_z) * e_z).normalized();
+      Eigen::Vector3f e_x = e_y.cross(e_z);
+      for (int k = 0; k < 3; k += 1){
+        t.rot[i * 9 + k] = e_x[k];
+        t.rot[i * 9 + 3 + k] = e_y[k];
+        t.rot[i * 9 + 6 + k] = e_z[k];
+        t.origin[i * 3 + k] = v[0][k];
+      }
 
-      tmp = -sub_in(tri_after(1, 1), tri_after(2, 1) , Eigen::Vector3f(a.L[12](1), -a.L[12](0), 0));
-      a.L[221] = Eigen::Vector3f(a.L[12](1), -a.L[12](0), tmp);
-      a.in_tri[221] = sub_in(tri_after(1, 0), tri_after(2, 0), a.L[221]) >= 0;
+      for (int j = 0; j < 3; j += 1){
+        const float* p0 = after + tri_edge[j][0] * 2;
+        const float* p1 = after + tri_edge[j][1] * 2;
+        const float* opposite = after + (3 - tri_edge[j][0] - tri_edge[j][1]) * 2;
+        Eigen::Vector3f l = sol_2(p0[0], p0[1], p1[0], p1[1]);
+        t.line[i * 9 + j * 3] = l[0];
+        t.line[i * 9 + j * 3 + 1] = l[1];
+        t.line[i * 9 + j * 3 + 2] = l[2];
+        if(sub_in(opposite[0], opposite[1], l) >= 0){
+          t.inside[i] |= 1 << j;
+        }
+      }
     }
-    preprocess_tri.push_back(a);
-  }
+  });
   return 0;
 }
 
-int find_support_point(MeshPtr triangles, float alpha, float sample_rate, pcl::PointCloud<pcl::PointXYZ>::Ptr P){
+struct VoxelSum{
+  // support points sampled in one voxel from a block of faces
+  uint64_t key;
+  double sum[3];
+  uint32_t count;
+};
+
+static bool sort_by_key(const VoxelSum &a, const VoxelSum &b){
+  return a.key < b.key;
+}
+
+int find_support_point(MeshPtr triangles, float alpha, float sample_rate, pcl::PointCloud<pcl::PointXYZ>::Ptr P, SupportProgress* progress){
   // ref: http://hpcg.purdue.edu/bbenes/papers/Vanek14SGP.pdf
   // MeshPtr triangles[in]: input stl
   // float alpha[in]: angle that >= alpha need to be supported
   // float sample_rate[in]: sample reate (grid)
-  // P[out]: out put the points that need to be supported
-
-  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud (new pcl::PointCloud<pcl::PointXYZ>);
-  fromPCLPointCloud2(triangles->cloud, *cloud);
-  std::cerr << "input points " << cloud -> size() << std::endl;
-  std::cerr << "input faces " << triangles->polygons.size() << std::endl;
-  // std::vector<float> normal_p;
-  // std::vector<float> normal_vertical;
-  // normal_vertical.push_back(0);
-  // normal_vertical.push_back(0);
-  // normal_vertical.push_back(1);
+  // P[out]: out put the points that need to be supported, the centroid of samples in each voxel
+  // progress[in]: may be NULL, return SUPPORT_CANCELLED when cancelled
+  // return SUPPORT_TOO_MANY_VOXELS when an axis needs 2^21 voxels or more
+  // samples are summed into voxels of size sample_rate as they are made, per block of faces,
+  // then blocks are merged in order, so P doesn't depend on the number of threads
+
+  // voxel index is z, y, x packed in 21 bits each from the corner of the bounding box,
+  // so P comes out in the same order as pcl::VoxelGrid
+  P -> clear();
+  if(triangles -> face_count() == 0){
+    return 0;
+  }
+  float inv_leaf = 1 / sample_rate;
+  std::vector<float> b_box;
+  bounding_box(triangles, b_box);
+  int64_t base[3];
+  for (int k = 0; k < 3; k += 1){
+    base[k] = (int64_t)floor(b_box[k] * inv_leaf);
+    if(!((int64_t)floor(b_box[k + 3] * inv_leaf) - base[k] + 1 < (1 << 21))){
+      return SUPPORT_TOO_MANY_VOXELS;
+    }
+  }
+
   float cos_alpha = cos((M_PI / 2.0) - alpha);
-  float a[3], b[3], normal_p[3];
-  float la, lb;
   const float normal_vertical[3] = {0, 0, -1};
-  std::vector<int> rec;
-  for (size_t i = 0; i < triangles->polygons.size(); i += 1){
-  // for (size_t i = 0; i < 1; i += 1){
-    a[0] = (*cloud)[(triangles->polygons[i]).vertices[1]].x - (*cloud)[(triangles->polygons[i]).vertices[0]].x;
-    a[1] = (*cloud)[(triangles->polygons[i]).vertices[1]].y - (*cloud)[(triangles->polygons[i]).vertices[0]].y;
-    a[2] = (*cloud)[(triangles->polygons[i]).vertices[1]].z - (*cloud)[(triangles->polygons[i]).vertices[0]].z;
-
-    b[0] = (*cloud)[(triangles->polygons[i]).vertices[2]].x - (*cloud)[(triangles->polygons[i]).vertices[0]].x;
-    b[1] = (*cloud)[(triangles->polygons[i]).vertices[2]].y - (*cloud)[(triangles->polygons[i]).vertices[0]].y;
-    b[2] = (*cloud)[(triangles->polygons[i]).vertices[2]].z - (*cloud)[(triangles->polygons[i]).vertices[0]].z;
-
-    normal_p[0] = a[1] * b[2] - a[2] * b[1];
-    normal_p[1] = a[2] * b[0] - a[0] * b[2];
-    normal_p[2] = a[0] * b[1] - a[1] * b[0];
-
-    // std::cout << normal_p[2] << std::endl;
-    float cos_theta = (normal_p[0] * normal_vertical[0] + normal_p[1] * normal_vertical[1] + normal_p[2] * normal_vertical[2]) / (sqrt(normal_p[0] * normal_p[0] + normal_p[1] * normal_p[1] + normal_p[2] * normal_p[2]) * sqrt(normal_vertical[0] * normal_vertical[0] + normal_vertical[1] * normal_vertical[1] + normal_vertical[2] * normal_vertical[2]));
-    // std::cout << cos_theta << std::endl;
-    // faces that need to be supported
-    if(cos_theta >= cos_alpha){  //cosine, larger angle, smaller cosine
-      rec.push_back(i);
-      // std::cout << "> "<<i << std::endl;
-      b[0] = (*cloud)[(triangles->polygons[i]).vertices[2]].x - (*cloud)[(triangles->polygons[i]).vertices[1]].x;
-      b[1] = (*cloud)[(triangles->polygons[i]).vertices[2]].y - (*cloud)[(triangles->polygons[i]).vertices[1]].y;
-      b[2] = (*cloud)[(triangles->polygons[i]).vertices[2]].z - (*cloud)[(triangles->polygons[i]).vertices[1]].z;
-      la = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
-      lb = sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
-      size_t ia = (size_t)(la / (sample_rate / 10.));
-      size_t ib = (size_t)(lb / (sample_rate / 10.));
-      // std::cout<< "ia:"<< ia << " " << ib << std::endl;
-
-      for (size_t j = 0; j < ia; j += 1){
-        for (size_t k = 0; k < (float)j / ia * ib; k += 1){
-          pcl::PointXYZ point;
-          point.x = (*cloud)[(triangles->polygons[i]).vertices[0]].x + a[0] * j / ia + b[0] * k / ib;
-          point.y = (*cloud)[(triangles->polygons[i]).vertices[0]].y + a[1] * j / ia + b[1] * k / ib;
-          point.z = (*cloud)[(triangles->polygons[i]).vertices[0]].z + a[2] * j / ia + b[2] * k / ib;
-          if(point.z != 0){
-            P -> push_back(point);
+  size_t m = triangles -> face_count();
+  size_t blocks = (m + SUPPORT_BLOCK_FACES - 1) / SUPPORT_BLOCK_FACES;
+  std::vector<std::vector<VoxelSum> > block_voxels(blocks);
+  std::atomic<size_t> blocks_done(0);
+
+  parallel_for(blocks, parallel_workers(blocks, 1), [&](size_t begin, size_t end, size_t w){
+    std::unordered_map<uint64_t, uint32_t> index;  // key -> position in voxels
+    float a[3], b[3], normal_p[3];
+    float la, lb;
+    for (size_t block = begin; block < end; block += 1){
+      std::vector<VoxelSum> &voxels = block_voxels[block];
+      index.clear();
+      for (size_t i = block * SUPPORT_BLOCK_FACES; i < std::min(m, (block + 1) * SUPPORT_BLOCK_FACES); i += 1){
+        if(progress != NULL && progress -> cancel){
+          return;
+        }
+        const float* v0 = triangles->face_point(i, 0);
+        const float* v1 = triangles->face_point(i, 1);
+        const float* v2 = triangles->face_point(i, 2);
+        a[0] = v1[0] - v0[0];
+        a[1] = v1[1] - v0[1];
+        a[2] = v1[2] - v0[2];
+
+        b[0] = v2[0] - v0[0];
+        b[1] = v2[1] - v0[1];
+        b[2] = v2[2] - v0[2];
+
+        normal_p[0] = a[1] * b[2] - a[2] * b[1];
+        normal_p[1] = a[2] * b[0] - a[0] * b[2];
+        normal_p[2] = a[0] * b[1] - a[1] * b[0];
+
+        float cos_theta = (normal_p[0] * normal_vertical[0] + normal_p[1] * normal_vertical[1] + normal_p[2] * normal_vertical[2]) / (sqrt(normal_p[0] * normal_p[0] + normal_p[1] * normal_p[1] + normal_p[2] * normal_p[2]) * sqrt(normal_vertical[0] * normal_vertical[0] + normal_vertical[1] * normal_vertical[1] + normal_vertical[2] * normal_vertical[2]));
+        // faces that need to be supported
+        if(!(cos_theta >= cos_alpha)){  //cosine, larger angle, smaller cosine
+          continue;
+        }
+        b[0] = v2[0] - v1[0];
+        b[1] = v2[1] - v1[1];
+        b[2] = v2[2] - v1[2];
+        la = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+        lb = sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+        size_t ia = (size_t)(la / (sample_rate / 10.));
+        size_t ib = (size_t)(lb / (sample_rate / 10.));
+
+        for (size_t j = 0; j < ia; j += 1){
+          for (size_t k = 0; k < (float)j / ia * ib; k += 1){
+            float point[3];
+            for (int c = 0; c < 3; c += 1){
+              point[c] = v0[c] + a[c] * j / ia + b[c] * k / ib;
+            }
+            uint64_t key = 0;
+            for (int c = 2; c >= 0; c -= 1){
+              // rounding may put a sample just outside the bounding box
+              int64_t v = (int64_t)floor(point[c] * inv_leaf) - base[c];
+              key = (key << 21) | (uint64_t)std::max((int64_t)0, std::min(v, (int64_t)(1 << 21) - 1));
+            }
+            std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> ins = index.insert(std::make_pair(key, (uint32_t)voxels.size()));
+            if(ins.second){
+              VoxelSum voxel = {key, {0, 0, 0}, 0};
+              voxels.push_back(voxel);
+            }
+            VoxelSum &voxel = voxels[ins.first -> second];
+            for (int c = 0; c < 3; c += 1){
+              voxel.sum[c] += point[c];
+            }
+            voxel.count += 1;
           }
         }
       }
+      if(progress != NULL){
+        progress -> value = 0.2 * (blocks_done += 1) / blocks;
+      }
     }
+  });
+  if(progress != NULL && progress -> cancel){
+    return SUPPORT_CANCELLED;
   }
-  std::cerr<< "face need:"<< rec.size() << std::endl;
-  std::cerr<< "P size before:"<< P->size() << std::endl;
-  pcl::VoxelGrid<pcl::PointXYZ> grid;
-  grid.setLeafSize(sample_rate, sample_rate, sample_rate);
-  grid.setInputCloud(P);
-  grid.filter(*P);
-  std::cerr<< "P size after:"<< P->size() << std::endl;
-  ////////////////////fake code //////////////////////////////
-  pcl::io::savePCDFileASCII ("tmp.pcd", *P + *cloud);
-  // pcl::io::savePCDFileASCII ("tmp.pcd", *P);
-  ////////////////////////////////////////////////////////////
 
+  // stable, so each voxel is summed in block order
+  std::vector<VoxelSum> all;
+  for (size_t i = 0; i < blocks; i += 1){
+    all.insert(all.end(), block_voxels[i].begin(), block_voxels[i].end());
+    std::vector<VoxelSum>().swap(block_voxels[i]);
+  }
+  std::stable_sort(all.begin(), all.end(), sort_by_key);
+
+  for (size_t i = 0; i < all.size();){
+    double sum[3] = {0, 0, 0};
+    size_t count = 0;
+    size_t j = i;
+    for (; j < all.size() && all[j].key == all[i].key; j += 1){
+      for (int c = 0; c < 3; c += 1){
+        sum[c] += all[j].sum[c];
+      }
+      count += all[j].count;
+    }
+    P -> push_back(pcl::PointXYZ(sum[0] / count, sum[1] / count, sum[2] / count));
+    i = j;
+  }
   return 0;
 }
 
-double cone_mesh_intersect(cone a, MeshPtr triangles, std::vector<tri_data> &preprocess_tri, Eigen::Vector3f &p){
+static float nearest_on_tri(const tri_data &t, size_t i, const Eigen::Vector3f &pos, Eigen::Vector3f &tmp_p){
+  // nearest point on triangle i to pos, return the distance
+  const float* rot = &t.rot[i * 9];
+  const float* origin = &t.origin[i * 3];
+  const float* after = &t.after[i * 6];
+  float q[3] = {pos[0] - origin[0], pos[1] - origin[1], pos[2] - origin[2]};
+  float p[3];
+  for (int k = 0; k < 3; k += 1){
+    p[k] = rot[k * 3] * q[0] + rot[k * 3 + 1] * q[1] + rot[k * 3 + 2] * q[2];
+  }
+
+  // nearest point in the triangle's frame
+  float n[3] = {0, p[1], p[2]};
+  float d = std::abs(p[0]);
+  float d_sq = INFINITY;
+  for (int j = 0; j < 3; j += 1){
+    const float* l = &t.line[i * 9 + j * 3];
+    bool side = l[0] * p[1] + l[1] * p[2] + l[2] >= 0;
+    if(side == bool((t.inside[i] >> j) & 1)){
+      continue;
+    }
+    // outside edge j, nearest on the edge segment
+    const float* a = after + tri_edge[j][0] * 2;
+    const float* b = after + tri_edge[j][1] * 2;
+    float e[2] = {b[0] - a[0], b[1] - a[1]};
+    float s = ((p[1] - a[0]) * e[0] + (p[2] - a[1]) * e[1]) / (e[0] * e[0] + e[1] * e[1]);
+    s = std::max(0.0f, std::min(1.0f, s));
+    float y = a[0] + s * e[0], z = a[1] + s * e[1];
+    float tmp_d = p[0] * p[0] + (p[1] - y) * (p[1] - y) + (p[2] - z) * (p[2] - z);
+    if(tmp_d < d_sq){
+      d_sq = tmp_d;
+      n[1] = y;
+      n[2] = z;
+    }
+  }
+  if(d_sq != INFINITY){
+    d = sqrt(d_sq);
+  }
+
+  for (int k = 0; k < 3; k += 1){
+    tmp_p[k] = rot[k] * n[0] + rot[3 + k] * n[1] + rot[6 + k] * n[2] + origin[k];
+  }
+  return d;
+}
+
+static float cone_box_distance(const cone &a, float tan_a, const BvhNode &node){
+  // lower bound of distance from the cone vertex to any point of the box
+  // that may be inside the cone, infinity if the box is outside
+  // boxes are widened by CONE_BOX_MARGIN for rounding of the nearest points
+  float lo[3], hi[3];
+  for (int k = 0; k < 3; k += 1){
+    lo[k] = node.lo[k] - CONE_BOX_MARGIN;
+    hi[k] = node.hi[k] + CONE_BOX_MARGIN;
+  }
+  float h = a.pos[2] - lo[2];
+  if(h < 0){
+    return INFINITY;
+  }
+  float dx = std::max(std::max(lo[0] - a.pos[0], a.pos[0] - hi[0]), 0.0f);
+  float dy = std::max(std::max(lo[1] - a.pos[1], a.pos[1] - hi[1]), 0.0f);
+  if(dx * dx + dy * dy > tan_a * tan_a * h * h){
+    return INFINITY;
+  }
+  float dz = std::max(a.pos[2] - hi[2], 0.0f);
+  return sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+double cone_mesh_intersect(cone a, const TriangleBvh &bvh, const tri_data &preprocess_tri, Eigen::Vector3f &p){
   // intersect a cone with a mesh
   // by finding the nearst point on each triangle
   // and check whether it's inside the cone
+  // only triangles in boxes that reach into the cone are visited, nearer boxes first
   // return the distance
   float tan_a = tan(a.theta);
-  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud (new pcl::PointCloud<pcl::PointXYZ>);
-  fromPCLPointCloud2(triangles->cloud, *cloud);
 
   float m = std::numeric_limits<float>::infinity();
-  std::vector<int> main_list(3);
-  main_list[0] = 12;
-  main_list[1] = 13;
-  main_list[2] = 23;
+  size_t m_index = SIZE_MAX;
+  if(bvh.nodes.empty()){
+    return m;
+  }
 
   float d;
   Eigen::Vector3f tmp_p;
-  int index, tmp_sum;
-  for (size_t i = 0; i < triangles->polygons.size(); i += 1){
-    if(!preprocess_tri[i].ok){
+  std::vector<std::pair<float, uint32_t> > stack;
+  stack.push_back(std::make_pair(cone_box_distance(a, tan_a, bvh.nodes[0]), 0));
+  while(!stack.empty()){
+    std::pair<float, uint32_t> top = stack.back();
+    stack.pop_back();
+    // equal distance is still visited, ties go to the lower face index
+    if(top.first > m){
       continue;
     }
-    Eigen::Vector3f p_trans = preprocess_tri[i].tri_trans * a.pos;
-    // Eigen::Vector3f p_yz(0, p_trans(1), p_trans(2));
-    std::vector<int> record;
-    for (size_t j = 0; j < 3; j += 1){
-      if (bool(sub_in(p_trans(1), p_trans(2), preprocess_tri[i].L[main_list[j]]) >= 0) == preprocess_tri[i].in_tri[main_list[j]]){
-        record.push_back(main_list[j]);
-      }
-    }
-    if (record.size() == 3){  // in the triangle
-      d = std::abs(p_trans(0));
-      tmp_p = Eigen::Vector3f(0, p_trans(1), p_trans(2));
-    }
-    else if(record.size() == 2){ // nearst to another line
-      tmp_sum = record[0] + record[1];
-      if(tmp_sum == 12 + 13){
-        index = 23;
-      }
-      else if(tmp_sum == 12 + 23){
-        index = 13;
+    const BvhNode &node = bvh.nodes[top.second];
+    if(node.count == 0){
+      std::pair<float, uint32_t> near(cone_box_distance(a, tan_a, bvh.nodes[top.second + 1]), top.second + 1);
+      std::pair<float, uint32_t> far(cone_box_distance(a, tan_a, bvh.nodes[node.first]), node.first);
+      if(far.first < near.first){
+        std::swap(near, far);
       }
-      else if(tmp_sum == 13 + 23){
-        index = 12;
+      if(far.first <= m){
+        stack.push_back(far);
       }
-      float c_n = (preprocess_tri[i].L[index](1) * p_trans(1)+ preprocess_tri[i].L[index](0) * p_trans(2)) * -1;
-      float a_sq_plus_b_sq = pow(preprocess_tri[i].L[index](0), 2) + pow(preprocess_tri[i].L[index](1), 2);
-      tmp_p = Eigen::Vector3f(0,
-        (-preprocess_tri[i].L[index](0) * preprocess_tri[i].L[index](2) - preprocess_tri[i].L[index](1) * c_n) / a_sq_plus_b_sq,
-        (preprocess_tri[i].L[index](0) * c_n - preprocess_tri[i].L[index](1) * preprocess_tri[i].L[index](2)) / a_sq_plus_b_sq);
-      d = d_v3(tmp_p, p_trans);
-    }
-    else if(record.size() == 1){// nearst to another point
-      if(record[0] == 12){
-        index = 3 - 1;
+      if(near.first <= m){
+        stack.push_back(near);
       }
-      else if(record[0] == 13){
-        index = 2 - 1;
-      }
-      else if(record[0] == 23){
-        index = 1 - 1;
-      }
-      tmp_p = Eigen::Vector3f(preprocess_tri[i].tri_after(0, index), preprocess_tri[i].tri_after(1, index), preprocess_tri[i].tri_after(2, index));
-      d = d_v3(tmp_p, p_trans);
-      // line_point
-    }
-    else{
-      // d+=1;
-      std::cerr<< "i " << i << " "<< record.size() << std::endl;
-      std::cerr<< "p_trans " << p_trans << std::endl;
-      std::cerr<< "1 f\n " << preprocess_tri[i].L[main_list[0]] << std::endl;
-      std::cerr<< "2 f\n " << preprocess_tri[i].L[main_list[1]] << std::endl;
-      std::cerr<< "3 f\n " << preprocess_tri[i].L[main_list[2]] << std::endl;
-
-      std::cerr<< "n 1\n " << sub_in(p_trans(1), p_trans(2), preprocess_tri[i].L[main_list[0]]) << std::endl;
-      std::cerr<< "n 2\n " << bool(sub_in(p_trans(1), p_trans(2), preprocess_tri[i].L[main_list[1]]) >=0) << std::endl;
-      std::cerr<< "n 3\n " << sub_in(p_trans(1), p_trans(2), preprocess_tri[i].L[main_list[2]]) << std::endl;
-
-      std::cerr<< " a1\n " << preprocess_tri[i].in_tri[main_list[0]] << std::endl;
-      std::cerr<< " a2\n " << preprocess_tri[i].in_tri[main_list[1]] << std::endl;
-      std::cerr<< " a3\n " << preprocess_tri[i].in_tri[main_list[2]] << std::endl;
-      if (bool(sub_in(p_trans(1), p_trans(2), preprocess_tri[i].L[main_list[1]]) >=0) == preprocess_tri[i].in_tri[main_list[1]])
-      {
-          std::cerr<< "ok " << std::endl;
-      }
-      exit(1);
-    }
-    tmp_p = preprocess_tri[i].tri_trans.inverse() * tmp_p;
-
-    //check whether it's in the cone
-    float h = a.pos[2] - tmp_p(2);
-    if(h >= 0){
-      if(tan_a * h >= sqrt(pow(tmp_p[0] - a.pos[0], 2) + pow(tmp_p[1] - a.pos[1], 2))){
-        if(d < m){
-          m = d;
-          p = tmp_p;
-          // std::cerr<< "i " << i << " "<< record.size() << std::endl;
+      continue;
+    }
+
+    for (uint32_t k = node.first; k < node.first + node.count; k += 1){
+      size_t i = bvh.order[k];
+      d = nearest_on_tri(preprocess_tri, i, a.pos, tmp_p);
+
+      //check whether it's in the cone
+      float h = a.pos[2] - tmp_p(2);
+      if(h >= 0){
+        if(tan_a * h >= sqrt(pow(tmp_p[0] - a.pos[0], 2) + pow(tmp_p[1] - a.pos[1], 2))){
+          if(d < m || (d == m && i < m_index)){
+            m = d;
+            m_index = i;
+            p = tmp_p;
+          }
         }
       }
     }
-
   }
-  // std::cerr<< "m " << m << std::endl;
-  // std::cerr<< "tmp_p " << tmp_p << std::endl;
-  // std::cerr<< "p " << p << std::endl;
-
   return m;
 }
 
@@ -569,7 +865,8 @@ double cone_intersect(cone a, cone b, cone &c){
       c = a;
       return 0;
     }
-    return -1;
+    // b right below a, the cone surfaces only meet at infinity
+    return INFINITY;
   }
   float h;
   // std::cout<< "tan " << tan(a.theta) << std::endl;
@@ -627,16 +924,66 @@ Eigen::Matrix3f find_strut_tri(float R, float shrink_d, Eigen::Vector3f start, E
   return tri;
 }
 
-int connect_tri(Eigen::Matrix3f &tri1, Eigen::Matrix3f &tri2, pcl::PointCloud<pcl::PointXYZ>::Ptr strut_point, MeshPtr &strut_stl){
-  int index = strut_point->size();
-  for (size_t i = 0; i < 3; i += 1){
-    strut_point->push_back(pcl::PointXYZ(tri1(0, i), tri1(1, i), tri1(2, i)));
+static void strut_size(const tree_node &n, uint32_t &points, uint32_t &faces){
+  // vertices and faces a node adds to the strut mesh
+  if(n.left >= 0){  // ring and the point splitting it, strut from the parent
+    points = 4;
+    faces = 6;
+  }
+  else if(n.left == -1){  // ring and tip, strut from the parent and cone to the tip
+    points = 4;
+    faces = 9;
+  }
+  else if(n.left == -2){  // tip on the mesh and ring
+    points = 4;
+    faces = 3;
+  }
+  else{  // ring on the plate
+    points = 3;
+    faces = 1;
   }
+}
 
-  for (size_t i = 0; i < 3; i += 1){
-    strut_point->push_back(pcl::PointXYZ(tri2(0, i), tri2(1, i), tri2(2, i)));
+static void set_point(MeshPtr &strut_stl, uint32_t i, float x, float y, float z){
+  float* p = strut_stl -> point(i);
+  p[0] = x;
+  p[1] = y;
+  p[2] = z;
+}
+
+static void set_face(MeshPtr &strut_stl, uint32_t f, uint32_t v0, uint32_t v1, uint32_t v2){
+  strut_stl -> faces[f * 3] = v0;
+  strut_stl -> faces[f * 3 + 1] = v1;
+  strut_stl -> faces[f * 3 + 2] = v2;
+}
+
+static void set_ring(MeshPtr &strut_stl, uint32_t i, const Eigen::Matrix3f &tri){
+  for (int j = 0; j < 3; j += 1){
+    set_point(strut_stl, i + j, tri(0, j), tri(1, j), tri(2, j));
   }
-  int index_mapping[6][3] = {
+}
+
+static Eigen::Matrix3f flat_ring(const pcl::PointXYZ &p, float z, float R){
+  // ring of radius R around p on the horizontal plane at z
+  Eigen::Matrix3f tri;
+  tri(0, 0) = p.x + R;
+  tri(1, 0) = p.y + 0;
+  tri(2, 0) = z;
+
+  tri(0, 1) = p.x + R * cos(M_PI * 2 / 3 * 2);
+  tri(1, 1) = p.y + R * sin(M_PI * 2 / 3 * 2);
+  tri(2, 1) = z;
+
+  tri(0, 2) = p.x + R * cos(M_PI * 2 / 3);
+  tri(1, 2) = p.y + R * sin(M_PI * 2 / 3);
+  tri(2, 2) = z;
+  return tri;
+}
+
+static void connect_tri(MeshPtr &strut_stl, uint32_t f, const uint32_t tri1[3], const uint32_t tri2[3]){
+  // side of a strut between 2 rings, 6 faces from f
+  uint32_t v[6] = {tri1[0], tri1[1], tri1[2], tri2[0], tri2[1], tri2[2]};
+  static const int index_mapping[6][3] = {
     {0, 2, 3},
     {1, 4, 5},
     {1, 5, 2},
@@ -645,189 +992,140 @@ int connect_tri(Eigen::Matrix3f &tri1, Eigen::Matrix3f &tri2, pcl::PointCloud<pc
     {0, 4, 1}
   };
   for (size_t i = 0; i < 6; i += 1){
-    pcl::Vertices v;
-    v.vertices.resize(3);
-    for (size_t j = 0; j < 3; j += 1){
-      v.vertices[j] = index + index_mapping[i][j];
-    }
-    strut_stl->polygons.push_back(v);
+    set_face(strut_stl, f + i, v[index_mapping[i][0]], v[index_mapping[i][1]], v[index_mapping[i][2]]);
   }
-  return 0;
 }
 
-int add_triangle(Eigen::Matrix3f &tri, pcl::PointCloud<pcl::PointXYZ>::Ptr strut_point, MeshPtr &strut_stl){
-  // simply add a triangle into mesh
-  for (size_t i = 0; i < 3; i += 1){
-    strut_point->push_back(pcl::PointXYZ(tri(0, i), tri(1, i), tri(2, i)));
-  }
-  pcl::Vertices v;
-  v.vertices.resize(3);
-  v.vertices[0] = strut_point -> size() - 3;
-  v.vertices[1] = strut_point -> size() - 2;
-  v.vertices[2] = strut_point -> size() - 1;
-
-  strut_stl->polygons.push_back(v);
-  return 0;
-}
-
-int re_strut(std::vector<int> input, int from, Eigen::Matrix3f tri, SupportTree &support_tree, MeshPtr &strut_stl, pcl::PointCloud<pcl::PointXYZ>::Ptr strut_point, pcl::PointCloud<pcl::PointXYZ>::Ptr P){
-  // recursively generate strut
-  float R = 1, shrink_d = 2;
-  Eigen::Matrix3f new_tri1, new_tri2;
-  for (size_t i = 0; i < input.size(); i += 1){
-    if (support_tree.tree[input[i]].left >= 0){ // split into 2
-
-
-      // big triangle
-      new_tri1(0, 0) = P->points[support_tree.tree[input[i]].index].x + R;
-      new_tri1(1, 0) = P->points[support_tree.tree[input[i]].index].y + 0;
-      new_tri1(2, 0) = P->points[support_tree.tree[input[i]].index].z;
-
-      //  fake code
-      // new_tri1(0, 1) = P->points[support_tree.tree[input[i]].index].x + R * cos(M_PI * 2 / 3 );
-      // new_tri1(1, 1) = P->points[support_tree.tree[input[i]].index].y + R * sin(M_PI * 2 / 3 );
-      // new_tri1(2, 1) = P->points[support_tree.tree[input[i]].index].z;
-
-      // new_tri1(0, 2) = P->points[support_tree.tree[input[i]].index].x + R * cos(M_PI * 2 / 3 * 2);
-      // new_tri1(1, 2) = P->points[support_tree.tree[input[i]].index].y + R * sin(M_PI * 2 / 3 * 2);
-      // new_tri1(2, 2) = P->points[support_tree.tree[input[i]].index].z;
-      // add_triangle(new_tri1, strut_point, strut_stl);
-      //
-
-      new_tri1(0, 1) = P->points[support_tree.tree[input[i]].index].x + R * cos(M_PI * 2 / 3 * 2);
-      new_tri1(1, 1) = P->points[support_tree.tree[input[i]].index].y + R * sin(M_PI * 2 / 3 * 2);
-      new_tri1(2, 1) = P->points[support_tree.tree[input[i]].index].z;
-
-      new_tri1(0, 2) = P->points[support_tree.tree[input[i]].index].x + R * cos(M_PI * 2 / 3);
-      new_tri1(1, 2) = P->points[support_tree.tree[input[i]].index].y + R * sin(M_PI * 2 / 3);
-      new_tri1(2, 2) = P->points[support_tree.tree[input[i]].index].z;
+struct StrutStep{
+  // a node waiting to be built, tri: vertices of the ring below it
+  // point, face: where its subtree starts in the strut mesh
+  int node, from;
+  uint32_t tri[3];
+  uint32_t point, face;
+};
 
-      connect_tri(tri, new_tri1, strut_point, strut_stl);
+static void build_strut(const pcl::PointCloud<pcl::PointXYZ> &P, std::vector<tree_node> &tree, const std::vector<uint32_t> &sub_points, const std::vector<uint32_t> &sub_faces, int root, uint32_t point, uint32_t face, MeshPtr &strut_stl){
+  // build the subtree of a root from point and face on, nodes of the subtree are written depth first
+  float R = 1, shrink_d = 2;  // TODO: how to determine R, radius
+  const tree_node &r = tree[root];
+  const pcl::PointXYZ &base = P.points[r.index];
+  Eigen::Matrix3f tri;
+  StrutStep step;
+  step.node = r.right;
+  step.from = root;
+  if(r.left == -3){  // strut start from plate
+    tri = flat_ring(base, base.z, R);
+    set_ring(strut_stl, point, tri);
+    set_face(strut_stl, face, point, point + 1, point + 2);
+    step.point = point + 3;
+    step.face = face + 1;
+    for (int j = 0; j < 3; j += 1){
+      step.tri[j] = point + j;
+    }
+  }
+  else{  // strut start from mesh
+    Eigen::Vector3f start(base.x, base.y, base.z);
+    const pcl::PointXYZ &end = P.points[r.right];
+    tri = find_strut_tri(R, shrink_d, start, Eigen::Vector3f(end.x, end.y, end.z));
+    set_point(strut_stl, point, start(0), start(1), start(2));
+    set_ring(strut_stl, point + 1, tri);
+    for (int j = 0; j < 3; j += 1){
+      set_face(strut_stl, face + j, point, point + (j + 0) % 3 + 1, point + (j + 1) % 3 + 1);
+      step.tri[j] = point + 1 + j;
+    }
+    step.point = point + 4;
+    step.face = face + 3;
+  }
 
-      Eigen::Vector3f left(P->points[support_tree.tree[input[i]].left].x, P->points[support_tree.tree[input[i]].left].y, P->points[support_tree.tree[input[i]].left].z);
-      Eigen::Vector3f right(P->points[support_tree.tree[input[i]].right].x, P->points[support_tree.tree[input[i]].right].y, P->points[support_tree.tree[input[i]].right].z);
-      Eigen::Vector3f t(P->points[support_tree.tree[input[i]].index].x + R * cos(M_PI * 2 / 3), P->points[support_tree.tree[input[i]].index].y + R * sin(M_PI * 2 / 3), P->points[support_tree.tree[input[i]].index].z);
+  std::vector<StrutStep> stack(1, step);
+  while(!stack.empty()){
+    step = stack.back();
+    stack.pop_back();
+    tree_node &n = tree[step.node];
+    const pcl::PointXYZ &p = P.points[n.index];
+    uint32_t ring[3] = {step.point, step.point + 1, step.point + 2};
+
+    if(n.left >= 0){  // split into 2
+      tri = flat_ring(p, p.z, R);
+      set_ring(strut_stl, step.point, tri);
+      uint32_t mid = step.point + 3;
+      set_point(strut_stl, mid, p.x - 0.5 * R, p.y, p.z);
+      connect_tri(strut_stl, step.face, step.tri, ring);
 
       // determine which connect to which, swap if needed
+      Eigen::Vector3f left(P.points[n.left].x, P.points[n.left].y, P.points[n.left].z);
+      Eigen::Vector3f right(P.points[n.right].x, P.points[n.right].y, P.points[n.right].z);
+      Eigen::Vector3f t = tri.col(2);
       if (d_v3(left, t) > d_v3(right, t)){
-        int tmp;
-        tmp = support_tree.tree[input[i]].left;
-        support_tree.tree[input[i]].left = support_tree.tree[input[i]].right;
-        support_tree.tree[input[i]].right = tmp;
-      }
-
-
-      // split triangle 1
-      new_tri1(0, 0) = P->points[support_tree.tree[input[i]].index].x + R;
-      new_tri1(1, 0) = P->points[support_tree.tree[input[i]].index].y + 0;
-      new_tri1(2, 0) = P->points[support_tree.tree[input[i]].index].z;
-
-      new_tri1(0, 1) = P->points[support_tree.tree[input[i]].index].x - 0.5 * R;
-      new_tri1(1, 1) = P->points[support_tree.tree[input[i]].index].y;
-      new_tri1(2, 1) = P->points[support_tree.tree[input[i]].index].z;
-
-      new_tri1(0, 2) = P->points[support_tree.tree[input[i]].index].x + R * cos(M_PI * 2 / 3);
-      new_tri1(1, 2) = P->points[support_tree.tree[input[i]].index].y + R * sin(M_PI * 2 / 3);
-      new_tri1(2, 2) = P->points[support_tree.tree[input[i]].index].z;
-      std::vector<int> new_input1;
-      new_input1.push_back(support_tree.tree[input[i]].left);
-      re_strut(new_input1, input[i], new_tri1, support_tree, strut_stl, strut_point, P);
-
-      // split triangle 2
-      new_tri2(0, 0) = P->points[support_tree.tree[input[i]].index].x + R;
-      new_tri2(1, 0) = P->points[support_tree.tree[input[i]].index].y + 0;
-      new_tri2(2, 0) = P->points[support_tree.tree[input[i]].index].z;
-
-      new_tri2(0, 1) = P->points[support_tree.tree[input[i]].index].x + R * cos(M_PI * 2 / 3 * 2);
-      new_tri2(1, 1) = P->points[support_tree.tree[input[i]].index].y + R * sin(M_PI * 2 / 3 * 2);
-      new_tri2(2, 1) = P->points[support_tree.tree[input[i]].index].z;
-
-      new_tri2(0, 2) = P->points[support_tree.tree[input[i]].index].x - 0.5 * R;
-      new_tri2(1, 2) = P->points[support_tree.tree[input[i]].index].y;
-      new_tri2(2, 2) = P->points[support_tree.tree[input[i]].index].z;
-      std::vector<int> new_input2;
-      new_input2.push_back(support_tree.tree[input[i]].right);
-      re_strut(new_input2, input[i], new_tri2, support_tree, strut_stl, strut_point, P);
-    }
-    else if(support_tree.tree[input[i]].left == -1){ // meet support point
-      Eigen::Vector3f start = Eigen::Vector3f(P->points[support_tree.tree[input[i]].index].x, P->points[support_tree.tree[input[i]].index].y, P->points[support_tree.tree[input[i]].index].z);
-      new_tri1 = find_strut_tri(R, shrink_d, start, Eigen::Vector3f(P->points[support_tree.tree[from].index].x, P->points[support_tree.tree[from].index].y, P->points[support_tree.tree[from].index].z));
-      connect_tri(tri, new_tri1, strut_point, strut_stl);
-      Eigen::Vector3f tmp;
-      int tmp_index = strut_point -> size();
-
-      strut_point -> push_back(pcl::PointXYZ(start(0), start(1), start(2)));
-      for (size_t j = 0; j < 3; j += 1){
-        tmp = new_tri1.block<3, 1>(0, j);
-        strut_point -> push_back(pcl::PointXYZ(tmp(0), tmp(1), tmp(2)));
+        std::swap(n.left, n.right);
       }
 
-      for (size_t j = 0; j < 3; j += 1){
-        pcl::Vertices v;
-        v.vertices.resize(3);
-        v.vertices[0] = tmp_index;
-        v.vertices[1] = tmp_index + ((j + 1) % 3) + 1;
-        v.vertices[2] = tmp_index + ((j + 0) % 3) + 1;
-        strut_stl->polygons.push_back(v);
+      // the ring is split at the middle of edge 1-2, left gets the half with vertex 2
+      StrutStep left_step, right_step;
+      left_step.node = n.left;
+      right_step.node = n.right;
+      left_step.from = right_step.from = step.node;
+      left_step.tri[0] = ring[0];
+      left_step.tri[1] = mid;
+      left_step.tri[2] = ring[2];
+      right_step.tri[0] = ring[0];
+      right_step.tri[1] = ring[1];
+      right_step.tri[2] = mid;
+      left_step.point = step.point + 4;
+      left_step.face = step.face + 6;
+      right_step.point = left_step.point + sub_points[n.left];
+      right_step.face = left_step.face + sub_faces[n.left];
+      stack.push_back(right_step);
+      stack.push_back(left_step);
+    }
+    else if(n.left == -1){  // meet support point
+      Eigen::Vector3f start(p.x, p.y, p.z);
+      const pcl::PointXYZ &from = P.points[tree[step.from].index];
+      tri = find_strut_tri(R, shrink_d, start, Eigen::Vector3f(from.x, from.y, from.z));
+      set_ring(strut_stl, step.point, tri);
+      uint32_t tip = step.point + 3;
+      set_point(strut_stl, tip, start(0), start(1), start(2));
+      connect_tri(strut_stl, step.face, step.tri, ring);
+      for (int j = 0; j < 3; j += 1){
+        set_face(strut_stl, step.face + 6 + j, tip, ring[(j + 1) % 3], ring[j]);
       }
-
     }
   }
-  return 0;
 }
 
 int genearte_strut(pcl::PointCloud<pcl::PointXYZ>::Ptr P, SupportTree &support_tree, MeshPtr &strut_stl){
-  std::vector<int> input;
-  pcl::PointCloud<pcl::PointXYZ>::Ptr strut_point(new pcl::PointCloud<pcl::PointXYZ>);
-  float R, shrink_d = 2;
-  for (size_t i = 0; i < support_tree.tree.size(); i += 1){
-    // (*cloud)[(triangles->polygons[i]).vertices[1]].x
-    if(support_tree.tree[i].left == -3 || support_tree.tree[i].left == -2){
-      input.push_back(support_tree.tree[i].right);
-      Eigen::Matrix3f tri;
-      if (support_tree.tree[i].left == -3){// dealing with strut start from plate
-        R = 1; // TODO: how to determine R, radius
-        tri(0, 0) = P->points[support_tree.tree[i].index].x + R;
-        tri(1, 0) = P->points[support_tree.tree[i].index].y + 0;
-        tri(2, 0) = 0;
-
-        tri(0, 1) = P->points[support_tree.tree[i].index].x + R * cos(M_PI * 2 / 3 * 2);
-        tri(1, 1) = P->points[support_tree.tree[i].index].y + R * sin(M_PI * 2 / 3 * 2);
-        tri(2, 1) = 0;
-
-        tri(0, 2) = P->points[support_tree.tree[i].index].x + R * cos(M_PI * 2 / 3);
-        tri(1, 2) = P->points[support_tree.tree[i].index].y + R * sin(M_PI * 2 / 3);
-        tri(2, 2) = 0;
-        add_triangle(tri, strut_point, strut_stl);
-
-      }
-      else{ // dealing with strut start from mesh
-        Eigen::Vector3f start = Eigen::Vector3f(P->points[support_tree.tree[i].index].x, P->points[support_tree.tree[i].index].y, P->points[support_tree.tree[i].index].z);
-        tri = find_strut_tri(R, shrink_d, start, Eigen::Vector3f(P->points[support_tree.tree[i].right].x, P->points[support_tree.tree[i].right].y, P->points[support_tree.tree[i].right].z));
-
-        Eigen::Vector3f tmp;
-        int tmp_index = strut_point -> size();
-
-        strut_point -> push_back(pcl::PointXYZ(start(0), start(1), start(2)));
-        for (size_t j = 0; j < 3; j += 1){
-          tmp = tri.block<3, 1>(0, j);
-          strut_point -> push_back(pcl::PointXYZ(tmp(0), tmp(1), tmp(2)));
-        }
-
-        for (size_t j = 0; j < 3; j += 1){
-          pcl::Vertices v;
-          v.vertices.resize(3);
-          v.vertices[0] = tmp_index;
-          v.vertices[1] = tmp_index + ((j + 0) % 3) + 1;
-          v.vertices[2] = tmp_index + ((j + 1) % 3) + 1;
-
-          strut_stl->polygons.push_back(v);
-        }
-      }
-      re_strut(input, i, tri, support_tree, strut_stl, strut_point, P);
-      input.clear();
+  // every node adds a ring of 3 vertices, a strut is a prism between the rings of a node and its parent,
+  // struts on a ring share its vertices
+  // sizes of all subtrees are counted first, children always come before their parent in the tree,
+  // then the subtree of each root is built into its own part of the mesh, in parallel
+  std::vector<tree_node> &tree = support_tree.tree;
+  size_t n = tree.size();
+  std::vector<uint32_t> sub_points(n), sub_faces(n);
+  std::vector<int> roots;
+  std::vector<uint32_t> root_point(1, 0), root_face(1, 0);
+  for (size_t i = 0; i < n; i += 1){
+    strut_size(tree[i], sub_points[i], sub_faces[i]);
+    if(tree[i].left >= 0){
+      sub_points[i] += sub_points[tree[i].left] + sub_points[tree[i].right];
+      sub_faces[i] += sub_faces[tree[i].left] + sub_faces[tree[i].right];
+    }
+    else if(tree[i].left == -2 || tree[i].left == -3){
+      sub_points[i] += sub_points[tree[i].right];
+      sub_faces[i] += sub_faces[tree[i].right];
+      roots.push_back(i);
+      root_point.push_back(root_point.back() + sub_points[i]);
+      root_face.push_back(root_face.back() + sub_faces[i]);
     }
   }
-  toPCLPointCloud2(*strut_point, strut_stl->cloud);
+
+  strut_stl -> points.assign((size_t)root_point.back() * 3, 0);
+  strut_stl -> faces.assign((size_t)root_face.back() * 3, 0);
+  parallel_for(roots.size(), parallel_workers(root_face.back(), FACES_PER_WORKER), [&](size_t begin, size_t end, size_t w){
+    for (size_t i = begin; i < end; i += 1){
+      build_strut(*P, tree, sub_points, sub_faces, roots[i], root_point[i], root_face[i], strut_stl);
+    }
+  });
+  strut_stl -> points_changed();
+  strut_stl -> faces_changed();
   return 0;
 }
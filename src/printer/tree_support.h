@@ -1,12 +1,82 @@
+#ifndef TREE_SUPPORT_H
+#define TREE_SUPPORT_H
+
+#include <atomic>
 #include "printer_module.h"
+#include "triangle_bvh.h"
+
+// boxes and grid cells are widened by this when culling cones, more than rounding of distances
+#define CONE_BOX_MARGIN 1e-3f
+// faces sampled for support points together, blocks are merged in order
+#define SUPPORT_BLOCK_FACES 4096
+// average number of cone vertices in a cell of the grid for cone-cone intersection
+#define CONE_GRID_POINTS 4
+// how far in mm points may be off a rigid move for a model to still match its SupportCache
+#define SUPPORT_MOVE_TOLERANCE 1e-3f
+
+// error code for add_support
+#define SUPPORT_CANCELLED -1
+#define SUPPORT_BAD_PARAMETER -2
+// sample_rate is valid but too small for the size of the model
+#define SUPPORT_TOO_MANY_VOXELS -3
+
+struct SupportProgress{
+  // shared with other threads while add_support runs
+  // value: fraction of the work done, 0 to 1
+  // cancel: set to make add_support stop early and return SUPPORT_CANCELLED
+  std::atomic<float> value;
+  std::atomic<bool> cancel;
+  SupportProgress() : value(0), cancel(false){}
+};
+
+struct tri_data{
+  // preprocessed triangles of a mesh as flat arrays, indexed by face
+  // each triangle is moved by a rigid transform onto the yz-plane,
+  // vertex 0 to the origin and vertex 1 onto the z axis
+  // ok[i]: whether it's a valid triangle, the rest is only set for valid ones
+  // rot[9 * i]: rotation by rows, p' = rot * (p - origin)
+  // origin[3 * i]: vertex 0, so the inverse is p = rot^T * p' + origin
+  // after[6 * i]: y, z of the 3 vertices after the transform, x is 0
+  // line[9 * i]: (a, b, c) of a * y + b * z + c = 0 through edge 12, 13 and 23
+  // inside[i]: bit j set if the triangle is on the side of line j where a * y + b * z + c >= 0
+  std::vector<uint8_t> ok;
+  std::vector<float> rot, origin, after, line;
+  std::vector<uint8_t> inside;
+};
+
+struct SupportCache{
+  // what add_support found for a model, kept in the coordinates of the mesh it was found on
+  // when the same model comes back turned about the z axis or moved, the samples and
+  // the preprocessed triangles are reused, the struts too if its height is unchanged
+  // only one add_support may use it at a time
+  // points, faces: the mesh, to recognize the model after a move
+  // samples: support points on the overhangs
+  // plate: height of the plate the struts were built for, NAN if there's none
+  bool valid;
+  float alpha, sample_rate;
+  std::vector<float> points;
+  std::vector<uint32_t> faces;
+  CloudPtr samples;
+  tri_data tri;
+  TriangleBvh bvh;
+  float plate;
+  MeshPtr strut;
+  SupportCache() : valid(false), alpha(0), sample_rate(0), samples(new pcl::PointCloud<pcl::PointXYZ>), plate(NAN), strut(createMeshPtr()){}
+};
 
 struct cone;
-struct tri_data;
 class SupportTree;
-int add_support(MeshPtr input_mesh, MeshPtr out_mesh, float alpha);
-int find_support_point(MeshPtr triangles, float alpha, float sample_rate, pcl::PointCloud<pcl::PointXYZ>::Ptr P);
-double cone_mesh_intersect(cone a, MeshPtr triangles, std::vector<tri_data> &preprocess_tri, Eigen::Vector3f &p);
+// tree support for faces that overhang more than alpha radians from the vertical,
+// overhangs are sampled on a grid of sample_rate mm, out_mesh gets the struts
+// progress and cache may be NULL
+// return number of faces in out_mesh, or error code
+int add_support(MeshPtr input_mesh, MeshPtr out_mesh, float alpha, float sample_rate, SupportProgress* progress, SupportCache* cache);
+int find_support_point(MeshPtr triangles, float alpha, float sample_rate, pcl::PointCloud<pcl::PointXYZ>::Ptr P, SupportProgress* progress);
+double cone_mesh_intersect(cone a, const TriangleBvh &bvh, const tri_data &preprocess_tri, Eigen::Vector3f &p);
 double cone_intersect(cone a, cone b, cone &c);
+int grow_tree(const pcl::PointCloud<pcl::PointXYZ> &samples, const TriangleBvh &bvh, const tri_data &preprocess_tri, float alpha, float plate, SupportProgress* progress, MeshPtr strut_stl);
 int genearte_strut(pcl::PointCloud<pcl::PointXYZ>::Ptr P, SupportTree &support_tree, MeshPtr &strut_stl);
 Eigen::Matrix3f find_strut_tri(float R, float shrink_d, Eigen::Vector3f start, Eigen::Vector3f end);
-int preprocess(MeshPtr input_mesh, std::vector<tri_data> &preprocess_tri);
+int preprocess(MeshPtr input_mesh, tri_data &preprocess_tri);
+
+#endif
@@ -0,0 +1,162 @@
+#include <algorithm>
+
+#include "triangle_bvh.h"
+#include "parallel.h"
+
+
+static float half_area(const float lo[3], const float hi[3]){
+  float d[3] = {hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]};
+  return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+}
+
+static void grow(float lo[3], float hi[3], const float* box){
+  for (int k = 0; k < 3; k += 1){
+    lo[k] = std::min(lo[k], box[k]);
+    hi[k] = std::max(hi[k], box[k + 3]);
+  }
+}
+
+static void reset(float lo[3], float hi[3]){
+  for (int k = 0; k < 3; k += 1){
+    lo[k] = INFINITY;
+    hi[k] = -INFINITY;
+  }
+}
+
+void TriangleBvh::build(const Mesh &mesh, const std::vector<uint8_t>* keep){
+  nodes.clear();
+  order.clear();
+  size_t m = mesh.face_count();
+  for (uint32_t f = 0; f < m; f += 1){
+    if(keep == NULL || (*keep)[f]){
+      order.push_back(f);
+    }
+  }
+  if(order.empty()){
+    return;
+  }
+
+  box.resize(m * 6);
+  center.resize(m * 3);
+  parallel_for(order.size(), parallel_workers(order.size(), FACES_PER_WORKER), [&](size_t begin, size_t end, size_t w){
+    for (size_t i = begin; i < end; i += 1){
+      uint32_t f = order[i];
+      float* b = &box[f * 6];
+      reset(b, b + 3);
+      for (int j = 0; j < 3; j += 1){
+        const float* p = mesh.face_point(f, j);
+        for (int k = 0; k < 3; k += 1){
+          b[k] = std::min(b[k], p[k]);
+          b[k + 3] = std::max(b[k + 3], p[k]);
+        }
+      }
+      for (int k = 0; k < 3; k += 1){
+        center[f * 3 + k] = (b[k] + b[k + 3]) / 2;
+      }
+    }
+  });
+
+  nodes.reserve(order.size() / BVH_LEAF_FACES * 2 + 1);
+  build_node(0, order.size());
+  std::vector<float>().swap(box);
+  std::vector<float>().swap(center);
+}
+
+uint32_t TriangleBvh::build_node(uint32_t begin, uint32_t end){
+  // nodes are laid out depth first, the left child right after its parent
+  uint32_t index = nodes.size();
+  nodes.push_back(BvhNode());
+
+  BvhNode node;
+  float c_lo[3], c_hi[3];
+  reset(node.lo, node.hi);
+  reset(c_lo, c_hi);
+  for (uint32_t i = begin; i < end; i += 1){
+    grow(node.lo, node.hi, &box[order[i] * 6]);
+    const float* c = &center[order[i] * 3];
+    for (int k = 0; k < 3; k += 1){
+      c_lo[k] = std::min(c_lo[k], c[k]);
+      c_hi[k] = std::max(c_hi[k], c[k]);
+    }
+  }
+  if(end - begin <= BVH_LEAF_FACES){
+    node.first = begin;
+    node.count = end - begin;
+    nodes[index] = node;
+    return index;
+  }
+
+  // binned surface area heuristic on the centroids,
+  // cost of a split is area(left) * count(left) + area(right) * count(right)
+  int best_axis = -1, best_bin = 0;
+  float best_cost = INFINITY;
+  for (int k = 0; k < 3; k += 1){
+    if(c_hi[k] <= c_lo[k]){
+      continue;
+    }
+    float scale = BVH_BINS / (c_hi[k] - c_lo[k]);
+    size_t bin_count[BVH_BINS] = {0};
+    float bin_box[BVH_BINS][6];
+    for (int b = 0; b < BVH_BINS; b += 1){
+      reset(bin_box[b], bin_box[b] + 3);
+    }
+    for (uint32_t i = begin; i < end; i += 1){
+      int b = std::min(BVH_BINS - 1, (int)((center[order[i] * 3 + k] - c_lo[k]) * scale));
+      bin_count[b] += 1;
+      grow(bin_box[b], bin_box[b] + 3, &box[order[i] * 6]);
+    }
+
+    // right side areas from the back, then sweep from the front
+    float right_area[BVH_BINS];
+    size_t right_count[BVH_BINS];
+    float lo[3], hi[3];
+    reset(lo, hi);
+    size_t count = 0;
+    for (int b = BVH_BINS - 1; b > 0; b -= 1){
+      if(bin_count[b]){
+        grow(lo, hi, bin_box[b]);
+      }
+      count += bin_count[b];
+      right_area[b] = count ? half_area(lo, hi) : 0;
+      right_count[b] = count;
+    }
+    reset(lo, hi);
+    count = 0;
+    for (int b = 0; b + 1 < BVH_BINS; b += 1){
+      if(bin_count[b]){
+        grow(lo, hi, bin_box[b]);
+      }
+      count += bin_count[b];
+      if(count == 0 || right_count[b + 1] == 0){
+        continue;
+      }
+      float cost = half_area(lo, hi) * count + right_area[b + 1] * right_count[b + 1];
+      if(cost < best_cost){
+        best_cost = cost;
+        best_axis = k;
+        best_bin = b + 1;
+      }
+    }
+  }
+
+  uint32_t mid = begin;
+  if(best_axis >= 0){
+    int k = best_axis;
+    float scale = BVH_BINS / (c_hi[k] - c_lo[k]);
+    const std::vector<float> &c = center;
+    float lo = c_lo[k];
+    mid = std::partition(order.begin() + begin, order.begin() + end, [&](uint32_t f){
+      return std::min(BVH_BINS - 1, (int)((c[f * 3 + k] - lo) * scale)) < best_bin;
+    }) - order.begin();
+  }
+  if(mid == begin || mid == end){
+    // all centroids at one point, just halve
+    mid = (begin + end) / 2;
+  }
+
+  build_node(begin, mid);
+  node.first = build_node(mid, end);
+  node.count = 0;
+  nodes[index] = node;
+  return index;
+}
@@ -0,0 +1,37 @@
+#ifndef TRIANGLE_BVH_H
+#define TRIANGLE_BVH_H
+
+#include <stdint.h>
+#include <vector>
+#include "printer_module.h"
+
+// largest leaf, and number of bins tried on each axis when splitting
+#define BVH_LEAF_FACES 4
+#define BVH_BINS 16
+
+struct BvhNode{
+  // lo, hi: bounding box of the faces under this node
+  // leaf: faces order[first, first + count)
+  // inner node: count == 0, children are the next node and nodes[first]
+  float lo[3], hi[3];
+  uint32_t first, count;
+};
+
+class TriangleBvh{
+  // bounding volume hierarchy over faces of a mesh, split by surface area heuristic
+  // nodes[0] is the root, empty if there's no face
+public:
+  // faces with keep[f] == 0 are left out, keep may be NULL
+  void build(const Mesh &mesh, const std::vector<uint8_t>* keep);
+
+  std::vector<BvhNode> nodes;
+  std::vector<uint32_t> order;  // face index
+
+private:
+  uint32_t build_node(uint32_t begin, uint32_t end);
+
+  std::vector<float> box;  // lo, hi of each face
+  std::vector<float> center;  // centroid of each face's box
+};
+
+#endif
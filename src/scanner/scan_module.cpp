@@ -236,42 +236,48 @@ int POS(PointXYZRGBNormalPtr cloud_with_normals, MeshPtr triangles, PointCloudXY
   return 0;
 }
 
-int STL_to_List(MeshPtr triangles, std::vector<std::vector< std::vector<float> > > &data){
-  // point's data
-  // data =[
-  //           t1[p1[x, y, z], p2[x, y, z], p3[x, y, z]],
-  //           t2[p1[x, y, z], p2[x, y, z], p3[x, y, z]],
-  //           t3[p1[x, y, z], p2[x, y, z], p3[x, y, z]],
-  //             ...
-  //       ]
+int mesh_face_count(MeshPtr triangles){
+  return triangles->polygons.size();
+}
+
+int mesh_point_count(MeshPtr triangles){
+  return triangles->cloud.width * triangles->cloud.height;
+}
+
+int export_triangles(MeshPtr triangles, float* data){
+  // data: face_count * 9 floats, x, y, z of the 3 points of each face
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud (new pcl::PointCloud<pcl::PointXYZRGB>);
   fromPCLPointCloud2(triangles->cloud, *cloud);
-  int v0, v1, v2;
-  data.resize(triangles->polygons.size());
   for (size_t i = 0; i < triangles->polygons.size(); i += 1){
-    data[i].resize(3);
     for (int j = 0; j < 3; j += 1){
-      data[i][j].resize(3);
+      const pcl::PointXYZRGB &p = (*cloud)[triangles->polygons[i].vertices[j]];
+      data[i * 9 + j * 3] = p.x;
+      data[i * 9 + j * 3 + 1] = p.y;
+      data[i * 9 + j * 3 + 2] = p.z;
     }
   }
-  for (size_t i = 0; i < triangles->polygons.size(); i += 1){
-    v0 = triangles->polygons[i].vertices[0];
-    v1 = triangles->polygons[i].vertices[1];
-    v2 = triangles->polygons[i].vertices[2];
-
-    data[i][0][0] = (*cloud)[v0].x;
-    data[i][0][1] = (*cloud)[v0].y;
-    data[i][0][2] = (*cloud)[v0].z;
-
-    data[i][1][0] = (*cloud)[v1].x;
-    data[i][1][1] = (*cloud)[v1].y;
-    data[i][1][2] = (*cloud)[v1].z;
+  return 0;
+}
 
-    data[i][2][0] = (*cloud)[v2].x;
-    data[i][2][1] = (*cloud)[v2].y;
-    data[i][2][2] = (*cloud)[v2].z;
+int export_points(MeshPtr triangles, float* data){
+  // data: point_count * 3 floats
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud (new pcl::PointCloud<pcl::PointXYZRGB>);
+  fromPCLPointCloud2(triangles->cloud, *cloud);
+  for (size_t i = 0; i < cloud->size(); i += 1){
+    data[i * 3] = (*cloud)[i].x;
+    data[i * 3 + 1] = (*cloud)[i].y;
+    data[i * 3 + 2] = (*cloud)[i].z;
   }
+  return 0;
+}
 
+int export_faces(MeshPtr triangles, int* data){
+  // data: face_count * 3 vertex indices
+  for (size_t i = 0; i < triangles->polygons.size(); i += 1){
+    for (int j = 0; j < 3; j += 1){
+      data[i * 3 + j] = triangles->polygons[i].vertices[j];
+    }
+  }
   return 0;
 }
 
@@ -56,7 +56,11 @@ typedef pcl::PolygonMesh::Ptr MeshPtr;
 MeshPtr createMeshPtr();
 int POS(PointXYZRGBNormalPtr cloud_with_normals, MeshPtr triangles, PointCloudXYZRGBPtr cloud, float smooth);
 int GPT(PointXYZRGBNormalPtr cloud_with_normals, MeshPtr triangles, PointCloudXYZRGBPtr cloud);
-int STL_to_List(MeshPtr triangles, std::vector<std::vector< std::vector<float> > > &data);
+int mesh_face_count(MeshPtr triangles);
+int mesh_point_count(MeshPtr triangles);
+int export_triangles(MeshPtr triangles, float* data);
+int export_points(MeshPtr triangles, float* data);
+int export_faces(MeshPtr triangles, int* data);
 // int STL_to_Faces(MeshPtr triangles, std::vector< std::vector<int> > &data);
 int apply_transform(PointCloudXYZRGBPtr cloud, NormalPtr normals, PointXYZRGBNormalPtr both, float x, float y, float z, float rx, float ry, float rz);
 
@@ -2,6 +2,8 @@ import cython
 import sys
 from libcpp.vector cimport vector
 
+import numpy as np
+
 
 cdef extern from "scan_module.h":
     cdef cppclass PointCloudXYZRGBPtr:
@@ -47,7 +49,11 @@ cdef extern from "scan_module.h":
     int POS(PointXYZRGBNormalPtr cloud_with_normals, MeshPtr triangles, PointCloudXYZRGBPtr cloud, float smooth)
     int GPT(PointXYZRGBNormalPtr cloud_with_normals, MeshPtr triangles, PointCloudXYZRGBPtr cloud)
     # int STL_to_Faces(MeshPtr, vector[vector [int]] &viewp)
-    int STL_to_List(MeshPtr triangles, vector[vector[vector [float]]] &data)
+    int mesh_face_count(MeshPtr triangles)
+    int mesh_point_count(MeshPtr triangles)
+    int export_triangles(MeshPtr triangles, float* data) nogil
+    int export_points(MeshPtr triangles, float* data) nogil
+    int export_faces(MeshPtr triangles, int* data) nogil
     int cut(PointCloudXYZRGBPtr input, PointCloudXYZRGBPtr output, int mode, int direction, float value)
 
 cdef class PointCloudXYZRGBObj:
@@ -152,10 +158,32 @@ cdef class PointCloudXYZRGBObj:
     #    STL_to_Faces(self.meshobj, viewp)
     #    return viewp
 
-    cpdef STL_to_List(self):
-        cdef vector[vector[vector [float]]] data
-        STL_to_List(self.meshobj, data)
-        return data
+    def triangles(self):
+        """
+        return float32[M, 3, 3] numpy array, x, y, z of the 3 points of each face
+        """
+        out = np.empty((mesh_face_count(self.meshobj), 3, 3), dtype=np.float32)
+        cdef float[:, :, ::1] view = out
+        if view.shape[0]:
+            with nogil:
+                export_triangles(self.meshobj, &view[0, 0, 0])
+        return out
+
+    def arrays(self):
+        """
+        return (float32[N, 3], int32[M, 3]) numpy arrays, points and vertex indices of each face
+        """
+        points = np.empty((mesh_point_count(self.meshobj), 3), dtype=np.float32)
+        faces = np.empty((mesh_face_count(self.meshobj), 3), dtype=np.int32)
+        cdef float[:, ::1] points_view = points
+        cdef int[:, ::1] faces_view = faces
+        if points_view.shape[0]:
+            with nogil:
+                export_points(self.meshobj, &points_view[0, 0])
+        if faces_view.shape[0]:
+            with nogil:
+                export_faces(self.meshobj, &faces_view[0, 0])
+        return points, faces
 
 
 
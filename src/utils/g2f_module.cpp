@@ -6,6 +6,7 @@
 #include "float.h"
 #include "math.h"
 #include "g2f_module.h"
+#include "utils_module.h"
 
 float FLT_SAFE = -(FLT_MAX/10);
 #define quick_abs(x) (x>0?x:-x)
@@ -149,7 +150,11 @@ FCode* createFCodePtr() {
   fc->layer_now = 0;
 
   fc->native_path = new vector< vector<PathVector> >();
-  fc->pause_at_layers = new vector<int>();
+  fc->path_worker = NULL;
+  fc->layer_events = new vector<LayerEvent>();
+  fc->next_event = 0;
+  fc->event_layer = -1;
+  fc->highlight_layer = -1;
 
   PathVector p = {0, 0, MAX_HEIGHT, TYPE_MOVE};
   vector<PathVector> first_layer;
@@ -159,12 +164,19 @@ FCode* createFCodePtr() {
 
   fc->counter_between_layers = 0;
   fc->record_z = 0;
-  fc->is_backed_to_normal_temperature = 0;
 
   fc->path_type = TYPE_MOVE;
   return fc;
 }
 
+void freeFCode(FCode* fc, char free_path) {
+  if (fc == NULL) return;
+  freePathWorker(fc->path_worker);
+  delete fc->layer_events;
+  if (free_path) delete fc->native_path;
+  free(fc);
+}
+
 int XYZEF(char* str, FCode* fc, float *num) {
     // """
     // Parses data into a list: [F, X, Y, Z, E1, E2, E3]
@@ -208,6 +220,21 @@ int XYZEF(char* str, FCode* fc, float *num) {
 
 
 
+void push_new_layer(FCode* fc) {
+  // start a new preview layer from the last point, the previous layer is
+  // finished from now on and can be handed to the path worker
+  vector<PathVector> new_layer;
+  PathVector p = fc->native_path->back().back();
+  p.path_type = fc->path_type;
+  new_layer.push_back(p);
+  fc->native_path->push_back(new_layer);
+
+  if (fc->path_worker != NULL) {
+    vector<PathVector> &done = (*fc->native_path)[fc->native_path->size() - 2];
+    path_worker_push(fc->path_worker, done.data(), done.size());
+  }
+}
+
 void process_path(FCode* fc, char* comment, bool move_flag, bool extrude_flag) {
   // """
   // convert to path list(for visualizing)
@@ -221,12 +248,7 @@ void process_path(FCode* fc, char* comment, bool move_flag, bool extrude_flag) {
         fc->record_z = fc->current_pos[3];
         fc->counter_between_layers = 0;
         fc->layer_now = fc->native_path->size();
-
-        vector<PathVector> new_layer;
-        PathVector p = fc->native_path->back().back();
-        p.path_type = fc->path_type;
-        new_layer.push_back(p);
-        fc->native_path->push_back(new_layer);
+        push_new_layer(fc);
     }
     if (move_flag) {
         if (extrude_flag) {
@@ -264,12 +286,7 @@ void process_path(FCode* fc, char* comment, bool move_flag, bool extrude_flag) {
 
                 fc->counter_between_layers = 0;
                 fc->layer_now = fc->native_path->size();
-
-                vector<PathVector> new_layer;
-                PathVector p = fc->native_path->back().back();
-                p.path_type = fc->path_type;
-                new_layer.push_back(p);
-                fc->native_path->push_back(new_layer);
+                push_new_layer(fc);
             }
         } else if(strstr(comment,"perimeter")) {
             line_type = TYPE_PERIMETER;
@@ -289,11 +306,7 @@ void process_path(FCode* fc, char* comment, bool move_flag, bool extrude_flag) {
         
         if (strlen(comment) == 0 && !splitted && fc->current_pos[3] - fc->record_z > 0.3) {
           // 0.3 is the max layer height in fluxstudio
-          vector<PathVector> new_layer;
-          PathVector p = fc->native_path->back().back();
-          p.path_type = fc->path_type;
-          new_layer.push_back(p);
-          fc->native_path->push_back(new_layer);
+          push_new_layer(fc);
 
           fc->record_z = fc->current_pos[3];
           fc->counter_between_layers = 0;
@@ -359,6 +372,64 @@ void analyze_metadata(float* data, char* comment, FCode* fc) {
   }
 }
 
+void add_layer_event(FCode* fc, LayerEvent event) {
+  // keep the table sorted by layer, events of the same layer keep their order
+  // a layer pauses once however many times it's listed
+  vector<LayerEvent>::iterator it = fc->layer_events->end();
+  while (it != fc->layer_events->begin() && (it - 1)->layer > event.layer) it--;
+  if (event.type == EVENT_PAUSE) {
+    for (vector<LayerEvent>::iterator same = it; same != fc->layer_events->begin() && (same - 1)->layer == event.layer; same--) {
+      if ((same - 1)->type == EVENT_PAUSE) return;
+    }
+  }
+  fc->layer_events->insert(it, event);
+}
+
+void apply_layer_events(FCode* fc, char** output_ptr) {
+  // called before every move, writes the events of layer_now, at most
+  // LAYER_EVENTS_PER_MOVE at a time since the output of a line has a fixed
+  // size, the rest follow on the next moves, even past the end of the layer
+  // events of layers left without any move are dropped
+  vector<LayerEvent>& events = *fc->layer_events;
+  if (fc->layer_now != fc->event_layer) {
+    size_t begin = fc->next_event;
+    while (fc->event_layer >= 0 && begin < events.size() && events[begin].layer <= fc->event_layer) begin++;
+    size_t end = begin;
+    while (end < events.size() && events[end].layer < fc->layer_now) end++;
+    events.erase(events.begin() + begin, events.begin() + end);
+    fc->event_layer = fc->layer_now;
+  }
+  int written = 0;
+  while (fc->next_event < events.size() && events[fc->next_event].layer <= fc->layer_now && written < LAYER_EVENTS_PER_MOVE) {
+    LayerEvent& event = events[fc->next_event++];
+    written++;
+    if ((event.type == EVENT_TEMPERATURE || event.type == EVENT_FAN) && (event.tool > 7 || event.tool < 0)) {
+      fprintf(stderr, "[G2FCPP-EXT] Skip layer event of toolhead %d\n", event.tool);
+      continue;
+    }
+    switch(event.type) {
+      case EVENT_PAUSE:
+        fprintf(stderr, "[G2FCPP-EXT] Auto pause at %d\n", fc->layer_now);
+        fc->highlight_layer = fc->layer_now;
+        write_char(output_ptr, 5);
+        break;
+      case EVENT_TEMPERATURE:
+        fprintf(stderr, "[G2FCPP-EXT] Setting toolhead temperature # %d to %f\n", fc->layer_now, event.value);
+        write_char(output_ptr, 16 | event.tool);
+        write_float(output_ptr, event.value);
+        break;
+      case EVENT_FAN:
+        write_char(output_ptr, 48 | event.tool);
+        write_float(output_ptr, event.value);
+        break;
+      case EVENT_OPCODE:
+        write_char(output_ptr, event.code);
+        if (event.has_value) write_float(output_ptr, event.value);
+        break;
+    }
+  }
+}
+
 const char* symbols[7] = {"F","X","Y","Z","E1","E2","E3"};
 
 int convert_to_fcode_by_line(char* line, FCode* fc, char* fcode_output) {
@@ -413,23 +484,8 @@ int convert_to_fcode_by_line(char* line, FCode* fc, char* fcode_output) {
           }
         }
 
-        // Auto pause at layers
-        if (std::find(fc->pause_at_layers->begin(), fc->pause_at_layers->end(), fc->layer_now) != fc->pause_at_layers->end()) {
-            if (fc->highlight_layer != fc->layer_now) {
-                fprintf(stderr, "[G2FCPP-EXT] Auto pause at %d\n", fc->layer_now);
-                fc->highlight_layer = fc->layer_now;
-                
-                write_char(&output_ptr, 5);
-            }
-        }
-        
-        // Overwrite following layer temperature
-        if (fc->layer_now == 2 && fc->printing_temperature > 50 && !fc->is_backed_to_normal_temperature){
-            write_char(&output_ptr, 16);
-            write_float(&output_ptr, fc->printing_temperature);
-            fprintf(stderr, "[G2FCPP-EXT] Setting toolhead temperature back to normal # %d to %f\n", fc->layer_now, fc->printing_temperature);
-            fc->is_backed_to_normal_temperature = true;
-        }
+        // Pause, temperature, fan... scheduled for this layer
+        apply_layer_events(fc, &output_ptr);
 
         analyze_metadata(data, comment, fc);
 
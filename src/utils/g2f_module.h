@@ -28,6 +28,29 @@ typedef struct{
   void* ptr;
 } Cursor;
 
+struct PathWorker;
+
+typedef enum{
+  EVENT_PAUSE,
+  EVENT_TEMPERATURE,
+  EVENT_FAN,
+  EVENT_OPCODE
+} LayerEventType;
+
+// events written before one move, 5 bytes at most each, so they stay
+// well inside the output buffer of a line, more events of a layer
+// are spread over the following moves
+#define LAYER_EVENTS_PER_MOVE 64
+
+typedef struct{
+  int layer;
+  LayerEventType type;
+  int tool;  // toolhead index for EVENT_TEMPERATURE and EVENT_FAN
+  int code;  // fcode command byte for EVENT_OPCODE
+  float value;  // temperature, fan strength (0~1) or EVENT_OPCODE argument
+  char has_value;  // EVENT_OPCODE only, write value after code
+} LayerEvent;
+
 
 typedef struct{
   int tool; 
@@ -46,20 +69,25 @@ typedef struct{
   int layer_now;
   PathType path_type;
   vector< vector<PathVector> >* native_path;
-  vector<int>* pause_at_layers;
+  PathWorker* path_worker;  // serializes finished layers, NULL if not used
+  vector<LayerEvent>* layer_events;  // sorted by layer
+  size_t next_event;  // first event of layer_events not applied yet
+  int event_layer;  // layer which events were applied last
   int counter_between_layers;
   float record_z;
   int index;
 	int highlight_layer;
   char is_cura;
   char record_path;
-  char is_backed_to_normal_temperature;
   //config = None  # config dict(given from fluxstudio)
 
 } FCode;
 
 FCode* createFCodePtr();
+// free_path: also delete native_path, 0 when it was handed to another owner
+void freeFCode(FCode* fc, char free_path);
 int convert_to_fcode_by_line(char* line, FCode* fc, char* fcode_output);
+void add_layer_event(FCode* fc, LayerEvent event);
 void trim_ends_cpp(vector< vector< PathVector > >* output);
 
 #endif
\ No newline at end of file
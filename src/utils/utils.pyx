@@ -8,7 +8,6 @@ from math import sqrt, sin, cos, pi, atan2
 import time
 from re import findall
 from getpass import getuser
-from threading import Thread
 from io import BytesIO, StringIO
 
 from fluxclient.hw_profile import HW_PROFILE
@@ -24,12 +23,6 @@ logger = logging.getLogger(__name__)
 
 cimport libc.stdlib
 
-cdef extern from "utils_module.h": 
-    ctypedef struct PathVector:
-        pass
-    string path_to_js(vector[vector[vector [float]]] output)
-    string path_to_js_cpp(vector[vector[PathVector]]* output)
-
 cdef extern from "path_vector.h":
     ctypedef struct PathVector:
         float x
@@ -37,8 +30,29 @@ cdef extern from "path_vector.h":
         float z
         int path_type 
 
+cdef extern from "utils_module.h": 
+    ctypedef struct PathLevels:
+        pass
+    string path_to_js(vector[vector[vector [float]]] output)
+    string path_to_js_cpp(vector[vector[PathVector]]* output)
+    string path_to_bin_cpp(vector[vector[PathVector]]* output, float quantum)
+    PathLevels* createPathLevels(vector[vector[PathVector]]* source)
+    void freePathLevels(PathLevels* pl)
+    int get_path_range(PathLevels* pl, int start, int end, int lod, vector[vector[PathVector]]* output) except +
+
+cdef encode_path_range(PathLevels* levels, int start, int end, int lod, path_type):
+    # levels is NULL when there is no path yet, encoded as no layer
+    cdef vector[vector[PathVector]] output
+    if levels != NULL:
+        get_path_range(levels, start, end, lod, &output)
+    if path_type == 'bin':
+        return path_to_bin_cpp(&output, 0.01)
+    else:
+        return path_to_js_cpp(&output).decode()
+
 cdef class NativePath:
     cdef vector[vector[PathVector]]* ptr
+    cdef PathLevels* levels
     
     def __init__(self):
         pass
@@ -49,7 +63,24 @@ cdef class NativePath:
     cdef vector[vector[PathVector]]* getPtr(self):
         return self.ptr
 
+    def __len__(self):
+        if self.ptr == NULL:
+            return 0
+        return self.ptr.size()
+
+    cpdef get_layers(self, int start=0, int end=-1, int lod=0, path_type='js'):
+        """
+        Returns layers [start, end) as js string or binary preview,
+        lod > 0 simplifies every layer, simplified layers are cached for good,
+        so the path must not grow anymore
+        """
+        if self.levels == NULL and self.ptr != NULL:
+            self.levels = createPathLevels(self.ptr)
+        return encode_path_range(self.levels, start, end, lod, path_type)
+
     def __dealloc__(self):
+        if self.levels != NULL:
+            freePathLevels(self.levels)
         PyMem_Free(self.ptr)
 
 
@@ -66,7 +97,47 @@ cdef class Tools:
         else:
             return path_to_js(path)
 
+    cpdef path_to_bin(self, path, float quantum=0.01):
+        """
+        Encode path into the binary preview format (see path_to_bin_cpp),
+        path can be a NativePath or a python list as path_to_js accepted
+        """
+        cdef vector[vector[PathVector]] origin
+        cdef vector[PathVector] layer_v
+        cdef PathVector v
+        cdef NativePath native = NativePath();
+        if(type(path) is type(native)):
+            native = path
+            return path_to_bin_cpp(native.ptr, quantum)
+        else:
+            for layer in path:
+                layer_v.clear()
+                for point in layer:
+                    v.x = point[0]
+                    v.y = point[1]
+                    v.z = point[2]
+                    v.path_type = <int>point[3] + 1
+                    layer_v.push_back(v)
+                origin.push_back(layer_v)
+            return path_to_bin_cpp(&origin, quantum)
+
 cdef extern from "g2f_module.h":
+    ctypedef struct PathWorker:
+        pass
+
+    ctypedef enum LayerEventType:
+        EVENT_PAUSE
+        EVENT_TEMPERATURE
+        EVENT_FAN
+        EVENT_OPCODE
+
+    ctypedef struct LayerEvent:
+        int layer
+        LayerEventType type
+        int tool
+        int code
+        float value
+        char has_value
 
     ctypedef enum PathType:
         pass
@@ -88,33 +159,43 @@ cdef extern from "g2f_module.h":
         int layer_now
         PathType path_type
         vector[vector[PathVector]]* native_path
-        vector[int]* pause_at_layers
+        PathWorker* path_worker
+        vector[LayerEvent]* layer_events
         int counter_between_layers
         float record_z
         int index
         int highlight_layer;
         char is_cura
         char record_path
-        char is_backed_to_normal_temperature # For first layer temperature settings
 
     int convert_to_fcode_by_line(char* line, FCode* fc, char* fcode_output);
     char* c_open_file(char* path)
     FCode* createFCodePtr()
+    void freeFCode(FCode* fc, char free_path)
+    void add_layer_event(FCode* fc, LayerEvent event)
     void trim_ends_cpp(vector[vector[PathVector]]* output);
 
 cdef extern from "../utils/utils_module.h":
     string path_to_js_cpp(vector[vector[PathVector]]* output)
+    string path_to_bin_cpp(vector[vector[PathVector]]* output, float quantum)
+    PathWorker* createPathWorker()
+    void close_path_worker(FCode* fc)
+    const char* path_worker_js(PathWorker* w, size_t* length) nogil
+    void freePathWorker(PathWorker* w)
 
 cdef class GcodeToFcodeCpp:
     cdef FCode* fc
+    cdef PathLevels* levels
     cdef unsigned long crc
     cdef public object image
     cdef public object md
-    cdef char record_path
+    cdef public bint record_path
+    cdef char path_given
     cdef public object empty_layer
     cdef public object pause_at_layers
+    cdef public object layer_events
     cdef object path_js
-    cdef object T #Thread
+    cdef object path_bin
     cdef public str engine
     cdef public object path
     cdef public object G92_delta
@@ -126,8 +207,6 @@ cdef class GcodeToFcodeCpp:
       analyze metadata
     """ 
     def __init__(self, version=1, head_type="EXTRUDER", ext_metadata={}):
-        self.T = None
-
         #super(GcodeToFcode, self).__init__()
         self.crc = 0  # computing crc32, use for generating fcode
         self.image = None  # png image that will store in fcode as perview image, should be a bytes obj
@@ -144,10 +223,77 @@ cdef class GcodeToFcodeCpp:
         self.config = None  # config dict(given from fluxstudio)
         
         self.pause_at_layers = []
+        self.layer_events = []  # [(layer, action, value, tool, code)], see add_layer_event
         self.empty_layer = []
 
         self.empty_layer = []
         self.path_js = None
+        self.path_bin = None
+
+    @staticmethod
+    def layer_event(layer, action, value=0, tool=0, code=None):
+        """
+        Returns a checked event as (layer, action, value, tool, code)
+        """
+        if action not in ('pause', 'temperature', 'fan', 'opcode'):
+            raise ValueError("Unknown layer event: %s" % action)
+        if not 0 <= int(tool) <= 7:
+            # toolhead index is the low 3 bits of the fcode command
+            raise ValueError("Bad toolhead: %s" % tool)
+        if action == 'opcode':
+            if code is None or not 0 <= int(code) <= 255:
+                raise ValueError("Bad fcode command byte: %s" % code)
+        else:
+            code = 0
+        return (int(layer), action, value, int(tool), int(code))
+
+    def add_layer_event(self, layer, action, value=0, tool=0, code=None):
+        """
+        Schedule an action when printing reaches layer, action is one of
+        'pause', 'temperature', 'fan' (value 0~1) or 'opcode' (code is
+        the fcode command byte 0~255, value is written after it if not None)
+        """
+        self.layer_events.append(self.layer_event(layer, action, value, tool, code))
+
+    def parse_layer_events(self, events):
+        """
+        Parse config string 'layer:action[:value[:tool]],...'
+        ex. '20:temperature:215,40:fan:0.5,60:pause,80:opcode:5'
+        returns the events, layer_events is not changed
+        """
+        result = []
+        for item in events.split(','):
+            item = item.strip()
+            if not item:
+                continue
+            args = item.split(':')
+            if len(args) < 2 or not args[0].strip().isdigit():
+                raise ValueError("Bad layer event: %s" % item)
+            layer, action = int(args[0]), args[1].strip()
+            if action == 'opcode':
+                if len(args) < 3:
+                    raise ValueError("Bad layer event: %s" % item)
+                result.append(self.layer_event(layer, action,
+                                               float(args[3]) if len(args) > 3 else None,
+                                               code=int(args[2], 0)))
+            else:
+                result.append(self.layer_event(layer, action,
+                                               float(args[2]) if len(args) > 2 else 0,
+                                               int(args[3]) if len(args) > 3 else 0))
+        return result
+
+    cdef push_layer_events(self, FCode* fc, events):
+        cdef LayerEvent event
+        types = {'pause': EVENT_PAUSE, 'temperature': EVENT_TEMPERATURE,
+                 'fan': EVENT_FAN, 'opcode': EVENT_OPCODE}
+        for layer, action, value, tool, code in events:
+            event.layer = layer
+            event.type = types[action]
+            event.tool = tool
+            event.code = code
+            event.has_value = value is not None
+            event.value = value if value is not None else 0
+            add_layer_event(fc, event)
 
     def get_metadata(self):
         """
@@ -170,35 +316,74 @@ cdef class GcodeToFcodeCpp:
     cpdef extract_vector(self, obj):
         cdef PathVector v = <PathVector> obj
 
-    cpdef sub_convert_path(self):
-        # self.path_js = FcodeBase.path_to_js(self.path)
-        cdef FCode* fc = self.fc
-        #self.path_js = path_to_js_cpp(fc.native_path).decode()
-
     def offset(self, x=0.0, y=0.0, z=0.0):
         self.G92_delta[0] += x
         self.G92_delta[1] += y
         self.G92_delta[2] += z
 
+    cdef free_fcode(self):
+        # drop the last conversion, a path given away by trim_ends stays alive
+        if self.levels != NULL:
+            freePathLevels(self.levels)
+            self.levels = NULL
+        if self.fc != NULL:
+            freeFCode(self.fc, not self.path_given)
+            self.fc = NULL
+        self.path_given = False
+        self.path_js = None
+        self.path_bin = None
+
     cpdef get_path(self, path_type='js'):
+        cdef const char* js
+        cdef size_t js_len = 0
+        if path_type in ('js', 'bin') and self.fc == NULL:
+            return None
         if path_type == 'js':
-            self.T.join()
             if self.path_js is None:
-                self.path_js = path_to_js_cpp(self.fc.native_path).decode()
+                # the path worker serialized layers while converting,
+                # only wait for what it has not finished yet
+                with nogil:
+                    js = path_worker_js(self.fc.path_worker, &js_len)
+                if js != NULL:
+                    self.path_js = js[:js_len].decode()
+                else:
+                    self.path_js = path_to_js_cpp(self.fc.native_path).decode()
             return self.path_js
+        elif path_type == 'bin':
+            if self.path_bin is None:
+                self.path_bin = path_to_bin_cpp(self.fc.native_path, 0.01)
+            return self.path_bin
         else:
             if self.path:
                 return self.path
             else:
                 return None
 
+    cpdef layer_count(self):
+        if self.fc == NULL:
+            return 0
+        return self.fc.native_path.size()
+
+    cpdef get_path_range(self, int start=0, int end=-1, int lod=0, path_type='js'):
+        """
+        Returns preview layers [start, end) at level of detail lod
+        (0 for the original path), as js string or binary preview bytes,
+        simplified layers are cached, only call this after process()
+        """
+        if self.levels == NULL and self.fc != NULL:
+            self.levels = createPathLevels(self.fc.native_path)
+        return encode_path_range(self.levels, start, end, lod, path_type)
+
     cpdef trim_ends(self, path):
         """
         trim the moving(non-extruding) part in path's both end
         """
         cdef NativePath np = NativePath();
+        if self.fc == NULL:
+            return None
         trim_ends_cpp(self.fc.native_path)
         np.ptr = self.fc.native_path
+        self.path_given = True
         return np
 
         
@@ -229,18 +414,29 @@ cdef class GcodeToFcodeCpp:
         cdef char output[2048]
         cdef int script_length = 0
         cdef int output_len = 0
-        cdef FCode* fc = createFCodePtr()
-        # Initiate new FCode C instance
+        cdef FCode* fc
+        # Initiate new FCode C instance, dropping the last conversion
+        self.free_fcode()
+        fc = createFCodePtr()
         self.fc = fc
+        if self.record_path:
+            fc.path_worker = createPathWorker()
         
+        # events from config only apply to this run, layer_events is kept as is
+        events = list(self.layer_events)
         if self.config is not None:
             if self.engine == 'cura':
                 self.offset(z=float(self.config.get('z_offset', '0')))
             for auto_pause_layer in self.config.get('pause_at_layers', '').split(','):
                 if auto_pause_layer.isdigit():
-                    fc.pause_at_layers.push_back(int(auto_pause_layer))
+                    events.append(self.layer_event(int(auto_pause_layer), 'pause'))
             fc.printing_temperature = float(self.config.get('temperature', '0'))
             logger.info("[G2FCPP] FCode Printing Temperature = " + str(fc.printing_temperature))
+            if fc.printing_temperature > 50:
+                # Set toolhead temperature back to normal after first layer
+                events.append(self.layer_event(2, 'temperature', fc.printing_temperature))
+            events += self.parse_layer_events(self.config.get('layer_events', ''))
+        self.push_layer_events(fc, events)
 
         fc.is_cura = self.engine == 'cura'
         fc.tool = 0;
@@ -266,10 +462,6 @@ cdef class GcodeToFcodeCpp:
                 
                 output_stream.write(output[:output_len])
                 script_length += output_len
-                    
-
-            self.T = Thread(target=self.sub_convert_path)
-            self.T.start()
 
             # Calculate File CRC
             output_stream.seek(12, 0);
@@ -323,6 +515,9 @@ cdef class GcodeToFcodeCpp:
         except Exception as e:
             logger.exception("G_to_F fail")
             return 'broken'
+        finally:
+            # the worker thread waits for the last layer until closed
+            close_path_worker(fc)
 
     def __dealloc__(self):
-        PyMem_Free(self.fc)
\ No newline at end of file
+        self.free_fcode()
\ No newline at end of file
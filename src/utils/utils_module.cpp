@@ -1,8 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
 #include <list>
 #include <numeric>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "utils_module.h"
 
@@ -25,56 +30,367 @@ std::string path_to_js(std::vector< std::vector< std::vector<float> > > path){
   return c_string;
 }
 
-class StringBuilder{
-  list<string> m_data;
-  int m_total_length;
-public:
-  StringBuilder(){
-    m_total_length = 0;
+void append_layer_js(std::string &buf, const PathVector* points, size_t size){
+  char tmp[50];
+  buf += "[";
+  for (size_t i = 0; i < size; i++){
+    sprintf(tmp, "[%.2f,%.2f,%.2f,%d]", points[i].x, points[i].y, points[i].z, points[i].path_type - 1);
+    buf += tmp;
+    if (i != size - 1) buf += ",";
   }
-  void append(string str){
-    m_data.push_back(str);
-    m_total_length += str.length();
+  buf += "]";
+}
+
+std::string path_to_js_cpp(vector< vector< PathVector > >* path){
+  size_t point_count = 0;
+  for (size_t layer = 0; layer < path->size(); layer += 1){
+    point_count += (*path)[layer].size();
   }
-  int length(){
-    return m_total_length;
+  std::string output("[");
+  output.reserve(point_count * 32 + path->size() * 3 + 2);
+  for (size_t layer = 0; layer < path->size(); layer += 1){
+    append_layer_js(output, (*path)[layer].data(), (*path)[layer].size());
+    if(layer != path->size()-1){
+      output += ",";
+    }
   }
-  string toString(){
-    string output = "";
-    output.reserve(m_total_length);
-    for (list<string>::iterator i = m_data.begin(); i != m_data.end(); ++i)
-    {
-      output+= *i;
+  output += "]";
+  return output;
+}
+
+void append_uint32_le(std::string &buf, uint32_t n){
+  char bytes[4] = {(char)(n & 0xff), (char)((n >> 8) & 0xff), (char)((n >> 16) & 0xff), (char)((n >> 24) & 0xff)};
+  buf.append(bytes, 4);
+}
+
+void append_int16_le(std::string &buf, int16_t n){
+  uint16_t u = (uint16_t)n;
+  char bytes[2] = {(char)(u & 0xff), (char)((u >> 8) & 0xff)};
+  buf.append(bytes, 2);
+}
+
+void append_float_le(std::string &buf, float f){
+  union {
+    float a;
+    uint32_t n;
+  } converter;
+  converter.a = f;
+  append_uint32_le(buf, converter.n);
+}
+
+std::string path_to_bin_cpp(vector< vector< PathVector > >* path, float quantum){
+  // binary preview format, every field is little-endian
+  //   header (24 bytes):
+  //     char[4]  magic "FPV1"
+  //     uint32   layer count
+  //     uint32   point count (all layers)
+  //     float    quantum, coordinate unit in mm
+  //     uint32   type stream size in bytes
+  //     uint32   coordinate stream size in bytes
+  //   uint32[layer count]  points in each layer
+  //   type stream: one 4-bit path type per point, low nibble first
+  //                (value is the js path type + 1, so new layer fits in 0)
+  //   coordinate stream: x, y, z of each point quantized by quantum and
+  //                delta-encoded against the previous point as 3 x int16,
+  //                when a delta does not fit, an int16 -32768 is written
+  //                and followed by 3 x int32 absolute deltas
+  uint32_t layer_count = path->size();
+  uint32_t point_count = 0;
+  for (size_t layer = 0; layer < path->size(); layer += 1){
+    point_count += (*path)[layer].size();
+  }
+
+  std::string types;
+  types.reserve((point_count + 1) / 2);
+  std::string coords;
+  coords.reserve(point_count * 6);
+
+  int32_t last[3] = {0, 0, 0};
+  uint32_t nibble = 0;
+  unsigned char pending = 0;
+  for (size_t layer = 0; layer < path->size(); layer += 1){
+    vector<PathVector> &points = (*path)[layer];
+    for (size_t i = 0; i < points.size(); i += 1){
+      unsigned char t = (unsigned char)(points[i].path_type & 0x0f);
+      if (nibble & 1){
+        types.push_back((char)(pending | (t << 4)));
+      } else {
+        pending = t;
+      }
+      nibble += 1;
+
+      int32_t q[3] = {
+        (int32_t)lroundf(points[i].x / quantum),
+        (int32_t)lroundf(points[i].y / quantum),
+        (int32_t)lroundf(points[i].z / quantum)
+      };
+      int32_t d[3] = {q[0] - last[0], q[1] - last[1], q[2] - last[2]};
+      bool narrow = true;
+      for (int j = 0; j < 3; j++){
+        if (d[j] <= INT16_MIN || d[j] > INT16_MAX) narrow = false;
+        last[j] = q[j];
+      }
+      if (narrow){
+        for (int j = 0; j < 3; j++) append_int16_le(coords, (int16_t)d[j]);
+      } else {
+        append_int16_le(coords, INT16_MIN);
+        for (int j = 0; j < 3; j++) append_uint32_le(coords, (uint32_t)d[j]);
+      }
     }
-    return output;
   }
-};
+  if (nibble & 1){
+    types.push_back((char)pending);
+  }
 
-std::string path_to_js_cpp(vector< vector< PathVector > >* path){
-  
-  char buf[50];
-  // std::string sb("[");
-  StringBuilder builder;
-  builder.append("[");
-  // int m_reserve = 1024;
-  // sb.reserve(m_reserve);
+  std::string output;
+  output.reserve(24 + layer_count * 4 + types.size() + coords.size());
+  output.append("FPV1", 4);
+  append_uint32_le(output, layer_count);
+  append_uint32_le(output, point_count);
+  append_float_le(output, quantum);
+  append_uint32_le(output, types.size());
+  append_uint32_le(output, coords.size());
   for (size_t layer = 0; layer < path->size(); layer += 1){
-    //sb+= "[";
-    builder.append("[");
-    int layer_size = (*path)[layer].size();
-    // m_reserve += layer_size*50;
-    // sb.reserve(m_reserve);
-    for (int i = 0; i < layer_size; i++){
-      sprintf(buf, "[%.2f,%.2f,%.2f,%d]",(*path)[layer][i].x,(*path)[layer][i].y,(*path)[layer][i].z,(*path)[layer][i].path_type - 1);
-      builder.append(string(buf));
-      if(i != layer_size-1) builder.append(",");
+    append_uint32_le(output, (*path)[layer].size());
+  }
+  output += types;
+  output += coords;
+  return output;
+}
+
+// Douglas-Peucker tolerance (mm) for each PathType at lod 1, every further
+// level multiplies it by 4. Walls stay tight since they shape the preview.
+const float LOD_TOLERANCE[10] = {
+  0.05, // TYPE_NEWLAYER
+  0.1,  // TYPE_INFILL
+  0.05, // TYPE_PERIMETER
+  0.2,  // TYPE_SUPPORT
+  0.5,  // TYPE_MOVE
+  0.1,  // TYPE_SKIRT
+  0.05, // TYPE_INNERWALL
+  0.2,  // TYPE_RAFT
+  0.1,  // TYPE_SKIN
+  0.05  // TYPE_HIGHLIGHT
+};
+
+float segment_distance_sq(const PathVector &p, const PathVector &a, const PathVector &b){
+  float abx = b.x - a.x, aby = b.y - a.y, abz = b.z - a.z;
+  float apx = p.x - a.x, apy = p.y - a.y, apz = p.z - a.z;
+  float len_sq = abx * abx + aby * aby + abz * abz;
+  float t = 0;
+  if (len_sq > 0){
+    t = (apx * abx + apy * aby + apz * abz) / len_sq;
+    if (t < 0) t = 0;
+    else if (t > 1) t = 1;
+  }
+  float dx = apx - t * abx, dy = apy - t * aby, dz = apz - t * abz;
+  return dx * dx + dy * dy + dz * dz;
+}
+
+void simplify_layer(vector<PathVector> &layer, float tolerance_scale, vector<PathVector> &output){
+  // simplify each run of same path type with Douglas-Peucker,
+  // the point before a run is its anchor so run boundaries never move
+  output.clear();
+  if (layer.size() < 3){
+    output = layer;
+    return;
+  }
+  output.reserve(layer.size() / 2);
+  output.push_back(layer[0]);
+
+  vector<char> keep(layer.size(), 0);
+  vector< std::pair<size_t, size_t> > stack;
+  size_t run_start = 1;
+  while (run_start < layer.size()){
+    size_t run_end = run_start;
+    int t = layer[run_start].path_type;
+    while (run_end + 1 < layer.size() && layer[run_end + 1].path_type == t) run_end++;
+
+    float tol = LOD_TOLERANCE[(t >= 0 && t < 10) ? t : TYPE_MOVE] * tolerance_scale;
+    float tol_sq = tol * tol;
+    keep[run_end] = 1;
+    stack.clear();
+    stack.push_back(std::make_pair(run_start - 1, run_end));
+    while (!stack.empty()){
+      size_t a = stack.back().first, b = stack.back().second;
+      stack.pop_back();
+      float max_d = -1;
+      size_t max_i = a;
+      for (size_t i = a + 1; i < b; i++){
+        float d = segment_distance_sq(layer[i], layer[a], layer[b]);
+        if (d > max_d){
+          max_d = d;
+          max_i = i;
+        }
+      }
+      if (max_d > tol_sq){
+        keep[max_i] = 1;
+        stack.push_back(std::make_pair(a, max_i));
+        stack.push_back(std::make_pair(max_i, b));
+      }
     }
-    builder.append("]");
-    if(layer != path->size()-1){
-      builder.append(",");
+    for (size_t i = run_start; i <= run_end; i++){
+      if (keep[i]) output.push_back(layer[i]);
     }
+    run_start = run_end + 1;
   }
-  builder.append("]");
-  // fprintf(stderr, "path_to_js_cpp end, size = %d\n", builder.length());
-  return builder.toString();
+}
+
+PathLevels* createPathLevels(vector< vector< PathVector > >* source){
+  PathLevels* pl = new PathLevels;
+  pl->source = source;
+  return pl;
+}
+
+void freePathLevels(PathLevels* pl){
+  delete pl;
+}
+
+vector<PathVector>* get_layer_lod(PathLevels* pl, int layer, int lod){
+  // lod 0 is the original path, larger lod is coarser
+  // a simplified layer is cached for good, so only call this once the
+  // conversion stopped growing the source path
+  if (layer < 0 || layer >= (int)pl->source->size()) return NULL;
+  if (lod <= 0) return &(*pl->source)[layer];
+  if (lod > PATH_MAX_LOD) lod = PATH_MAX_LOD;
+
+  if ((int)pl->levels.size() < lod){
+    pl->levels.resize(lod);
+    pl->ready.resize(lod);
+  }
+  vector< vector<PathVector> > &level = pl->levels[lod - 1];
+  vector<char> &ready = pl->ready[lod - 1];
+  if (level.size() < pl->source->size()){
+    // source still grows while converting, new layers are not ready yet
+    level.resize(pl->source->size());
+    ready.resize(pl->source->size(), 0);
+  }
+  if (!ready[layer]){
+    simplify_layer((*pl->source)[layer], powf(4, lod - 1), level[layer]);
+    ready[layer] = 1;
+  }
+  return &level[layer];
+}
+
+int get_path_range(PathLevels* pl, int start, int end, int lod, vector< vector< PathVector > >* output){
+  // copy layers [start, end) at the given lod into output, end < 0 means to the last layer
+  // lod is clamped to [0, PATH_MAX_LOD]
+  int layer_count = pl->source->size();
+  if (lod < 0) lod = 0;
+  if (lod > PATH_MAX_LOD) lod = PATH_MAX_LOD;
+  if (end < 0 || end > layer_count) end = layer_count;
+  if (start < 0) start = 0;
+  output->clear();
+  if (start >= end) return 0;
+  output->reserve(end - start);
+  for (int layer = start; layer < end; layer++){
+    output->push_back(*get_layer_lod(pl, layer, lod));
+  }
+  return end - start;
+}
+
+struct PathWorker{
+  // Serializes finished preview layers into js on its own thread while
+  // g2f is still converting. The converting thread is the only producer,
+  // layers travel through a single-producer single-consumer ring.
+  struct Item{
+    const PathVector* data;
+    size_t size;
+  };
+  Item queue[PATH_QUEUE_SIZE];
+  std::atomic<size_t> head;  // next item to consume, written by worker
+  std::atomic<size_t> tail;  // next free slot, written by producer
+  std::atomic<bool> closed;
+  // the worker sleeps on wake while the ring is empty, sleeping tells the
+  // producer to notify, so pushes to an awake worker take no lock
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::atomic<bool> sleeping;
+  size_t layers;
+  std::string js;
+  std::thread thread;
+};
+
+static void wake_path_worker(PathWorker* w){
+  // tail or closed is stored before sleeping is read and the worker sets
+  // sleeping before reading them (all sequentially consistent), so either
+  // the worker sees the change or this sees it sleeping; taking the mutex
+  // then makes sure it is waiting before the notification
+  if (!w->sleeping.load()) return;
+  { std::lock_guard<std::mutex> lock(w->mutex); }
+  w->wake.notify_one();
+}
+
+void path_worker_run(PathWorker* w){
+  size_t head = 0;
+  w->js = "[";
+  while (true){
+    if (head == w->tail.load(std::memory_order_acquire)){
+      if (w->closed.load(std::memory_order_acquire) && head == w->tail.load(std::memory_order_acquire)) break;
+      std::unique_lock<std::mutex> lock(w->mutex);
+      w->sleeping.store(true);
+      w->wake.wait(lock, [&]{
+        return head != w->tail.load() || w->closed.load();
+      });
+      w->sleeping.store(false);
+      continue;
+    }
+    PathWorker::Item item = w->queue[head % PATH_QUEUE_SIZE];
+    if (w->layers) w->js += ",";
+    append_layer_js(w->js, item.data, item.size);
+    w->layers++;
+    head++;
+    w->head.store(head, std::memory_order_release);
+  }
+  w->js += "]";
+}
+
+PathWorker* createPathWorker(){
+  PathWorker* w = new PathWorker;
+  w->head = 0;
+  w->tail = 0;
+  w->closed = false;
+  w->sleeping = false;
+  w->layers = 0;
+  w->thread = std::thread(path_worker_run, w);
+  return w;
+}
+
+void path_worker_push(PathWorker* w, const PathVector* data, size_t size){
+  // data must not change anymore, the buffer of a finished layer stays in
+  // place even when native_path itself reallocates
+  size_t tail = w->tail.load(std::memory_order_relaxed);
+  while (tail - w->head.load(std::memory_order_acquire) >= PATH_QUEUE_SIZE){
+    std::this_thread::yield();
+  }
+  w->queue[tail % PATH_QUEUE_SIZE].data = data;
+  w->queue[tail % PATH_QUEUE_SIZE].size = size;
+  w->tail.store(tail + 1);
+  wake_path_worker(w);
+}
+
+void close_path_worker(FCode* fc){
+  // the last layer is finished once the whole gcode is converted
+  if (fc->path_worker == NULL || fc->path_worker->closed) return;
+  vector<PathVector> &last = fc->native_path->back();
+  path_worker_push(fc->path_worker, last.data(), last.size());
+  fc->path_worker->closed.store(true);
+  wake_path_worker(fc->path_worker);
+}
+
+const char* path_worker_js(PathWorker* w, size_t* length){
+  // block until every pushed layer is serialized
+  // NULL without a worker or before close_path_worker
+  if (w == NULL || !w->closed) return NULL;
+  if (w->thread.joinable()) w->thread.join();
+  *length = w->js.size();
+  return w->js.c_str();
+}
+
+void freePathWorker(PathWorker* w){
+  if (w == NULL) return;
+  w->closed = true;
+  wake_path_worker(w);
+  if (w->thread.joinable()) w->thread.join();
+  delete w;
 }
@@ -3,5 +3,37 @@
 #include <string>
 #include "g2f_module.h"
 
+#ifndef UtilsModuleHeader
+
+#define UtilsModuleHeader
+
 std::string path_to_js(std::vector< std::vector< std::vector<float> > > output);
-std::string path_to_js_cpp(std::vector< std::vector< PathVector > >* output);
\ No newline at end of file
+std::string path_to_js_cpp(std::vector< std::vector< PathVector > >* output);
+std::string path_to_bin_cpp(std::vector< std::vector< PathVector > >* output, float quantum);
+
+typedef struct{
+  std::vector< std::vector<PathVector> >* source;
+  // levels[lod - 1][layer], filled lazily, ready marks the computed layers
+  std::vector< std::vector< std::vector<PathVector> > > levels;
+  std::vector< std::vector<char> > ready;
+} PathLevels;
+
+// simplified layers are cached and never recomputed,
+// the source path must be complete before the first query
+// coarsest level of detail, larger lod is clamped to it
+#define PATH_MAX_LOD 8
+PathLevels* createPathLevels(std::vector< std::vector< PathVector > >* source);
+void freePathLevels(PathLevels* pl);
+std::vector<PathVector>* get_layer_lod(PathLevels* pl, int layer, int lod);
+int get_path_range(PathLevels* pl, int start, int end, int lod, std::vector< std::vector< PathVector > >* output);
+#define PATH_QUEUE_SIZE 1024
+
+PathWorker* createPathWorker();
+void path_worker_push(PathWorker* w, const PathVector* data, size_t size);
+void close_path_worker(FCode* fc);
+const char* path_worker_js(PathWorker* w, size_t* length);
+void freePathWorker(PathWorker* w);
+
+void simplify_layer(std::vector<PathVector> &layer, float tolerance_scale, std::vector<PathVector> &output);
+
+#endif
@@ -4,11 +4,15 @@ import pytest
 import sys
 import os
 from time import sleep
+import threading
 import unittest
 import random
 import string
 
+import numpy as np
+
 from fluxclient.printer.stl_slicer import StlSlicer
+from fluxclient.printer import _printer
 
 
 @pytest.fixture(scope="module", params=["tests/printer/data/cube_ascii.stl", "tests/printer/data/cube.stl"])
@@ -23,6 +27,36 @@ def obj_binary(request):
     return buf
 
 
+@pytest.fixture(scope="module")
+def octahedron():
+    points = np.array([[10, 0, 0], [0, 10, 0], [-10, 0, 0], [0, -10, 0], [0, 0, 10], [0, 0, -10]], dtype=np.float32)
+    faces = np.array([[0, 1, 4], [1, 2, 4], [2, 3, 4], [3, 0, 4],
+                      [1, 0, 5], [2, 1, 5], [3, 2, 5], [0, 3, 5]], dtype=np.int32)
+    return points, faces
+
+
+@pytest.fixture(scope="module")
+def grid_mesh():
+    def build(n, z, down=False):
+        # (n - 1) x (n - 1) grid of unit squares, z[in]: height of each point, down[in]: faces point down
+        x, y = np.meshgrid(np.arange(n, dtype=np.float32), np.arange(n, dtype=np.float32))
+        z = np.broadcast_to(z(x, y) if callable(z) else z, x.shape).astype(np.float32)
+        points = np.stack([x.ravel(), y.ravel(), z.ravel()], axis=1)
+        i = (np.arange(n - 1)[:, None] * n + np.arange(n - 1)).ravel()
+        if down:
+            faces = np.concatenate([np.stack([i, i + n + 1, i + 1], axis=1), np.stack([i, i + n, i + n + 1], axis=1)])
+        else:
+            faces = np.concatenate([np.stack([i, i + 1, i + n + 1], axis=1), np.stack([i, i + n + 1, i + n], axis=1)])
+        return _printer.MeshObj(points, faces)
+    return build
+
+
+@pytest.fixture(autouse=True)
+def fcode_cache_dir(tmpdir, monkeypatch):
+    # converted fcode is cached in tmpdir instead of the home directory
+    monkeypatch.setenv('FLUX_FCODE_CACHE', str(tmpdir.join('fcode_cache')))
+
+
 @pytest.fixture(scope="module")
 def img_buf(request):
     buf = open('tests/printer/data/worden.jpg', 'rb').read()
@@ -44,11 +78,346 @@ class TestPrinter:
         assert _stl_slicer.slic3r == k
 
     def test_read_stl(self, stl_binary):
-        StlSlicer.read_stl(stl_binary)
+        mesh = StlSlicer.read_stl(stl_binary)
+        assert len(mesh) > 0
+        assert mesh.bounding_box()[0][2] == 0
+
+    def test_read_stl_file(self):
+        a = StlSlicer.read_stl("tests/printer/data/cube.stl")
+        b = StlSlicer.read_stl(open("tests/printer/data/cube.stl", 'rb').read())
+        assert len(a) == len(b) == 12
+        assert a.bounding_box() == b.bounding_box()
+
+        with pytest.raises(ValueError):
+            StlSlicer.read_stl(b'solid broken\n  facet normal 0 0\n')
+        with pytest.raises(IOError):
+            StlSlicer.read_stl("tests/printer/data/not_exist.stl")
 
     def test_read_obj(self, obj_binary):
         StlSlicer.read_obj(obj_binary)
 
+    def test_mesh_from_numpy(self):
+        points = np.array([[0, 0, 0], [1, 0, 0], [0, 1, 0], [0, 0, 1]], dtype=np.float32)
+        faces = np.array([[0, 2, 1], [0, 1, 3], [0, 3, 2], [1, 2, 3]], dtype=np.int32)
+        mesh = _printer.MeshObj(points, faces)
+        assert len(mesh) == 4
+        assert mesh.bounding_box() == [[0, 0, 0], [1, 1, 1]]
+
+        # same mesh from python lists and flat faces
+        assert len(_printer.MeshObj(_printer.MeshCloud(points.tolist()), faces.tolist())) == 4
+        assert len(_printer.MeshObj(points, faces.ravel())) == 4
+
+        with pytest.raises(ValueError):
+            _printer.MeshObj(points, [[0, 1, 4]])
+
+    def test_export_arrays(self):
+        mesh = _printer.MeshObj.from_stl("tests/printer/data/cube.stl")
+        tri = mesh.triangles()
+        assert tri.shape == (12, 3, 3) and tri.dtype == np.float32
+        points, faces = mesh.arrays()
+        assert points.shape == (8, 3) and faces.shape == (12, 3)
+        assert (points[faces] == tri).all()
+
+        # round trip through arrays
+        again = _printer.MeshObj(points, faces)
+        assert (again.triangles() == tri).all()
+        assert _printer.MeshObj().triangles().shape == (0, 3, 3)
+
+    def test_transform_bounds(self):
+        rng = np.random.RandomState(0)
+        points = (rng.rand(1001, 3) * 20).astype(np.float32)
+        faces = np.arange(999, dtype=np.int32).reshape(-1, 3)
+        mesh = _printer.MeshObj(points, faces)
+
+        # move to (1, 2, 3) and scale around the bounding box center
+        center = (points.min(axis=0) + points.max(axis=0)) / 2
+        expect = (points - center) * [2, 1, 0.5] + [1, 2, 3]
+        mesh.apply_transform([1, 2, 3, 0, 0, 0, 2, 1, 0.5])
+        b_box = mesh.bounding_box()
+        assert b_box[0] == pytest.approx(expect.min(axis=0), abs=1e-4)
+        assert b_box[1] == pytest.approx(expect.max(axis=0), abs=1e-4)
+
+        # a quarter turn around z swaps the x and y extent
+        mesh.apply_transform([0, 0, 0, 0, 0, np.pi / 2, 1, 1, 1])
+        size = np.subtract(*mesh.bounding_box()[::-1])
+        assert size == pytest.approx(np.ptp(expect, axis=0)[[1, 0, 2]], abs=1e-4)
+
+        # bounds of add_on cover both meshes
+        other = _printer.MeshObj(points + 100, faces)
+        b_box = mesh.bounding_box()
+        mesh.add_on(other)
+        assert mesh.bounding_box()[0] == b_box[0]
+        assert mesh.bounding_box()[1] == pytest.approx(points.max(axis=0) + 100)
+
+    def test_cut_watertight(self, tmpdir, octahedron):
+        # octahedron, the plane crosses 4 edges of the lower half
+        points, faces = octahedron
+        mesh = _printer.MeshObj(points, faces).cut(-4)
+        assert len(mesh) == 12
+        assert mesh.bounding_box() == [[-10, -10, -4], [10, 10, 10]]
+
+        # every edge is shared with opposite direction, except the loop on the plane
+        path = str(tmpdir.join("cut.stl"))
+        mesh.write_stl(path)
+        facet = np.dtype([('normal', '<f4', 3), ('v', '<f4', (3, 3)), ('attr', '<u2')])
+        facets = np.fromfile(path, dtype=facet, offset=84)['v']
+        edges = set()
+        for tri in facets.tolist():
+            for j in range(3):
+                edges.add((tuple(tri[j]), tuple(tri[(j + 1) % 3])))
+        border = [e for e in edges if (e[1], e[0]) not in edges]
+        assert len(border) == 4
+        assert all(e[0][2] == e[1][2] == -4 for e in border)
+
+    def test_topology(self, octahedron):
+        points, faces = octahedron
+        octa = _printer.MeshObj(points, faces)
+        report = octa.manifold_report()
+        assert report['watertight'] and report['components'] == 1
+
+        # the loop left by cutting
+        report = octa.cut(-4).manifold_report()
+        assert report['boundary_edges'] == 4 and report['boundary_loops'] == 1
+        assert not report['watertight']
+
+        # two copies side by side, then a face hanging on an edge of the first
+        pair = _printer.MeshObj(np.concatenate([points, points + 30]), np.concatenate([faces, faces + 6]))
+        parts = pair.split_components()
+        assert [len(p) for p in parts] == [8, 8]
+        assert (parts[1].triangles() == (points + 30)[faces]).all()
+        assert pair.manifold_report()['components'] == 2
+
+        pair = _printer.MeshObj(np.concatenate([points, points + 30]), np.concatenate([faces, faces + 6, [[0, 1, 6]]]))
+        report = pair.manifold_report()
+        assert report['components'] == 2 and report['non_manifold_edges'] == 1
+
+        # winding of one face turned over
+        flipped = faces.copy()
+        flipped[0] = flipped[0][::-1]
+        assert _printer.MeshObj(points, flipped).manifold_report()['flipped_edges'] == 3
+
+    def test_decimate(self, grid_mesh):
+        # flat 40 x 40 grid with a bump in the middle
+        mesh = grid_mesh(41, lambda x, y: np.where((np.abs(x - 20) < 3) & (np.abs(y - 20) < 3), 5, 0))
+
+        # nothing moves off the surface, the border and the bump stay
+        flat = mesh.decimate(max_error=1e-3)
+        assert len(flat) < len(mesh) / 10
+        assert flat.bounding_box() == mesh.bounding_box()
+        report = flat.manifold_report()
+        assert report['boundary_loops'] == 1 and report['non_manifold_edges'] == 0 and report['flipped_edges'] == 0
+        assert set(np.unique(flat.arrays()[0][:, 2])) == {0, 5}
+
+        assert len(mesh.decimate(200)) <= 200
+        with pytest.raises(ValueError):
+            mesh.decimate()
+
+    def test_add_support(self, grid_mesh):
+        # 10 x 10 floating plate at z 10, faces point down
+        mesh = grid_mesh(11, 10, down=True)
+
+        task = _printer.SupportTask()
+        support = mesh.add_support(np.pi / 4, 1, task)
+        assert task.progress == 1 and not task.cancelled
+        assert len(support) > 0
+        (b_min, b_max) = support.bounding_box()
+        assert b_min[2] == 0 and b_max[2] <= 10
+        # struts share the vertices of their rings
+        points, faces = support.arrays()
+        assert len(points) < len(faces) and faces.max() == len(points) - 1
+
+        # moved on the plate, the cached struts are moved along
+        cache = _printer.SupportCache()
+        assert np.array_equal(mesh.add_support(np.pi / 4, 1, None, cache).arrays()[0], points)
+        moved = mesh.copy()
+        moved.apply_transform([25, 30, 10, 0, 0, 0, 1, 1, 1])
+        moved_points, moved_faces = moved.add_support(np.pi / 4, 1, None, cache).arrays()
+        assert np.array_equal(moved_faces, faces)
+        assert moved_points == pytest.approx(points + [20, 25, 0], abs=1e-4)
+        # lifted, the struts are grown again down to the plate
+        moved.apply_transform([30, 35, 15, 0, 0, np.pi / 2, 1, 1, 1])
+        (b_min, b_max) = moved.add_support(np.pi / 4, 1, None, cache).bounding_box()
+        assert b_min[2] == pytest.approx(0, abs=1e-4) and b_max[2] == pytest.approx(15)
+
+        # a cache is used by one add_support at a time, the worker only leaves add_support
+        # with the gil, which this thread keeps from seeing the cache busy until the check
+        task = _printer.SupportTask()
+        worker = threading.Thread(target=mesh.add_support, args=(np.pi / 4, 1, task, cache))
+        switch_interval = sys.getswitchinterval()
+        sys.setswitchinterval(1000)
+        try:
+            worker.start()
+            while not cache.busy:
+                sleep(0.001)
+            assert worker.is_alive()
+            with pytest.raises(RuntimeError):
+                mesh.add_support(np.pi / 4, 1, None, cache)
+            task.cancel()
+        finally:
+            sys.setswitchinterval(switch_interval)
+        worker.join()
+        assert not cache.busy
+        assert len(mesh.add_support(np.pi / 4, 1, None, cache)) > 0
+
+        task = _printer.SupportTask()
+        task.cancel()
+        assert mesh.add_support(np.pi / 4, 1, task) is None
+        with pytest.raises(ValueError):
+            mesh.add_support(0)
+        with pytest.raises(ValueError, match='too small'):
+            mesh.add_support(np.pi / 4, 1e-6)
+
+    def test_best_orientations(self, octahedron):
+        # octahedron, best put down on a face: nothing overhangs and it's lower than on a vertex
+        points, faces = octahedron
+        octa = _printer.MeshObj(points, faces)
+        best = octa.best_orientations(3)
+        assert len(best) == 3 and best[0]['cost'] <= best[1]['cost'] <= best[2]['cost']
+        assert best[0]['overhang'] == 0 and best[0]['contact'] == pytest.approx(50 * np.sqrt(3), rel=1e-4)
+        assert best[0]['height'] == pytest.approx(20 / np.sqrt(3), rel=1e-4)
+        rx, ry, rz = best[0]['rotation']
+        octa.apply_transform([0, 0, 0, rx, ry, rz, 1, 1, 1])
+        z = np.sort(octa.arrays()[0][:, 2])
+        assert z[:3] == pytest.approx([z[0]] * 3, abs=1e-4)
+
+        assert octa.best_orientations(0) == []
+        with pytest.raises(ValueError):
+            octa.best_orientations(1, 0)
+
+    def test_arrange(self, stl_binary):
+        _stl_slicer = StlSlicer('')
+        _stl_slicer.upload('a', stl_binary)
+        for n in 'bcd':
+            _stl_slicer.duplicate('a', n)
+        _stl_slicer.set('a', [0, 0, 4.5, 0, 0, 0, 1, 1, 1])
+        result = _stl_slicer.arrange(spacing=2)
+        assert sorted(result) == ['a', 'b', 'c', 'd'] and result['a'][2] == 4.5
+        assert all(_stl_slicer.parameter[n] == result[n] for n in result)
+
+        # cubes are at least a side plus the spacing apart, all of them on the plate
+        (b_min, b_max) = _stl_slicer.models['a'].bounding_box()
+        centers = np.array([result[n][:2] for n in 'abcd'])
+        d = np.linalg.norm(centers[:, None] - centers[None], axis=2)
+        assert d[np.triu_indices(4, 1)].min() >= b_max[0] - b_min[0] + 2 - 1e-3
+        points = _stl_slicer.merge_models(list('abcd')).merge().arrays()[0]
+        assert np.linalg.norm(points[:, :2], axis=1).max() <= 86
+
+        # no room for a model larger than the plate
+        _stl_slicer.set('b', [0, 0, 4.5, 0, 0, 0, 20, 20, 1])
+        assert _stl_slicer.arrange(['b'])['b'] is None
+
+    def test_mesh_instances(self, stl_binary, tmpdir):
+        _stl_slicer = StlSlicer('')
+        _stl_slicer.upload('a', stl_binary)
+        _stl_slicer.duplicate('a', 'b')
+        _stl_slicer.duplicate('a', 'c')
+        _stl_slicer.set('a', [10, 0, 4, 0.3, 0, 0.5, 1, 1, 1])
+        _stl_slicer.set('b', [-10, 5, 4, 0.3, 0, 2, 1, 1, 1])
+        _stl_slicer.set('c', [0, -20, 4, 0, 0, 0, 1, 1, 1])
+        _stl_slicer.config['cut_bottom'] = '1'
+
+        # same geometry as transforming a copy of each model, merging and cutting
+        expected = None
+        for n in 'abc':
+            m_mesh = _stl_slicer.models[n].copy()
+            m_mesh.apply_transform(_stl_slicer.parameter[n])
+            if expected is None:
+                expected = m_mesh
+            else:
+                expected.add_on(m_mesh)
+        expected = expected.cut(1)
+
+        instances = _stl_slicer.merge_models(list('abc'))
+        assert len(instances) == len(expected)
+        assert np.array(instances.bounding_box()) == pytest.approx(np.array(expected.bounding_box()), abs=1e-4)
+        assert np.sort(instances.merge().triangles().reshape(-1, 9), axis=0) == pytest.approx(np.sort(expected.triangles().reshape(-1, 9), axis=0), abs=1e-4)
+
+        # written in one stream, same faces as the expanded mesh
+        path = str(tmpdir.join("instances.stl"))
+        instances.write_stl(path)
+        data = open(path, 'rb').read()
+        assert len(data) == 84 + 50 * len(expected)
+        assert np.frombuffer(data[84:], dtype=np.dtype([('n', '<f4', 3), ('p', '<f4', 9), ('a', '<u2')]))['p'] == pytest.approx(instances.merge().triangles().reshape(-1, 9), abs=1e-4)
+        with pytest.raises(IOError):
+            instances.write_stl(str(tmpdir.join("not_exist", "a.stl")))
+
+    def test_preview(self, stl_binary):
+        _stl_slicer = StlSlicer('')
+        assert _stl_slicer.preview('tmp') is None
+        _stl_slicer.upload('tmp', stl_binary)
+        buf = _stl_slicer.preview('tmp')
+        assert len(buf) == 84 + 50 * len(_stl_slicer.models['tmp'])
+        assert len(_stl_slicer.preview('tmp', 4)) < len(buf)
+
+    def test_slice_layers(self, octahedron):
+        mesh = _printer.MeshObj.from_stl("tests/printer/data/cube.stl")
+        (b_min, b_max) = mesh.bounding_box()
+        mid = (b_min[2] + b_max[2]) / 2
+        layers = mesh.slice_layers([mid, b_max[2] + 1])
+        polygons, open_chains = layers[0]
+        assert len(polygons) == 1 and open_chains == []
+        # each side is split into 2 faces, so 2 points on each edge of the square
+        assert polygons[0].shape == (8, 2) and polygons[0].dtype == np.float32
+        assert layers[1] == ([], [])
+
+        size = np.subtract(b_max, b_min)
+        stats = mesh.layer_stats([mid])
+        assert stats[0] == pytest.approx([size[0] * size[1], 2 * (size[0] + size[1])])
+
+        # octahedron, the cross section at z is a square of half diagonal 10 - |z|
+        points, faces = octahedron
+        octa = _printer.MeshObj(points, faces)
+        zs = np.array([-5, 0.5, 5])
+        assert octa.layer_stats(zs)[:, 0] == pytest.approx(2 * (10 - np.abs(zs)) ** 2, rel=1e-5)
+
+        with pytest.raises(ValueError):
+            octa.slice_layers([1, 0])
+
+    def test_quick_slice(self, stl_binary):
+        _stl_slicer = StlSlicer('')
+        assert _stl_slicer.quick_slice(['tmp'])[0] is False
+        _stl_slicer.upload('tmp', stl_binary)
+        _stl_slicer.set('tmp', [0, 0, 4.5, 0, 0, 0, 1, 1, 1])
+        flag, metadata = _stl_slicer.quick_slice(['tmp'])
+        assert flag is True
+        assert metadata[0] > 0 and metadata[1] > 0
+
+        # a percentage extrusion width is relative to the layer height
+        _stl_slicer.config['layer_height'] = '0.2'
+        _stl_slicer.config['extrusion_width'] = '0.4'
+        absolute = _stl_slicer.quick_slice(['tmp'])[1]
+        _stl_slicer.config['extrusion_width'] = '200%'
+        assert _stl_slicer.quick_slice(['tmp'])[1] == pytest.approx(absolute)
+
+    def test_write_formats(self, tmpdir):
+        mesh = _printer.MeshObj.from_stl("tests/printer/data/cube.stl")
+        path = str(tmpdir.join("cube.stl"))
+        mesh.write_stl(path)
+        data = mesh.dumps()
+        assert len(data) == 84 + 50 * 12
+        assert bytes(data) == open(path, 'rb').read()
+
+        # to an open file, same bytes
+        with open(str(tmpdir.join("cube2.stl")), 'wb') as f:
+            mesh.write(f)
+        assert open(str(tmpdir.join("cube2.stl")), 'rb').read() == bytes(data)
+
+        ascii = bytes(mesh.dumps('stl_ascii'))
+        assert ascii.startswith(b'solid ascii\n')
+        again = _printer.MeshObj.from_stl(ascii)
+        assert len(again) == 12
+        assert again.bounding_box() == mesh.bounding_box()
+
+        ply = bytes(mesh.dumps('ply'))
+        assert ply.startswith(b'ply\nformat binary_little_endian 1.0\n')
+        assert b'element vertex 8\n' in ply and b'element face 12\n' in ply
+        assert len(ply) == ply.index(b'end_header\n') + 11 + 8 * 12 + 12 * 13
+
+        with pytest.raises(ValueError):
+            mesh.dumps('obj')
+        with pytest.raises(IOError):
+            mesh.write(str(tmpdir.join("not_exist", "cube.stl")))
+
     def test_upload(self, stl_binary):
         _stl_slicer = StlSlicer('')
         assert _stl_slicer.upload('tmp', b'') is False
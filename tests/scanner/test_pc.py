@@ -3,6 +3,9 @@
 import unittest
 import struct
 import os
+from io import BytesIO
+
+import numpy as np
 
 from PIL import Image
 
@@ -84,3 +87,11 @@ class scan_toolTest(unittest.TestCase):
             tmp = tools.normalize(i)
             for k in range(3):
                 self.assertAlmostEqual(tmp[k], j[k])
+
+    def test_write_stl_numpy(self):
+        tri = np.random.RandomState(0).rand(50, 3, 3).astype(np.float32) * 10
+        tri[0] = 1  # degenerate face, zero normal
+        from_list, from_array = BytesIO(), BytesIO()
+        tools.write_stl(tri.tolist(), from_list)
+        tools.write_stl(tri, from_array)
+        self.assertEqual(from_list.getvalue(), from_array.getvalue())
@@ -0,0 +1,88 @@
+from io import BytesIO
+import tempfile
+import shutil
+import os
+import unittest
+
+from fluxclient.fcode.cache import FcodeCache
+from fluxclient.utils._utils import GcodeToFcodeCpp
+
+from tests.utils.test_g2f_preview import sample_gcode
+
+
+class TestFcodeCache(unittest.TestCase):
+    def setUp(self):
+        self.root = tempfile.mkdtemp()
+        self.cache = FcodeCache(os.path.join(self.root, 'cache'))
+        self.gcode_file = os.path.join(self.root, 'input.gcode')
+        with open(self.gcode_file, 'w') as f:
+            f.writelines(sample_gcode())
+
+    def tearDown(self):
+        shutil.rmtree(self.root)
+
+    def convert(self, **kwargs):
+        g2f = GcodeToFcodeCpp(ext_metadata=kwargs.get('ext_metadata', {}))
+        g2f.engine = 'cura'
+        g2f.pause_at_layers = kwargs.get('pause_at_layers', [])
+        output = BytesIO()
+        entry = self.cache.process(g2f, self.gcode_file, output)
+        return entry, g2f, output.getvalue()
+
+    def test_hit_returns_same_conversion(self):
+        entry, g2f, fcode = self.convert()
+        self.assertIsNone(entry)
+        path_js = g2f.get_path('js')
+
+        entry, g2f_hit, fcode_hit = self.convert()
+        self.assertIsNotNone(entry)
+        self.assertEqual(fcode_hit, fcode)
+        self.assertEqual(entry['path_js'], path_js)
+        self.assertEqual(entry['path_bin'], g2f.get_path('bin'))
+        self.assertEqual(g2f_hit.md, g2f.md)
+
+    def test_params_change_key(self):
+        self.convert()
+        entry, _, _ = self.convert(pause_at_layers=[2])
+        self.assertIsNone(entry)
+        entry, _, _ = self.convert(ext_metadata={'CORRECTION': 'N'})
+        self.assertIsNone(entry)
+        self.assertNotEqual(FcodeCache.make_key(b'G28\n'), FcodeCache.make_key(b'G28\n', head_type='LASER'))
+        self.assertNotEqual(FcodeCache.make_key(b'G28\n', engine='cura'), FcodeCache.make_key(b'G28\n', engine='slic3r'))
+        self.assertNotEqual(FcodeCache.make_key(b'G28\n'), FcodeCache.make_key(b'G28\n', record_path=False))
+
+    def test_revision_changes_key(self):
+        from fluxclient.fcode import cache
+        key = FcodeCache.make_key(b'G28\n')
+        cache.CONVERTER_REVISION += 1
+        try:
+            self.assertNotEqual(FcodeCache.make_key(b'G28\n'), key)
+        finally:
+            cache.CONVERTER_REVISION -= 1
+
+    def test_engine_changes_key(self):
+        self.convert()
+        g2f = GcodeToFcodeCpp()
+        g2f.engine = 'slic3r'
+        self.assertIsNone(self.cache.process(g2f, self.gcode_file, BytesIO()))
+
+    def test_broken_entry_is_a_miss(self):
+        key = FcodeCache.make_key(b'G28\n')
+        self.cache.put(key, b'fcode', {'TIME_COST': 1})
+        with open(self.cache._entry_path(key), 'r+b') as f:
+            f.truncate(10)
+        self.assertIsNone(self.cache.get(key))
+        self.assertFalse(os.path.exists(self.cache._entry_path(key)))
+
+    def test_lru_eviction(self):
+        self.cache.max_size = 3300
+        keys = [FcodeCache.make_key(str(i).encode()) for i in range(3)]
+        for i, key in enumerate(keys):
+            self.cache.put(key, b'x' * 1000, {})
+            os.utime(self.cache._entry_path(key), (i, i))
+        self.assertIsNotNone(self.cache.get(keys[0]))  # touch, keys[1] is the oldest now
+
+        self.cache.put(FcodeCache.make_key(b'new'), b'x' * 1000, {})
+        self.assertIsNone(self.cache.get(keys[1]))
+        self.assertIsNotNone(self.cache.get(keys[0]))
+        self.assertEqual([n for n in os.listdir(self.cache.root) if n.endswith('.tmp')], [])
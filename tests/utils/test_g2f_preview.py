@@ -0,0 +1,190 @@
+from io import BytesIO
+import struct
+import json
+import unittest
+
+from fluxclient.utils._utils import GcodeToFcodeCpp, NativePath, Tools
+
+
+def sample_gcode(layers=3, points=20):
+    lines = ["G28\n", "G90\n", "M104 S200\n"]
+    for layer in range(layers):
+        lines.append(";LAYER:%d\n" % layer)
+        lines.append("G0 X0 Y0 Z%.2f\n" % (0.2 * (layer + 1)))
+        lines.append(";TYPE:WALL-OUTER\n")
+        for i in range(points):
+            lines.append("G1 X%.2f Y%.2f E%.3f\n" % (i * 0.5, (i % 3) * 0.25, i * 0.01))
+    return lines
+
+
+def decode_bin(buf):
+    magic, layer_count, point_count, quantum, type_size, coord_size = \
+        struct.unpack('<4sIIfII', buf[:24])
+    assert magic == b'FPV1'
+    index = 24
+    counts = struct.unpack('<%dI' % layer_count, buf[index:index + 4 * layer_count])
+    index += 4 * layer_count
+    types = buf[index:index + type_size]
+    index += type_size
+    coords = buf[index:index + coord_size]
+    assert sum(counts) == point_count
+
+    ci, last, n, path = 0, [0, 0, 0], 0, []
+    for count in counts:
+        layer = []
+        for _ in range(count):
+            t = (types[n // 2] >> (4 * (n % 2))) & 0x0f
+            d = struct.unpack('<3h', coords[ci:ci + 6])
+            if d[0] == -32768:
+                d = struct.unpack('<3i', coords[ci + 2:ci + 14])
+                ci += 14
+            else:
+                ci += 6
+            last = [last[j] + d[j] for j in range(3)]
+            layer.append([round(v * quantum, 2) for v in last] + [t - 1])
+            n += 1
+        path.append(layer)
+    assert ci == coord_size
+    return path
+
+
+class TestPathPreview(unittest.TestCase):
+    def setUp(self):
+        self.g2f = GcodeToFcodeCpp()
+        self.g2f.engine = 'cura'
+        self.g2f.process(iter(sample_gcode()), BytesIO())
+
+    def test_bin_matches_js(self):
+        js = json.loads(self.g2f.get_path('js'))
+        self.assertEqual(decode_bin(self.g2f.get_path('bin')), js)
+
+    def test_bin_from_list(self):
+        path = [[[0.0, 0.0, 240.0, 3]], [[1.5, -2.25, 0.2, 1], [120.0, -80.0, 0.2, 0]]]
+        self.assertEqual(decode_bin(Tools().path_to_bin(path)), path)
+
+    def test_layer_range(self):
+        full = json.loads(self.g2f.get_path('js'))
+        self.assertEqual(self.g2f.layer_count(), len(full))
+        self.assertEqual(json.loads(self.g2f.get_path_range(1, 3)), full[1:3])
+        self.assertEqual(json.loads(self.g2f.get_path_range(2)), full[2:])
+        self.assertEqual(decode_bin(self.g2f.get_path_range(1, 3, path_type='bin')), full[1:3])
+
+    def test_range_before_process(self):
+        g2f = GcodeToFcodeCpp()
+        self.assertEqual(g2f.layer_count(), 0)
+        self.assertEqual(g2f.get_path_range(), '[]')
+        self.assertEqual(len(NativePath()), 0)
+        self.assertEqual(NativePath().get_layers(), '[]')
+
+    def test_path_before_process(self):
+        self.assertIsNone(GcodeToFcodeCpp().get_path('js'))
+        self.assertIsNone(GcodeToFcodeCpp().get_path('bin'))
+
+    def test_process_again(self):
+        js = self.g2f.get_path('js')
+        self.g2f.process(iter(sample_gcode(layers=2)), BytesIO())
+        self.assertNotEqual(self.g2f.get_path('js'), js)
+        self.assertEqual(self.g2f.layer_count(), len(json.loads(self.g2f.get_path('js'))))
+
+    def test_broken_input_closes_worker(self):
+        def lines():
+            yield from sample_gcode()
+            raise IOError('gone')
+        g2f = GcodeToFcodeCpp()
+        g2f.engine = 'cura'
+        self.assertEqual(g2f.process(lines(), BytesIO()), 'broken')
+        self.assertEqual(len(json.loads(g2f.get_path('js'))), g2f.layer_count())
+
+    def test_lod_keeps_type_boundaries(self):
+        full = json.loads(self.g2f.get_path('js'))
+        coarse = json.loads(self.g2f.get_path_range(lod=3))
+        self.assertEqual(len(coarse), len(full))
+        for layer, simple in zip(full, coarse):
+            self.assertLessEqual(len(simple), len(layer))
+            if layer:
+                self.assertEqual(simple[0], layer[0])
+                self.assertEqual(simple[-1], layer[-1])
+            boundaries = [p for i, p in enumerate(layer[:-1]) if p[3] != layer[i + 1][3]]
+            for p in boundaries:
+                self.assertIn(p, simple)
+        # cached levels return the same result
+        self.assertEqual(json.loads(self.g2f.get_path_range(lod=3)), coarse)
+        # levels past the coarsest one are clamped to it
+        self.assertEqual(self.g2f.get_path_range(lod=1 << 30), self.g2f.get_path_range(lod=8))
+
+    def test_js_built_while_converting(self):
+        # more layers than the path worker queue holds
+        g2f = GcodeToFcodeCpp()
+        g2f.engine = 'cura'
+        g2f.process(iter(sample_gcode(layers=1500, points=2)), BytesIO())
+        js = json.loads(g2f.get_path('js'))
+        self.assertEqual(len(js), g2f.layer_count())
+        self.assertEqual(decode_bin(g2f.get_path('bin')), js)
+
+
+def fcode_commands(buf):
+    # list non-move commands in fcode script as (cmd, float argument or None)
+    script_len = struct.unpack('<I', buf[8:12])[0]
+    script, i, result = buf[12:12 + script_len], 0, []
+    while i < len(script):
+        cmd = script[i]
+        i += 1
+        if cmd & 128:
+            i += 4 * bin(cmd & 127).count('1')
+        elif cmd in (4, 32) or 16 <= cmd < 32 or 48 <= cmd < 56:
+            result.append((cmd, round(struct.unpack('<f', script[i:i + 4])[0], 2)))
+            i += 4
+        else:
+            result.append((cmd, None))
+    return result
+
+
+class TestLayerEvents(unittest.TestCase):
+    def convert(self, config):
+        g2f = GcodeToFcodeCpp()
+        g2f.engine = 'cura'
+        g2f.config = config
+        output = BytesIO()
+        g2f.process(iter(sample_gcode(layers=5, points=4)), output)
+        return fcode_commands(output.getvalue())
+
+    def test_pause_and_temperature(self):
+        cmds = self.convert({'pause_at_layers': '2', 'temperature': '210'})
+        self.assertEqual(cmds, [(1, None), (2, None), (16, 200.0), (5, None), (16, 210.0)])
+
+    def test_config_layer_events(self):
+        cmds = self.convert({'layer_events': '4:fan:0.5, 3:opcode:4:500, 4:temperature:220:1, 3:pause'})
+        self.assertEqual(cmds, [(1, None), (2, None), (16, 200.0),
+                                (4, 500.0), (5, None), (48, 0.5), (17, 220.0)])
+
+    def test_bad_layer_event(self):
+        with self.assertRaises(ValueError):
+            GcodeToFcodeCpp().parse_layer_events('3:explode')
+        with self.assertRaises(ValueError):
+            GcodeToFcodeCpp().add_layer_event(3, 'opcode', code=256)
+        with self.assertRaises(ValueError):
+            GcodeToFcodeCpp().add_layer_event(3, 'opcode')
+        with self.assertRaises(ValueError):
+            GcodeToFcodeCpp().parse_layer_events('20:temperature:215:8')
+
+    def test_pause_once(self):
+        cmds = self.convert({'pause_at_layers': '3', 'layer_events': '3:pause'})
+        self.assertEqual(cmds.count((5, None)), 1)
+
+    def test_many_events_on_a_layer(self):
+        # more events than fit before one move are spread over the next ones
+        cmds = self.convert({'layer_events': ','.join(['3:fan:0.5'] * 300)})
+        self.assertEqual(cmds.count((48, 0.5)), 300)
+
+    def test_process_twice_same_events(self):
+        g2f = GcodeToFcodeCpp()
+        g2f.engine = 'cura'
+        g2f.config = {'pause_at_layers': '2', 'temperature': '210', 'layer_events': '3:opcode:4:500'}
+        g2f.add_layer_event(4, 'fan', 0.5)
+        outputs = []
+        for _ in range(2):
+            output = BytesIO()
+            g2f.process(iter(sample_gcode(layers=5, points=4)), output)
+            outputs.append(fcode_commands(output.getvalue()))
+        self.assertEqual(outputs[0], outputs[1])
+        self.assertEqual(len(g2f.layer_events), 1)